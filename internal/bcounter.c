@@ -0,0 +1,212 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#include "nsync_cpp.h"
+#include "platform.h"
+#include "compiler.h"
+#include "cputype.h"
+#include "nsync.h"
+#include "nsync_bcounter.h"
+#include "atomic.h"
+#include "dll.h"
+#include "sem.h"
+#include "wait_internal.h"
+#include "common.h"
+
+NSYNC_CPP_START_
+
+/* Implementation notes
+
+   Waiters are queued in order of decreasing threshold, held in
+   nw.wait_arg, so a decrement wakes a prefix of the queue.  wake_at is one
+   more than the threshold of the first waiter, or zero if there are none,
+   so a change that leaves the value at least wake_at needs no lock.
+
+   A decrement that may reach a waiter's threshold takes mu before its
+   CAS.  Since a waiter may be queued between the decrement's check of
+   wake_at and its CAS, the decrement checks wake_at again afterwards.  */
+
+/* Internal details of nsync_bcounter. */
+struct nsync_bcounter_s_ {
+	nsync_atomic_uint32_ value;    /* value of counter */
+	nsync_atomic_uint32_ wake_at;  /* 1 + first waiter's threshold, or 0; written under mu */
+	nsync_mu mu;                   /* protects waiters and writes of wake_at */
+	nsync_dll_list_ waiters;       /* of struct nsync_waiter_s, by decreasing threshold */
+};
+
+nsync_bcounter nsync_bcounter_new (uint32_t value) {
+	nsync_bcounter b = (nsync_bcounter) malloc (sizeof (*b));
+	if (b != NULL) {
+		memset ((void *) b, 0, sizeof (*b));
+		ATM_STORE (&b->value, value);
+		nsync_mu_init (&b->mu);
+	}
+	return (b);
+}
+
+void nsync_bcounter_free (nsync_bcounter b) {
+	nsync_mu_lock (&b->mu);
+	ASSERT (nsync_dll_is_empty_ (b->waiters));
+	nsync_mu_unlock (&b->mu);
+	free (b);
+}
+
+/* Set b->wake_at from the first waiter of b.  b->mu is held. */
+static void bcounter_set_wake_at (nsync_bcounter b) {
+	nsync_dll_element_ *p = nsync_dll_first_ (b->waiters);
+	ATM_STORE (&b->wake_at, p == NULL? 0 : DLL_NSYNC_WAITER (p)->wait_arg + 1);
+}
+
+uint32_t nsync_bcounter_add (nsync_bcounter b, int32_t delta) {
+	uint32_t value;
+	IGNORE_RACES_START ();
+	if (delta >= 0) {
+		do {
+			value = ATM_LOAD (&b->value);
+		} while (!ATM_CAS_RELACQ (&b->value, value, value+delta));
+		value += delta;
+		ASSERT (value >= (uint32_t) delta); /* Crash on overflow. */
+	} else {
+		uint32_t wake_at = ATM_LOAD (&b->wake_at);
+		int locked = 0;
+		do {
+			value = ATM_LOAD (&b->value);
+			if (!locked && value + delta < wake_at) {
+				nsync_mu_lock (&b->mu);
+				locked = 1;
+				value = ATM_LOAD (&b->value);
+			}
+		} while (!ATM_CAS_RELACQ (&b->value, value, value+delta));
+		value += delta;
+		ASSERT (value < value - delta); /* Crash on underflow. */
+		if (!locked) {
+			/* The fence orders the CAS of value before this read of
+			   wake_at, pairing with the fence in bcounter_enqueue():
+			   either the enqueuer sees the new value, or this thread
+			   sees its wake_at. */
+			ATM_FENCE ();
+			if (value < ATM_LOAD (&b->wake_at)) {
+				nsync_mu_lock (&b->mu);
+				locked = 1;
+			}
+		}
+		if (locked) {
+			nsync_dll_element_ *p;
+			while ((p = nsync_dll_first_ (b->waiters)) != NULL &&
+			       DLL_NSYNC_WAITER (p)->wait_arg >= value) {
+				b->waiters = nsync_dll_remove_ (b->waiters, p);
+				nsync_waiter_wake_ (DLL_NSYNC_WAITER (p));
+			}
+			bcounter_set_wake_at (b);
+			nsync_mu_unlock (&b->mu);
+		}
+	}
+	IGNORE_RACES_END ();
+	return (value);
+}
+
+uint32_t nsync_bcounter_value (nsync_bcounter b) {
+	uint32_t result;
+	IGNORE_RACES_START ();
+	result = ATM_LOAD_ACQ (&b->value);
+	IGNORE_RACES_END ();
+	return (result);
+}
+
+uint32_t nsync_bcounter_wait (nsync_bcounter b, uint32_t threshold, nsync_time abs_deadline) {
+	struct nsync_bcounter_wait_s bw;
+	struct nsync_waitable_s waitable;
+	struct nsync_waitable_s *pwaitable = &waitable;
+	bw.b = b;
+	bw.threshold = threshold;
+	waitable.v = &bw;
+	waitable.funcs = &nsync_bcounter_waitable_funcs;
+	nsync_wait_n (NULL, NULL, NULL, abs_deadline, 1, &pwaitable);
+	return (nsync_bcounter_value (b));
+}
+
+static nsync_time bcounter_ready_time (void *v, struct nsync_waiter_s *nw) {
+	struct nsync_bcounter_wait_s *bw = (struct nsync_bcounter_wait_s *) v;
+	nsync_time r = nsync_time_no_deadline;
+	/* A waiter that has been woken is ready even if the value has since
+	   risen again. */
+	if (ATM_LOAD_ACQ (&bw->b->value) <= bw->threshold ||
+	    (nw != NULL && ATM_LOAD_ACQ (&nw->waiting) == 0)) {
+		r = nsync_time_zero;
+	}
+	return (r);
+}
+
+static int bcounter_enqueue (void *v, struct nsync_waiter_s *nw) {
+	struct nsync_bcounter_wait_s *bw = (struct nsync_bcounter_wait_s *) v;
+	nsync_bcounter b = bw->b;
+	int waiting = 0;
+	nsync_mu_lock (&b->mu);
+	/* Queue *nw after any waiters with thresholds at least as high, then
+	   set wake_at before checking the value, so that a decrement either
+	   sees the new wake_at or precedes the check.  The fence orders the
+	   store of wake_at before the read of value; see
+	   nsync_bcounter_add(). */
+	nw->wait_arg = bw->threshold;
+	if (ATM_LOAD_ACQ (&b->value) > bw->threshold) {
+		nsync_dll_element_ *p = nsync_dll_last_ (b->waiters);
+		while (p != NULL && DLL_NSYNC_WAITER (p)->wait_arg < bw->threshold) {
+			p = nsync_dll_prev_ (b->waiters, p);
+		}
+		if (p == NULL) {
+			b->waiters = nsync_dll_make_first_in_list_ (b->waiters, &nw->q);
+		} else if (p == nsync_dll_last_ (b->waiters)) {
+			b->waiters = nsync_dll_make_last_in_list_ (b->waiters, &nw->q);
+		} else {
+			nsync_dll_splice_after_ (p, &nw->q);
+		}
+		ATM_STORE (&nw->waiting, 1);
+		bcounter_set_wake_at (b);
+		ATM_FENCE ();
+		if (ATM_LOAD_ACQ (&b->value) > bw->threshold) {
+			waiting = 1;
+		} else {
+			b->waiters = nsync_dll_remove_ (b->waiters, &nw->q);
+			ATM_STORE (&nw->waiting, 0);
+			bcounter_set_wake_at (b);
+		}
+	} else {
+		ATM_STORE (&nw->waiting, 0);
+	}
+	nsync_mu_unlock (&b->mu);
+	return (waiting);
+}
+
+static int bcounter_dequeue (void *v, struct nsync_waiter_s *nw) {
+	struct nsync_bcounter_wait_s *bw = (struct nsync_bcounter_wait_s *) v;
+	nsync_bcounter b = bw->b;
+	int was_queued = 0;
+	nsync_mu_lock (&b->mu);
+	if (ATM_LOAD_ACQ (&nw->waiting) != 0) {
+		b->waiters = nsync_dll_remove_ (b->waiters, &nw->q);
+		ATM_STORE (&nw->waiting, 0);
+		bcounter_set_wake_at (b);
+		was_queued = 1;
+	}
+	nsync_mu_unlock (&b->mu);
+	return (was_queued);
+}
+
+const struct nsync_waitable_funcs_s nsync_bcounter_waitable_funcs = {
+	&bcounter_ready_time,
+	&bcounter_enqueue,
+	&bcounter_dequeue
+};
+
+NSYNC_CPP_END_
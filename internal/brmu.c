@@ -0,0 +1,252 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#include "nsync_cpp.h"
+#include "platform.h"
+#include "compiler.h"
+#include "cputype.h"
+#include "nsync.h"
+#include "nsync_brmu.h"
+#include "dll.h"
+#include "sem.h"
+#include "wait_internal.h"
+#include "common.h"
+#include "atomic.h"
+
+NSYNC_CPP_START_
+
+/* Implementation notes
+
+   An nsync_brmu consists of an nsync_mu "mu", a word "writer", and an array of
+   reader counts "slot[]".  A reader increments a slot and then checks that
+   "writer" is zero; if it is, the reader holds the lock without having touched
+   "mu".  A writer acquires "mu" in write mode, which excludes other writers,
+   sets "writer" to BRMU_DRAINING, and then waits for the sum of the slots to
+   reach zero before setting "writer" to BRMU_WRITING.  Each side writes its
+   own variable, executes ATM_FENCE(), and then reads the other's, so either
+   the reader sees the writer, or the writer sees the reader's increment.
+   The fences are needed because the compare-and-swap operations alone do
+   not order a write before a later read of another variable.  A reader that sees
+   a writer undoes its increment and instead acquires "mu" in read mode, which
+   blocks it until the writer has finished.  Once it holds "mu", no writer can
+   start, so it increments a slot, releases "mu", and proceeds as though it had
+   taken the fast path.  Writers therefore cannot be starved by a stream of
+   readers.
+
+   A reader leaving while "writer" is BRMU_DRAINING wakes the writer via
+   drain_mu and drain_cv; it too fences between its decrement and its read
+   of "writer", so either it sees the writer draining, or the writer sees
+   the decrement.  The writer checks the slots while holding drain_mu,
+   and the reader acquires drain_mu to signal, so the wakeup cannot be lost.
+
+   Readers choose a slot by hashing the address of the calling thread's
+   reserved waiter (see nsync_thread_waiter_()), which does not change for
+   the life of the thread, so a thread releases each share in the slot in
+   which it acquired it, wherever in its stack the calls are made.  The sum
+   read by a draining writer is not a snapshot, but each term can only
+   overstate the number of readers present: every increment not yet seen by
+   the writer was made after "writer" was set, and is undone in the same
+   slot, while decrements are made only by readers already counted in that
+   slot.
+
+   Conditional critical sections and condition variable waits are built on
+   those of "mu": a reader gives up its slot share and waits while holding
+   "mu" in read mode; a writer clears "writer", so that readers may proceed
+   while it waits, and drains the slots again once it has reacquired "mu".  */
+
+#define BRMU_DRAINING ((uint32_t) 1) /* writer holds mu; readers leaving */
+#define BRMU_WRITING ((uint32_t) 2)  /* writer holds mu; no readers remain */
+
+/* Atomically add delta to *p. */
+static void brmu_add (nsync_atomic_uint32_ *p, uint32_t delta) {
+	uint32_t old_value;
+	do {
+		old_value = ATM_LOAD (p);
+	} while (!ATM_CAS_RELACQ (p, old_value, old_value + delta));
+}
+
+/* Return a pointer to the reader count in *b that the calling thread should
+   use.  The result is the same on every call by a given thread. */
+static nsync_atomic_uint32_ *brmu_slot (nsync_brmu *b) {
+	uintptr_t h = ((uintptr_t) nsync_thread_waiter_ ()) / sizeof (waiter);
+	h ^= (h >> 5) ^ (h >> 10);
+	return (&b->slot[h % NSYNC_BRMU_SLOTS_].readers);
+}
+
+/* Return the number of readers registered in the slots of *b. */
+static uint32_t brmu_readers (nsync_brmu *b) {
+	uint32_t sum = 0;
+	int i;
+	for (i = 0; i != NSYNC_BRMU_SLOTS_; i++) {
+		sum += ATM_LOAD_ACQ (&b->slot[i].readers);
+	}
+	return (sum);
+}
+
+/* Give up a share of *b registered in *slot, waking a draining writer if
+   there is one. */
+static void brmu_release_slot (nsync_brmu *b, nsync_atomic_uint32_ *slot) {
+	brmu_add (slot, (uint32_t) -1);
+	ATM_FENCE (); /* pairs with the fence in brmu_drain() */
+	if (ATM_LOAD_ACQ (&b->writer) == BRMU_DRAINING) {
+		nsync_mu_lock (&b->drain_mu);
+		nsync_cv_signal (&b->drain_cv);
+		nsync_mu_unlock (&b->drain_mu);
+	}
+}
+
+/* Called with b->mu held in write mode.  Wait for readers registered in the
+   slots of *b to leave, and prevent others from entering. */
+static void brmu_drain (nsync_brmu *b) {
+	uint32_t old_value = ATM_LOAD (&b->writer);
+	while (!ATM_CAS_RELACQ (&b->writer, old_value, BRMU_DRAINING)) {
+		old_value = ATM_LOAD (&b->writer);
+	}
+	/* Order the write of "writer" before the reads of the slots; pairs
+	   with the fences in nsync_brmu_rlock() and brmu_release_slot(). */
+	ATM_FENCE ();
+	if (brmu_readers (b) != 0) {
+		nsync_mu_lock (&b->drain_mu);
+		while (brmu_readers (b) != 0) {
+			nsync_cv_wait (&b->drain_cv, &b->drain_mu);
+		}
+		nsync_mu_unlock (&b->drain_mu);
+	}
+	ATM_STORE_REL (&b->writer, BRMU_WRITING);
+}
+
+/* Called with b->mu held in read mode.  Register the calling thread as a
+   reader in a slot of *b, then release b->mu. */
+static void brmu_rlock_from_mu (nsync_brmu *b) {
+	/* No writer can hold *b while b->mu is held in read mode. */
+	brmu_add (brmu_slot (b), 1);
+	nsync_mu_runlock (&b->mu);
+}
+
+/* ---------------------------------------- */
+
+void nsync_brmu_init (nsync_brmu *b) {
+	memset ((void *) b, 0, sizeof (*b));
+}
+
+void nsync_brmu_lock (nsync_brmu *b) {
+	nsync_mu_lock (&b->mu);
+	brmu_drain (b);
+}
+
+void nsync_brmu_unlock (nsync_brmu *b) {
+	if (ATM_LOAD (&b->writer) != BRMU_WRITING) {
+		nsync_panic_ ("attempt to nsync_brmu_unlock() an nsync_brmu "
+			      "not held in write mode\n");
+	}
+	ATM_STORE_REL (&b->writer, 0);
+	nsync_mu_unlock (&b->mu);
+}
+
+void nsync_brmu_rlock (nsync_brmu *b) {
+	nsync_atomic_uint32_ *slot = brmu_slot (b);
+	brmu_add (slot, 1);
+	ATM_FENCE (); /* pairs with the fence in brmu_drain() */
+	if (ATM_LOAD_ACQ (&b->writer) != 0) {
+		/* A writer holds or is acquiring *b; wait for it on b->mu. */
+		brmu_release_slot (b, slot);
+		nsync_mu_rlock (&b->mu);
+		brmu_rlock_from_mu (b);
+	}
+}
+
+void nsync_brmu_runlock (nsync_brmu *b) {
+	brmu_release_slot (b, brmu_slot (b));
+}
+
+void nsync_brmu_assert_held (const nsync_brmu *b) {
+	nsync_mu_assert_held (&b->mu);
+	if (ATM_LOAD (&b->writer) != BRMU_WRITING) {
+		nsync_panic_ ("nsync_brmu not held in write mode\n");
+	}
+}
+
+int nsync_brmu_is_reader (const nsync_brmu *b) {
+	/* Readers hold *b only while "writer" is not BRMU_WRITING. */
+	return (ATM_LOAD (&b->writer) != BRMU_WRITING);
+}
+
+int nsync_brmu_wait_with_deadline (nsync_brmu *b,
+				   int (*condition) (const void *condition_arg),
+				   const void *condition_arg,
+				   int (*condition_arg_eq) (const void *a, const void *b),
+				   nsync_time abs_deadline, nsync_note cancel_note) {
+	int outcome = 0;
+	if (condition != NULL && !(*condition) (condition_arg)) {
+		if (!nsync_brmu_is_reader (b)) {
+			/* Let readers in while this thread waits. */
+			ATM_STORE_REL (&b->writer, 0);
+			outcome = nsync_mu_wait_with_deadline (&b->mu, condition, condition_arg,
+							       condition_arg_eq, abs_deadline,
+							       cancel_note);
+			brmu_drain (b);
+		} else {
+			brmu_release_slot (b, brmu_slot (b));
+			nsync_mu_rlock (&b->mu);
+			outcome = nsync_mu_wait_with_deadline (&b->mu, condition, condition_arg,
+							       condition_arg_eq, abs_deadline,
+							       cancel_note);
+			brmu_rlock_from_mu (b);
+		}
+	}
+	return (outcome);
+}
+
+void nsync_brmu_wait (nsync_brmu *b, int (*condition) (const void *condition_arg),
+		      const void *condition_arg,
+		      int (*condition_arg_eq) (const void *a, const void *b)) {
+	nsync_brmu_wait_with_deadline (b, condition, condition_arg, condition_arg_eq,
+				       nsync_time_no_deadline, NULL);
+}
+
+/* Versions of the lock operations with "void *" arguments, for
+   nsync_cv_wait_with_deadline_generic(). */
+static void void_brmu_lock (void *b) {
+	nsync_brmu_lock ((nsync_brmu *) b);
+}
+static void void_brmu_unlock (void *b) {
+	nsync_brmu_unlock ((nsync_brmu *) b);
+}
+static void void_brmu_rlock (void *b) {
+	nsync_brmu_rlock ((nsync_brmu *) b);
+}
+static void void_brmu_runlock (void *b) {
+	nsync_brmu_runlock ((nsync_brmu *) b);
+}
+
+int nsync_brmu_cv_wait_with_deadline (nsync_cv *cv, nsync_brmu *b,
+				      nsync_time abs_deadline, nsync_note cancel_note) {
+	int outcome;
+	if (nsync_brmu_is_reader (b)) {
+		outcome = nsync_cv_wait_with_deadline_generic (cv, b, &void_brmu_rlock,
+							       &void_brmu_runlock,
+							       abs_deadline, cancel_note);
+	} else {
+		outcome = nsync_cv_wait_with_deadline_generic (cv, b, &void_brmu_lock,
+							       &void_brmu_unlock,
+							       abs_deadline, cancel_note);
+	}
+	return (outcome);
+}
+
+void nsync_brmu_cv_wait (nsync_cv *cv, nsync_brmu *b) {
+	nsync_brmu_cv_wait_with_deadline (cv, b, nsync_time_no_deadline, NULL);
+}
+
+NSYNC_CPP_END_
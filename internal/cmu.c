@@ -0,0 +1,444 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#include "nsync_cpp.h"
+#include "platform.h"
+#include "compiler.h"
+#include "cputype.h"
+#include "nsync.h"
+#include "dll.h"
+#include "sem.h"
+#include "wait_internal.h"
+#include "common.h"
+#include "park.h"
+#include "atomic.h"
+
+NSYNC_CPP_START_
+
+/* Implementation notes
+
+   An nsync_cmu has the reader/writer protocol of nsync_mu, but its waiters
+   are parked on the address of the nsync_cmu (see park.c) rather than
+   queued on a list in the lock, so the lock's word alone must tell an
+   unlocker whether to wake anyone.  A thread blocks by calling nsync_park_()
+   with a validation function that, with the parking queue locked, confirms
+   that it cannot acquire and sets CMU_WAITING.  An unlocker that sees
+   CMU_WAITING calls nsync_unpark_(), and releases the lock in the "done"
+   function, under the same queue lock, while also setting CMU_DESIG_WAKER
+   and recomputing CMU_WAITING and CMU_WRITER_WAITING.  The release is thus
+   the unlocker's last access to the nsync_cmu, so the lock may be freed as
+   soon as another thread acquires it.
+
+   The fields of nsync_cmu.word follow those of nsync_mu.word (see common.h),
+   but there is no spinlock, no conditional waiters, and no long-wait
+   bit.  */
+#define CMU_WLOCK ((uint32_t) (1 << 0)) /* writer lock is held */
+#define CMU_WAITING ((uint32_t) (1 << 1)) /* some thread may be parked on the lock */
+#define CMU_DESIG_WAKER ((uint32_t) (1 << 2)) /* a woken thread has yet to acquire or park anew */
+#define CMU_WRITER_WAITING ((uint32_t) (1 << 3)) /* a writer is parked */
+#define CMU_RLOCK ((uint32_t) (1 << 4)) /* low-order bit of reader count, which uses rest of word */
+
+#define CMU_RLOCK_FIELD (~(uint32_t) (CMU_RLOCK - 1)) /* mask of reader count field */
+#define CMU_ANY_LOCK (CMU_WLOCK | CMU_RLOCK_FIELD) /* mask for any lock held */
+
+/* Tokens with which threads park on an nsync_cmu. */
+#define CMU_PARK_WRITER 1
+#define CMU_PARK_READER 2
+
+static lock_type cmu_writer_type = {
+	CMU_ANY_LOCK,                      /* zero_to_acquire */
+	CMU_WLOCK,                         /* add_to_acquire */
+	CMU_WLOCK,                         /* held_if_non_zero */
+	CMU_WAITING | CMU_WRITER_WAITING,  /* set_when_waiting */
+	CMU_WRITER_WAITING,                /* clear_on_acquire */
+	0                                  /* clear_on_uncontended_release */
+};
+static lock_type cmu_reader_type = {
+	CMU_WLOCK | CMU_WRITER_WAITING,    /* zero_to_acquire */
+	CMU_RLOCK,                         /* add_to_acquire */
+	CMU_RLOCK_FIELD,                   /* held_if_non_zero */
+	CMU_WAITING,                       /* set_when_waiting */
+	0,                                 /* clear_on_acquire */
+	0                                  /* clear_on_uncontended_release */
+};
+
+/* Initialize *mu. */
+void nsync_cmu_init (nsync_cmu *mu) {
+	memset ((void *) mu, 0, sizeof (*mu));
+}
+
+/* The state of a thread blocking in cmu_lock_slow(). */
+typedef struct cmu_parker_s {
+	nsync_cmu *mu;
+	lock_type *l_type;
+	uint32_t zero_to_acquire; /* bits that must be zero for this thread to acquire */
+	uint32_t clear;           /* CMU_DESIG_WAKER if this thread was woken */
+} cmu_parker;
+
+/* The validation function passed to nsync_park_() by cmu_lock_slow().
+   Return whether the thread described by *v should block, and if so, record
+   its presence in the lock word.  It should block only if it cannot acquire,
+   and some other thread will release the lock or acquire it and then release
+   it; the latter is true of the designated waker.  */
+static int cmu_validate (const void *addr, void *v) {
+	cmu_parker *p = (cmu_parker *) v;
+	uint32_t old_word;
+	(void) addr;
+	do {
+		old_word = ATM_LOAD (&p->mu->word);
+		if ((old_word & p->zero_to_acquire) == 0 ||
+		    (old_word & (CMU_ANY_LOCK | (CMU_DESIG_WAKER & ~p->clear))) == 0) {
+			return (0);
+		}
+	} while (!ATM_CAS (&p->mu->word, old_word,
+			   (old_word | p->l_type->set_when_waiting) & ~p->clear));
+	return (1);
+}
+
+/* Acquire *mu in the mode given by *l_type, blocking as necessary. */
+static void cmu_lock_slow (nsync_cmu *mu, lock_type *l_type) {
+	cmu_parker p;
+	uint32_t token = (l_type == &cmu_writer_type? CMU_PARK_WRITER : CMU_PARK_READER);
+	unsigned attempts = 0;
+	p.mu = mu;
+	p.l_type = l_type;
+	p.zero_to_acquire = l_type->zero_to_acquire;
+	p.clear = 0;
+	for (;;) {
+		uint32_t old_word = ATM_LOAD (&mu->word);
+		if ((old_word & p.zero_to_acquire) == 0) {
+			if (ATM_CAS_ACQ (&mu->word, old_word,
+					 (old_word + l_type->add_to_acquire) &
+					 ~(p.clear | l_type->clear_on_acquire))) {
+				return;
+			}
+		} else if (attempts < 4) {
+			attempts = nsync_spin_delay_ (attempts);
+		} else if (nsync_park_ (mu, &cmu_validate, &p, token,
+					nsync_time_no_deadline, NULL) == 0) {
+			/* Woken, so this thread is the designated waker, and as
+			   a reader it no longer defers to waiting writers.  */
+			p.clear = CMU_DESIG_WAKER;
+			p.zero_to_acquire &= ~CMU_WRITER_WAITING;
+			attempts = 0;
+		} else {
+			attempts = nsync_spin_delay_ (attempts);
+		}
+	}
+}
+
+/* The state of an unlocker in cmu_unlock_slow(). */
+typedef struct cmu_unlocker_s {
+	nsync_cmu *mu;
+	lock_type *l_type;    /* mode in which the unlocker holds mu */
+	uint32_t woken_token; /* token of first thread woken, or 0 */
+	int writer_left;      /* whether a parked writer is not being woken */
+} cmu_unlocker;
+
+/* The select function passed to nsync_unpark_() by cmu_unlock_slow().
+   Wake the first parked thread; if it is a reader, wake all parked readers. */
+static int cmu_select (void *v, uint32_t token) {
+	cmu_unlocker *u = (cmu_unlocker *) v;
+	int wake = 0;
+	if (u->woken_token == 0) {
+		u->woken_token = token;
+		wake = 1;
+	} else if (u->woken_token == CMU_PARK_READER && token == CMU_PARK_READER) {
+		wake = 1;
+	} else if (token == CMU_PARK_WRITER) {
+		u->writer_left = 1;
+	}
+	return (wake);
+}
+
+/* The done function passed to nsync_unpark_() by cmu_unlock_slow().
+   Release the unlocker's hold on the lock, and update the waiting bits.  */
+static void cmu_release (const void *addr, void *v, int woken, int remaining) {
+	cmu_unlocker *u = (cmu_unlocker *) v;
+	uint32_t old_word;
+	uint32_t new_word;
+	(void) addr;
+	do {
+		old_word = ATM_LOAD (&u->mu->word);
+		new_word = old_word - u->l_type->add_to_acquire;
+		if (woken != 0) {
+			new_word |= CMU_DESIG_WAKER;
+		}
+		if (remaining == 0) {
+			new_word &= ~(CMU_WAITING | CMU_WRITER_WAITING);
+		} else if (u->writer_left) {
+			new_word |= CMU_WRITER_WAITING;
+		}
+	} while (!ATM_CAS_REL (&u->mu->word, old_word, new_word));
+}
+
+/* Release *mu, held in the mode given by *l_type, and wake waiters. */
+static void cmu_unlock_slow (nsync_cmu *mu, lock_type *l_type) {
+	cmu_unlocker u;
+	u.mu = mu;
+	u.l_type = l_type;
+	u.woken_token = 0;
+	u.writer_left = 0;
+	nsync_unpark_ (mu, &cmu_select, &cmu_release, &u);
+}
+
+/* Attempt to acquire *mu in writer mode without blocking, and return non-zero
+   iff successful.  Return non-zero with high probability if *mu was free
+   on entry. */
+int nsync_cmu_trylock (nsync_cmu *mu) {
+	int result;
+	IGNORE_RACES_START ();
+	if (ATM_CAS_ACQ (&mu->word, 0, CMU_WLOCK)) { /* acquire CAS */
+		result = 1;
+	} else {
+		uint32_t old_word = ATM_LOAD (&mu->word);
+		result = ((old_word & CMU_ANY_LOCK) == 0 &&
+			  ATM_CAS_ACQ (&mu->word, old_word,
+				       (old_word + CMU_WLOCK) & ~CMU_WRITER_WAITING));
+	}
+	IGNORE_RACES_END ();
+	return (result);
+}
+
+/* Block until *mu is free and then acquire it in writer mode. */
+void nsync_cmu_lock (nsync_cmu *mu) {
+	IGNORE_RACES_START ();
+	if (!nsync_cmu_trylock (mu)) {
+		cmu_lock_slow (mu, &cmu_writer_type);
+	}
+	IGNORE_RACES_END ();
+}
+
+/* Attempt to acquire *mu in reader mode without blocking, and return non-zero
+   iff successful.  It may fail to acquire if a writer is waiting, to avoid
+   starvation. */
+int nsync_cmu_rtrylock (nsync_cmu *mu) {
+	int result;
+	IGNORE_RACES_START ();
+	if (ATM_CAS_ACQ (&mu->word, 0, CMU_RLOCK)) { /* acquire CAS */
+		result = 1;
+	} else {
+		uint32_t old_word = ATM_LOAD (&mu->word);
+		result = ((old_word & (CMU_WLOCK | CMU_WRITER_WAITING)) == 0 &&
+			  ATM_CAS_ACQ (&mu->word, old_word, old_word + CMU_RLOCK));
+	}
+	IGNORE_RACES_END ();
+	return (result);
+}
+
+/* Block until *mu can be acquired in reader mode and then acquire it. */
+void nsync_cmu_rlock (nsync_cmu *mu) {
+	IGNORE_RACES_START ();
+	if (!nsync_cmu_rtrylock (mu)) {
+		cmu_lock_slow (mu, &cmu_reader_type);
+	}
+	IGNORE_RACES_END ();
+}
+
+/* Unlock *mu, which must be held in write mode, and wake waiters, if
+   appropriate. */
+void nsync_cmu_unlock (nsync_cmu *mu) {
+	IGNORE_RACES_START ();
+	if (!ATM_CAS_REL (&mu->word, CMU_WLOCK, 0)) {
+		uint32_t old_word = ATM_LOAD (&mu->word);
+		if ((old_word & CMU_WLOCK) == 0) {
+			if ((old_word & CMU_RLOCK_FIELD) != 0) {
+				nsync_panic_ ("attempt to nsync_cmu_unlock() an nsync_cmu "
+					      "held in read mode\n");
+			} else {
+				nsync_panic_ ("attempt to nsync_cmu_unlock() an nsync_cmu "
+					      "not held in write mode\n");
+			}
+		} else if ((old_word & (CMU_WAITING | CMU_DESIG_WAKER)) == CMU_WAITING ||
+			   !ATM_CAS_REL (&mu->word, old_word, old_word - CMU_WLOCK)) {
+			/* There are waiters and no designated waker, or the
+			   CAS failed, so use the slow path.  */
+			cmu_unlock_slow (mu, &cmu_writer_type);
+		}
+	}
+	IGNORE_RACES_END ();
+}
+
+/* Unlock *mu, which must be held in read mode, and wake waiters, if
+   appropriate. */
+void nsync_cmu_runlock (nsync_cmu *mu) {
+	IGNORE_RACES_START ();
+	if (!ATM_CAS_REL (&mu->word, CMU_RLOCK, 0)) {
+		uint32_t old_word = ATM_LOAD (&mu->word);
+		if ((old_word & CMU_RLOCK_FIELD) == 0) {
+			if ((old_word & CMU_WLOCK) != 0) {
+				nsync_panic_ ("attempt to nsync_cmu_runlock() an nsync_cmu "
+					      "held in write mode\n");
+			} else {
+				nsync_panic_ ("attempt to nsync_cmu_runlock() an nsync_cmu "
+					      "not held in read mode\n");
+			}
+		} else if (((old_word & (CMU_WAITING | CMU_DESIG_WAKER)) == CMU_WAITING &&
+			    (old_word & CMU_RLOCK_FIELD) == CMU_RLOCK) ||
+			   !ATM_CAS_REL (&mu->word, old_word, old_word - CMU_RLOCK)) {
+			/* The last reader is leaving with waiters and no
+			   designated waker, or the CAS failed.  */
+			cmu_unlock_slow (mu, &cmu_reader_type);
+		}
+	}
+	IGNORE_RACES_END ();
+}
+
+/* Abort if *mu is not held in write mode. */
+void nsync_cmu_assert_held (const nsync_cmu *mu) {
+	IGNORE_RACES_START ();
+	if ((ATM_LOAD (&mu->word) & CMU_WLOCK) == 0) {
+		nsync_panic_ ("nsync_cmu not held in write mode\n");
+	}
+	IGNORE_RACES_END ();
+}
+
+/* Abort if *mu is not held in some mode. */
+void nsync_cmu_rassert_held (const nsync_cmu *mu) {
+	IGNORE_RACES_START ();
+	if ((ATM_LOAD (&mu->word) & CMU_ANY_LOCK) == 0) {
+		nsync_panic_ ("nsync_cmu not held in some mode\n");
+	}
+	IGNORE_RACES_END ();
+}
+
+/* Return whether *mu is held in read mode.
+   Requires that *mu is held in some mode. */
+int nsync_cmu_is_reader (const nsync_cmu *mu) {
+	uint32_t word;
+	IGNORE_RACES_START ();
+	word = ATM_LOAD (&mu->word);
+	if ((word & CMU_ANY_LOCK) == 0) {
+		nsync_panic_ ("nsync_cmu not held in some mode\n");
+	}
+	IGNORE_RACES_END ();
+	return ((word & CMU_WLOCK) == 0);
+}
+
+/* ---------- */
+
+/* Fields in nsync_ccv.word.  The sequence number is incremented by every
+   signal and broadcast; a waiter parks only if it is unchanged since the
+   waiter released its lock, so no wakeup is lost.  CCV_WAITING is set by
+   waiters, under the parking queue's lock, and cleared by wakers that leave
+   the queue empty; a waker must increment the sequence number even when
+   CCV_WAITING is clear, because a thread may be about to park.  */
+#define CCV_WAITING ((uint32_t) (1 << 0)) /* some thread may be parked on the cv */
+#define CCV_SEQ ((uint32_t) (1 << 1))     /* low-order bit of sequence number, which uses rest of word */
+
+/* Initialize *cv. */
+void nsync_ccv_init (nsync_ccv *cv) {
+	memset ((void *) cv, 0, sizeof (*cv));
+}
+
+/* The validation function passed to nsync_park_() by
+   nsync_ccv_wait_with_deadline().  *v is the sequence number read before
+   the waiter released its lock.  */
+static int ccv_validate (const void *addr, void *v) {
+	nsync_ccv *cv = (nsync_ccv *) addr;
+	uint32_t seq = *(uint32_t *) v;
+	uint32_t old_word;
+	do {
+		old_word = ATM_LOAD (&cv->word);
+		if ((old_word & ~CCV_WAITING) != seq) {
+			return (0);
+		}
+	} while ((old_word & CCV_WAITING) == 0 &&
+		 !ATM_CAS (&cv->word, old_word, old_word | CCV_WAITING));
+	return (1);
+}
+
+int nsync_ccv_wait_with_deadline (nsync_ccv *cv, nsync_cmu *mu,
+				  nsync_time abs_deadline,
+				  nsync_note cancel_note) {
+	int is_reader = nsync_cmu_is_reader (mu);
+	uint32_t seq;
+	int outcome;
+	IGNORE_RACES_START ();
+	seq = ATM_LOAD_ACQ (&cv->word) & ~CCV_WAITING;
+	if (is_reader) {
+		nsync_cmu_runlock (mu);
+	} else {
+		nsync_cmu_unlock (mu);
+	}
+	outcome = nsync_park_ (cv, &ccv_validate, &seq, 0, abs_deadline, cancel_note);
+	if (outcome == EAGAIN) { /* signalled before parking */
+		outcome = 0;
+	}
+	if (is_reader) {
+		nsync_cmu_rlock (mu);
+	} else {
+		nsync_cmu_lock (mu);
+	}
+	IGNORE_RACES_END ();
+	return (outcome);
+}
+
+void nsync_ccv_wait (nsync_ccv *cv, nsync_cmu *mu) {
+	nsync_ccv_wait_with_deadline (cv, mu, nsync_time_no_deadline, NULL);
+}
+
+/* The select function passed to nsync_unpark_() by nsync_ccv_signal(); *v
+   counts the threads woken. */
+static int ccv_select_one (void *v, uint32_t token) {
+	int *woken = (int *) v;
+	(void) token;
+	return ((*woken)++ == 0);
+}
+
+/* The done function passed to nsync_unpark_() by nsync_ccv_signal() and
+   nsync_ccv_broadcast(): clear CCV_WAITING if no thread remains parked. */
+static void ccv_done (const void *addr, void *v, int woken, int remaining) {
+	nsync_ccv *cv = (nsync_ccv *) addr;
+	uint32_t old_word;
+	(void) v;
+	(void) woken;
+	if (remaining == 0) {
+		do {
+			old_word = ATM_LOAD (&cv->word);
+		} while ((old_word & CCV_WAITING) != 0 &&
+			 !ATM_CAS (&cv->word, old_word, old_word & ~CCV_WAITING));
+	}
+}
+
+/* Increment the sequence number of *cv, and return whether CCV_WAITING was
+   set. */
+static int ccv_advance (nsync_ccv *cv) {
+	uint32_t old_word;
+	do {
+		old_word = ATM_LOAD (&cv->word);
+	} while (!ATM_CAS_RELACQ (&cv->word, old_word, old_word + CCV_SEQ));
+	return ((old_word & CCV_WAITING) != 0);
+}
+
+/* Wake at least one thread if any are currently blocked on *cv. */
+void nsync_ccv_signal (nsync_ccv *cv) {
+	IGNORE_RACES_START ();
+	if (ccv_advance (cv)) {
+		int woken = 0;
+		nsync_unpark_ (cv, &ccv_select_one, &ccv_done, &woken);
+	}
+	IGNORE_RACES_END ();
+}
+
+/* Wake all threads currently blocked on *cv. */
+void nsync_ccv_broadcast (nsync_ccv *cv) {
+	IGNORE_RACES_START ();
+	if (ccv_advance (cv)) {
+		nsync_unpark_ (cv, NULL, &ccv_done, NULL);
+	}
+	IGNORE_RACES_END ();
+}
+
+NSYNC_CPP_END_
@@ -72,11 +72,12 @@ NSYNC_CPP_START_
    well even with large numbers of threads if there is at most one
    wait condition that can be false at any given time (such as in a
    producer/consumer queue, which cannot be both empty and full
-   simultaneously).  One could imagine a queueing mechanism that would
-   guarantee to evaluate each condition at most once per wakeup, but that would
-   be substantially more complex, and would still degrade if the number of
-   distinct wakeup conditions were high.  So clients are advised to resort to
-   condition variables if they have many distinct wakeup conditions. */
+   simultaneously).  Waiters with equal conditions that are not adjacent are
+   handled by a small hash table built during each wakeup (see cond_memo in
+   mu.c), so each distinct condition is usually evaluated at most once per
+   wakeup.  Nevertheless, the cost of a wakeup grows with the number of distinct
+   wakeup conditions, so clients are advised to resort to condition variables
+   if they have many. */
 
 /* Used in spinloops to delay resumption of the loop.
    Usage:
@@ -110,6 +111,23 @@ uint32_t nsync_spin_test_and_set_ (nsync_atomic_uint32_ *w, uint32_t test,
 	return (old);
 }
 
+/* -------------------------------- */
+
+/* Semaphore statistics; see sem.h. */
+nsync_atomic_uint32_ nsync_mu_semaphore_stats_enabled_;
+nsync_atomic_uint32_ nsync_mu_semaphore_sleeps_;
+nsync_atomic_uint32_ nsync_mu_semaphore_wakes_;
+
+/* If nsync_mu_semaphore_stats_enabled_ is non-zero, atomically increment *counter. */
+void nsync_mu_semaphore_count_ (nsync_atomic_uint32_ *counter) {
+	if (ATM_LOAD (&nsync_mu_semaphore_stats_enabled_) != 0) {
+		uint32_t old_value;
+		do {
+			old_value = ATM_LOAD (counter);
+		} while (!ATM_CAS (counter, old_value, old_value+1));
+	}
+}
+
 /* ====================================================================================== */
 
 struct nsync_waiter_s *nsync_dll_nsync_waiter_ (nsync_dll_element_ *e) {
@@ -136,69 +154,204 @@ waiter *nsync_dll_waiter_samecond_ (nsync_dll_element_ *e) {
 
 /* -------------------------------- */
 
+/* Free waiter structs are kept in three tiers:
+   - Each thread has a reserved waiter, used for its first concurrent wait,
+     and a "magazine" of up to MAGAZINE_SIZE further free waiters, chained
+     through next_free from the reserved waiter's "magazine" field.  Only the
+     owning thread touches these, so the common cases need no atomic
+     operations.
+   - A thread whose magazine is empty takes a whole magazine from the depot,
+     and one whose magazine is full gives the magazine to the depot.  An
+     exiting thread gives its reserved waiter and magazine to the depot.  The
+     depot is an array of slots, each holding at most one magazine.  A thread
+     claims a slot by moving its state from DEPOT_EMPTY or DEPOT_FULL to
+     DEPOT_BUSY with a compare-and-swap, so a slot's contents are only ever
+     touched by the single thread that claimed it, and no ABA problem arises.
+     Threads start their search at a slot chosen by hashing a stack address,
+     and slots lie in separate cache lines, so threads seldom touch the same
+     line.
+   - If the depot is full, waiters go to the free_waiters list, protected by
+     the spinlock free_waiters_mu. */
+#define MAGAZINE_SIZE 8
+#define DEPOT_SLOTS 64
+#define DEPOT_EMPTY ((uint32_t) 0) /* slot holds no magazine */
+#define DEPOT_BUSY ((uint32_t) 1)  /* slot claimed by a thread */
+#define DEPOT_FULL ((uint32_t) 2)  /* slot holds a magazine */
+
+static struct depot_slot_s {
+	nsync_atomic_uint32_ state; /* DEPOT_EMPTY, DEPOT_BUSY, or DEPOT_FULL */
+	waiter *magazine;           /* valid in DEPOT_FULL; chained through next_free */
+	char pad[64 - sizeof (nsync_atomic_uint32_) - sizeof (waiter *)];
+} depot[DEPOT_SLOTS];
+
+/* Return the index of the depot slot at which the calling thread should
+   start its search. */
+static unsigned depot_start (void) {
+	char local;
+	uintptr_t h = ((uintptr_t) &local) >> 12;
+	h ^= (h >> 6) ^ (h >> 12);
+	return ((unsigned) (h % DEPOT_SLOTS));
+}
+
+/* Move the first depot slot found in state "from" to DEPOT_BUSY, and return
+   its address, or return NULL if there is no such slot. */
+static struct depot_slot_s *depot_claim (uint32_t from) {
+	unsigned start = depot_start ();
+	unsigned i;
+	for (i = 0; i != DEPOT_SLOTS; i++) {
+		struct depot_slot_s *d = &depot[(start + i) % DEPOT_SLOTS];
+		if (ATM_LOAD (&d->state) == from &&
+		    ATM_CAS_ACQ (&d->state, from, DEPOT_BUSY)) {
+			return (d);
+		}
+	}
+	return (NULL);
+}
+
 static nsync_dll_list_ free_waiters = NULL;
 
 /* free_waiters points to a doubly-linked list of free waiter structs. */
 static nsync_atomic_uint32_ free_waiters_mu; /* spinlock; protects free_waiters */
 
+/* Give the chain of free waiters starting at *w and linked via next_free to
+   the depot, or if it is full, to free_waiters. */
+static void waiters_release (waiter *w) {
+	struct depot_slot_s *d = depot_claim (DEPOT_EMPTY);
+	if (d != NULL) {
+		d->magazine = w;
+		ATM_STORE_REL (&d->state, DEPOT_FULL); /* release store */
+	} else {
+		nsync_spin_test_and_set_ (&free_waiters_mu, 1, 1, 0);
+		for (; w != NULL; w = w->next_free) {
+			free_waiters = nsync_dll_make_first_in_list_ (free_waiters, &w->nw.q);
+		}
+		ATM_STORE_REL (&free_waiters_mu, 0); /* release store */
+	}
+}
+
+/* Return a chain of free waiters linked via next_free, taken from the depot
+   or free_waiters, or NULL if there are none. */
+static waiter *waiters_acquire (void) {
+	waiter *w = NULL;
+	struct depot_slot_s *d = depot_claim (DEPOT_FULL);
+	if (d != NULL) {
+		w = d->magazine;
+		d->magazine = NULL;
+		ATM_STORE_REL (&d->state, DEPOT_EMPTY); /* release store */
+	} else {
+		nsync_dll_element_ *q;
+		nsync_spin_test_and_set_ (&free_waiters_mu, 1, 1, 0);
+		q = nsync_dll_first_ (free_waiters);
+		if (q != NULL) { /* If free list is non-empty, dequeue an item. */
+			free_waiters = nsync_dll_remove_ (free_waiters, q);
+			w = DLL_WAITER (q);
+			w->next_free = NULL;
+		}
+		ATM_STORE_REL (&free_waiters_mu, 0); /* release store */
+	}
+	return (w);
+}
+
 static THREAD_LOCAL waiter *waiter_for_thread;
 static void waiter_destroy (void *v) {
 	waiter *w = (waiter *) v;
 	IGNORE_RACES_START ();
 	ASSERT ((w->flags & (WAITER_RESERVED|WAITER_IN_USE)) == WAITER_RESERVED);
 	w->flags &= ~WAITER_RESERVED;
-	nsync_spin_test_and_set_ (&free_waiters_mu, 1, 1, 0);
-	free_waiters = nsync_dll_make_first_in_list_ (free_waiters, &w->nw.q);
-	ATM_STORE_REL (&free_waiters_mu, 0); /* release store */
+	if (HAVE_THREAD_LOCAL) {
+		waiter_for_thread = NULL;
+	}
+	nsync_slab_flush_caches_ (w->slab_cache);
+	w->next_free = w->magazine;
+	w->magazine = NULL;
+	w->magazine_size = 0;
+	waiters_release (w);
 	IGNORE_RACES_END ();
 }
 
 /* If non-nil, nsync_malloc_ptr_ points to a malloc-like routine that allocated
-   memory, used by mutex and condition variable code to allocate waiter
-   structs.  This would allow nsync's mutexes to be used inside an
-   implementation of malloc(), by providing another, simpler allocator here.
-   The intent is that the implicit NULL value here can be overridden by a
-   client declaration that uses an initializer.  */
+   memory, used to allocate the memory for waiter structs, notes, and
+   counters, unless nsync_set_arena() has been called (see slab.c).  This
+   would allow nsync's mutexes to be used inside an implementation of
+   malloc(), by providing another, simpler allocator here.  The intent is
+   that the implicit NULL value here can be overridden by a client
+   declaration that uses an initializer.  */
 void *(*nsync_malloc_ptr_) (size_t size);
 
-/* Return a pointer to an unused waiter struct.
-   Ensures that the enclosed timer is stopped and its channel drained. */
-waiter *nsync_waiter_new_ (void) {
-	nsync_dll_element_ *q;
+/* Waiter structs are allocated from waiter_slab, which uses
+   nsync_malloc_ptr_ if it is set.  They are never freed.  */
+static nsync_slab_ waiter_slab = NSYNC_SLAB_INIT_ (sizeof (waiter), NSYNC_SLAB_NO_CACHE_);
+
+/* Return a newly allocated waiter struct. */
+static waiter *waiter_alloc (void) {
+	waiter *w = (waiter *) nsync_slab_alloc_ (&waiter_slab);
+	w->tag = WAITER_TAG;
+	w->nw.tag = NSYNC_WAITER_TAG;
+	nsync_mu_semaphore_init (&w->sem);
+	w->nw.sem = &w->sem;
+	nsync_dll_init_ (&w->nw.q, &w->nw);
+	NSYNC_ATOMIC_UINT32_STORE_ (&w->nw.waiting, 0);
+	w->nw.flags = NSYNC_WAITER_FLAG_MUCV;
+	ATM_STORE (&w->remove_count, 0);
+	nsync_dll_init_ (&w->same_condition, w);
+	w->cond_memo_next = NULL;
+	w->cond_mask = ~(uint32_t) 0;
+	w->cv_lock = NULL;
+	w->cv_wake_next = NULL;
+	w->wake_next = NULL;
+	w->wake_batch = 0;
+	w->park_addr = NULL;
+	w->park_token = 0;
+	w->next_free = NULL;
+	w->magazine = NULL;
+	w->magazine_size = 0;
+	memset ((void *) w->slab_cache, 0, sizeof (w->slab_cache));
+	w->flags = 0;
+	return (w);
+}
+
+/* Return the calling thread's reserved waiter, or NULL if it has none. */
+static waiter *thread_waiter (void) {
 	waiter *tw;
-	waiter *w;
 	if (HAVE_THREAD_LOCAL) {
 		tw = waiter_for_thread;
 	} else {
 		tw = (waiter *) nsync_per_thread_waiter_ (&waiter_destroy);
 	}
-	w = tw;
+	return (tw);
+}
+
+/* Return a pointer to an unused waiter struct.
+   Ensures that the enclosed timer is stopped and its channel drained. */
+waiter *nsync_waiter_new_ (void) {
+	waiter *tw = thread_waiter ();
+	waiter *w = tw;
 	if (w == NULL || (w->flags & (WAITER_RESERVED|WAITER_IN_USE)) != WAITER_RESERVED) {
-		w = NULL;
-		nsync_spin_test_and_set_ (&free_waiters_mu, 1, 1, 0);
-		q = nsync_dll_first_ (free_waiters);
-		if (q != NULL) { /* If free list is non-empty, dequeue an item. */
-			free_waiters = nsync_dll_remove_ (free_waiters, q);
-			w = DLL_WAITER (q);
+		if (tw != NULL && tw->magazine == NULL) {
+			/* Refill the magazine from the depot. */
+			tw->magazine = waiters_acquire ();
+			tw->magazine_size = 0;
+			for (w = tw->magazine; w != NULL; w = w->next_free) {
+				tw->magazine_size++;
+			}
 		}
-		ATM_STORE_REL (&free_waiters_mu, 0); /* release store */
-		if (w == NULL) { /* If free list was empty, allocate an item. */
-			if (nsync_malloc_ptr_ != NULL) { /* Use client's malloc() */
-				w = (waiter *) (*nsync_malloc_ptr_) (sizeof (*w));
-			} else {  /* standard malloc () */
-				w = (waiter *) malloc (sizeof (*w));
+		if (tw != NULL && tw->magazine != NULL) {
+			w = tw->magazine;
+			tw->magazine = w->next_free;
+			tw->magazine_size--;
+		} else if (tw != NULL || (w = waiters_acquire ()) == NULL) {
+			w = waiter_alloc ();
+		} else {
+			/* The new reserved waiter keeps the rest of the chain
+			   as its magazine. */
+			w->magazine = w->next_free;
+			w->magazine_size = 0;
+			for (tw = w->magazine; tw != NULL; tw = tw->next_free) {
+				w->magazine_size++;
 			}
-			w->tag = WAITER_TAG;
-			w->nw.tag = NSYNC_WAITER_TAG;
-			nsync_mu_semaphore_init (&w->sem);
-			w->nw.sem = &w->sem;
-			nsync_dll_init_ (&w->nw.q, &w->nw);
-			NSYNC_ATOMIC_UINT32_STORE_ (&w->nw.waiting, 0);
-			w->nw.flags = NSYNC_WAITER_FLAG_MUCV;
-			ATM_STORE (&w->remove_count, 0);
-			nsync_dll_init_ (&w->same_condition, w);
-			w->flags = 0;
+			tw = NULL;
 		}
+		w->next_free = NULL;
 		if (tw == NULL) {
 			w->flags |= WAITER_RESERVED;
 			nsync_set_per_thread_waiter_ (w, &waiter_destroy);
@@ -216,9 +369,42 @@ void nsync_waiter_free_ (waiter *w) {
 	ASSERT ((w->flags & WAITER_IN_USE) != 0);
 	w->flags &= ~WAITER_IN_USE;
 	if ((w->flags & WAITER_RESERVED) == 0) {
-		nsync_spin_test_and_set_ (&free_waiters_mu, 1, 1, 0);
-		free_waiters = nsync_dll_make_first_in_list_ (free_waiters, &w->nw.q);
-		ATM_STORE_REL (&free_waiters_mu, 0); /* release store */
+		waiter *tw = thread_waiter ();
+		if (tw == NULL) {
+			w->next_free = NULL;
+			waiters_release (w);
+		} else {
+			if (tw->magazine_size >= MAGAZINE_SIZE) {
+				/* Magazine is full; pass it to the depot. */
+				waiters_release (tw->magazine);
+				tw->magazine = NULL;
+				tw->magazine_size = 0;
+			}
+			w->next_free = tw->magazine;
+			tw->magazine = w;
+			tw->magazine_size++;
+		}
+	}
+}
+
+waiter *nsync_thread_waiter_ (void) {
+	waiter *tw = thread_waiter ();
+	if (tw == NULL) {
+		nsync_waiter_free_ (nsync_waiter_new_ ());
+		tw = thread_waiter ();
+	}
+	return (tw);
+}
+
+void nsync_thread_prewarm (void) {
+	waiter *w[3];
+	int i;
+	for (i = 0; i != 3; i++) {
+		w[i] = nsync_waiter_new_ ();
+	}
+	while (i != 0) {
+		i--;
+		nsync_waiter_free_ (w[i]);
 	}
 }
 
@@ -247,4 +433,18 @@ static lock_type Xreader_type = {
 };
 lock_type *nsync_reader_type_ = &Xreader_type;
 
+
+/* downgrade_type points to a lock_type that describes how to convert a writer
+   lock into a reader lock; "releasing" it subtracts MU_WLOCK and adds MU_RLOCK.
+   Only the release-related fields are used. */
+static lock_type Xdowngrade_type = {
+	MU_WZERO_TO_ACQUIRE,
+	MU_WADD_TO_ACQUIRE - MU_RADD_TO_ACQUIRE,
+	MU_WHELD_IF_NON_ZERO,
+	MU_WSET_WHEN_WAITING,
+	MU_WCLEAR_ON_ACQUIRE,
+	MU_WCLEAR_ON_UNCONTENDED_RELEASE
+};
+lock_type *nsync_downgrade_type_ = &Xdowngrade_type;
+
 NSYNC_CPP_END_
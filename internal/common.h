@@ -21,6 +21,7 @@
 #include "sem.h"
 #include "nsync_waiter.h"
 #include "dll.h"
+#include "slab.h"
 #include "nsync_mu.h"
 #include "nsync_note.h"
 
@@ -139,6 +140,13 @@ void nsync_panic_ (const char *s);
 #define MU_RCLEAR_ON_ACQUIRE ((uint32_t) 0)              /* nothing to clear when a read acquires */
 #define MU_RCLEAR_ON_UNCONTENDED_RELEASE ((uint32_t) 0)  /* nothing to clear when a read releases */
 
+/* nsync_mu.version counts releases of the write lock; see
+   nsync_mu_read_begin().  A thread holding *mu_ in write mode uses
+   MU_BUMP_VERSION (mu_) before releasing or downgrading *mu_ in any way.
+   Only the writer modifies the field, and the release store orders it after
+   the writer's modifications to the protected data.  */
+#define MU_BUMP_VERSION(mu_) ATM_STORE_REL (&(mu_)->version, ATM_LOAD (&(mu_)->version) + 1)
+
 
 /* A lock_type holds the values needed to manipulate a mu in some mode (read or
    write).  This allows some of the code to be generic, and parameterized by
@@ -159,6 +167,10 @@ extern lock_type *nsync_writer_type_;
 /* reader_type points to a lock_type that describes how to manipulate a mu for a reader. */
 extern lock_type *nsync_reader_type_;
 
+/* Used with nsync_mu_unlock_slow_() to convert a write lock into a read lock,
+   waking only readers. */
+extern lock_type *nsync_downgrade_type_;
+
 /* ---------- */
 
 /* Bits in nsync_cv.word */
@@ -201,15 +213,28 @@ struct wait_condition_s {
    Remove *w from the relevant queue then:
     ATM_STORE_REL (&w.waiting, 0);
     nsync_mu_semaphore_v (&w.sem); */
-typedef struct {
+typedef struct waiter_s {
 	uint32_t tag;              /* debug DLL_NSYNC_WAITER, DLL_WAITER, DLL_WAITER_SAMECOND */
 	nsync_semaphore sem;       /* Thread waits on this semaphore. */
 	struct nsync_waiter_s nw;  /* An embedded nsync_waiter_s. */
 	struct nsync_mu_s_ *cv_mu;  /* pointer to nsync_mu associated with a cv wait */
 	lock_type *l_type;         /* Lock type of the mu, or nil if not associated with a mu. */
+	void *cv_lock;             /* lock of a cv wait if not an nsync_mu, else nil */
+	struct waiter_s *cv_wake_next; /* waiter to wake once cv_lock is reacquired; see cv.c */
+	struct waiter_s *wake_next; /* next waiter in a batch woken from a mu; see mu.c */
+	int wake_batch;            /* number of waiters from wake_next that this one wakes */
 	nsync_atomic_uint32_ remove_count;   /* count of removals from queue */
 	struct wait_condition_s cond; /* A condition on which to acquire a mu. */
 	nsync_dll_element_ same_condition;   /* Links neighbours in nw.q with same non-nil condition. */
+	uint32_t cond_mask;           /* state on which cond depends; see nsync_mu_unlock_with_mask() */
+	nsync_dll_element_ *cond_memo_next; /* next nw.q in a cond_memo bucket; see mu.c */
+	int cond_memo_value;          /* value of cond when last evaluated via a cond_memo */
+	const void *park_addr;        /* address parked on; see park.c */
+	uint32_t park_token;          /* value passed to nsync_park_() */
+	struct waiter_s *next_free;   /* next in a chain of free waiters; see common.c */
+	struct waiter_s *magazine;    /* if reserved, the owning thread's free waiters */
+	int magazine_size;            /* number of waiters in magazine */
+	nsync_slab_cache_ slab_cache[NSYNC_SLAB_CACHES_]; /* if reserved, thread's slab caches */
 	int flags;                    /* see WAITER_* bits below */
 } waiter;
 static const uint32_t WAITER_TAG = 0x0590239f;
@@ -244,6 +269,13 @@ waiter *nsync_waiter_new_ (void);
 /* Return an unused waiter struct *w to the free pool. */
 void nsync_waiter_free_ (waiter *w);
 
+/* Return the calling thread's reserved waiter, creating it if necessary.
+   The caller may use its slab_cache field, but not the waiter itself. */
+waiter *nsync_thread_waiter_ (void);
+
+/* If non-nil, a malloc-like routine used to allocate memory; see common.c. */
+extern void *(*nsync_malloc_ptr_) (size_t size);
+
 /* ---------- */
 
 /* The internals of an nync_note.  See internal/note.c for details of locking
@@ -253,21 +285,54 @@ struct nsync_note_s_ {
         int expiry_time_valid;      /* whether expiry_time is valid; r/o after init */
         nsync_time expiry_time;     /* expiry time, if expiry_time_valid != 0; r/o after init */
         nsync_mu note_mu;          /* protects fields below except "notified" */
-        nsync_cv no_children_cv;    /* signalled when children becomes empty */
+        nsync_cv no_children_cv;    /* signalled when children or disconnecting changes */
         uint32_t disconnecting;     /* non-zero => node is being disconnected */
         nsync_atomic_uint32_ notified;   /* non-zero if the note has been notified */
+        nsync_atomic_uint32_ futex_waited; /* non-zero if nsync_wait_n() may block on notified; see wait.c */
         struct nsync_note_s_ *parent;     /* points to parent, if any */
         nsync_dll_element_ *children; /* list of children */
         nsync_dll_element_ *waiters;  /* list of waiters */
+        int timer_added;              /* whether the note was added to the timer heap */
+        uint32_t timer_index;         /* 1 + index in the timer heap, or 0; see note_timer.c */
 };
 
 /* ---------- */
 
 void nsync_mu_lock_slow_ (nsync_mu *mu, waiter *w, uint32_t clear, lock_type *l_type);
-void nsync_mu_unlock_slow_ (nsync_mu *mu, lock_type *l_type);
+void nsync_mu_unlock_slow_ (nsync_mu *mu, lock_type *l_type, uint32_t eval_mask);
+void nsync_mu_wake_batch_ (waiter *w);
 nsync_dll_list_ nsync_remove_from_mu_queue_ (nsync_dll_list_ mu_queue, nsync_dll_element_ *e);
 void nsync_maybe_merge_conditions_ (nsync_dll_element_ *p, nsync_dll_element_ *n);
 nsync_time nsync_note_notified_deadline_ (nsync_note n);
+
+/* Add *n, which has a finite expiry time, to the timer that notifies notes
+   at expiry, remove it, or remove it and wait until the timer is not using
+   it, so that it may be freed.  See note_timer.c. */
+void nsync_note_timer_add_ (nsync_note n);
+void nsync_note_timer_remove_ (nsync_note n);
+void nsync_note_timer_free_ (nsync_note n);
+
+/* If the note or counter *v is ready, return NULL.  Otherwise, return the
+   address of a word whose value is now *value, and that will change and be
+   passed to nsync_wait_futex_wake_() when *v becomes ready; set *deadline to
+   the time at which *v may become ready with no such wake.  Used by
+   nsync_wait_n() to block on many notes and counters without enqueueing on
+   each.  */
+nsync_atomic_uint32_ *nsync_note_futex_word_ (void *v, uint32_t *value, nsync_time *deadline);
+nsync_atomic_uint32_ *nsync_counter_futex_word_ (void *v, uint32_t *value, nsync_time *deadline);
+
+/* Wake all threads blocked in nsync_wait_n() on *word, if the platform lets
+   nsync_wait_n() block on words; otherwise do nothing.  */
+void nsync_wait_futex_wake_ (nsync_atomic_uint32_ *word);
+
+/* Wake the waiter *nw, which its object has just removed from its queue:
+   set nw->waiting to zero, and V *nw->sem or, if *nw belongs to an
+   nsync_eventfd, make its file descriptor readable.  */
+void nsync_waiter_wake_ (struct nsync_waiter_s *nw);
+
+/* Make the file descriptor of the nsync_eventfd containing *nw readable,
+   then set nw->waiting to zero.  */
+void nsync_eventfd_wake_ (struct nsync_waiter_s *nw);
 int nsync_sem_wait_with_cancel_ (waiter *w, nsync_time abs_deadline,
 				 nsync_note cancel_note);
 NSYNC_CPP_END_
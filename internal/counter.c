@@ -25,16 +25,43 @@
 
 NSYNC_CPP_START_
 
+/* Implementation notes for sharded counters
+
+   A sharded counter's value is the sum of "value" and the credits of its
+   shards.  A thread adds to the credit of a shard chosen by a hash of its
+   stack address, without locking, unless that could take the credit to or
+   from zero.  Otherwise it takes counter_mu and adds to "value"; if a
+   decrement would take "value" to zero or below, it first drains the
+   credits of all shards into "value", which then holds the whole count.
+
+   Credit is granted to a shard only from "value", and only when "value"
+   remains non-zero, so "value" is zero exactly when the counter is.  The
+   waitable functions and nsync_wait_n() can therefore treat sharded and
+   unsharded counters alike.  */
+
+/* The number of shards of a sharded counter. */
+#define COUNTER_SHARDS 16
+
+/* A shard of a sharded counter.  Each is on a different cache line. */
+typedef struct counter_shard_s {
+	nsync_atomic_uint32_ credit;  /* this shard's part of the counter's value */
+	char pad[64 - sizeof (nsync_atomic_uint32_)];
+} counter_shard;
+
 /* Internal details of nsync_counter. */
 struct nsync_counter_s_ {
         nsync_atomic_uint32_ waited;    /* wait has been called */
-        nsync_mu counter_mu;         /* protects fields below except reads of "value" */
+        nsync_mu counter_mu;         /* protects waiters, and changes of "value" to or from zero */
         nsync_atomic_uint32_ value;     /* value of counter */
         struct nsync_dll_element_s_ *waiters;  /* list of waiters */
+        counter_shard *shards;       /* NULL, or COUNTER_SHARDS shards; see above */
 };
 
+nsync_slab_ nsync_counter_slab_ = NSYNC_SLAB_INIT_ (sizeof (struct nsync_counter_s_),
+						     NSYNC_SLAB_CACHE_COUNTER_);
+
 nsync_counter nsync_counter_new (uint32_t value) {
-	nsync_counter c = (nsync_counter) malloc (sizeof (*c));
+	nsync_counter c = (nsync_counter) nsync_slab_alloc_ (&nsync_counter_slab_);
 	if (c != NULL) {
 		memset (c, 0, sizeof (*c));
 		ATM_STORE (&c->value, value);
@@ -42,11 +69,121 @@ nsync_counter nsync_counter_new (uint32_t value) {
 	return (c);
 }
 
+nsync_counter nsync_counter_new_sharded (uint32_t value) {
+	nsync_counter c = nsync_counter_new (value);
+	if (c != NULL) {
+		c->shards = (counter_shard *) malloc (COUNTER_SHARDS * sizeof (c->shards[0]));
+		if (c->shards == NULL) {
+			nsync_counter_free (c);
+			c = NULL;
+		} else {
+			memset ((void *) c->shards, 0, COUNTER_SHARDS * sizeof (c->shards[0]));
+		}
+	}
+	return (c);
+}
+
 void nsync_counter_free (nsync_counter c) {
 	nsync_mu_lock (&c->counter_mu);
 	ASSERT (nsync_dll_is_empty_ (c->waiters));
 	nsync_mu_unlock (&c->counter_mu);
-	free (c);
+	if (c->shards != NULL) {
+		free (c->shards);
+	}
+	nsync_slab_free_ (&nsync_counter_slab_, c);
+}
+
+/* Add delta to c->value with a CAS, and return the new value. */
+static uint32_t counter_value_add (nsync_counter c, int32_t delta) {
+	uint32_t value;
+	do {
+		value = ATM_LOAD (&c->value);
+	} while (!ATM_CAS_RELACQ (&c->value, value, value+delta));
+	return (value + delta);
+}
+
+/* Wake the waiters of c, whose value has just reached zero.
+   c->counter_mu is held.  */
+static void counter_wake_waiters (nsync_counter c) {
+	nsync_dll_element_ *p;
+	/* The fence orders the CAS that set value to zero before this read
+	   of waited, pairing with the fence in nsync_counter_futex_word_():
+	   either a futex waiter sees the zero, or this thread sees waited set. */
+	ATM_FENCE ();
+	if (ATM_LOAD (&c->waited) != 0) {
+		nsync_wait_futex_wake_ (&c->value);
+	}
+	while ((p = nsync_dll_first_ (c->waiters)) != NULL) {
+		struct nsync_waiter_s *nw = DLL_NSYNC_WAITER (p);
+		c->waiters = nsync_dll_remove_ (c->waiters, p);
+		nsync_waiter_wake_ (nw);
+	}
+}
+
+/* Return the shard of c to be used by the calling thread. */
+static counter_shard *counter_shard_of (nsync_counter c) {
+	char local;
+	uintptr_t h = ((uintptr_t) &local) >> 12;
+	h ^= (h >> 5) ^ (h >> 11);
+	return (&c->shards[h & (COUNTER_SHARDS - 1)]);
+}
+
+/* nsync_counter_add() for a sharded counter, with delta != 0.  Return the
+   new value or, if that is non-zero, possibly a smaller non-zero value. */
+static uint32_t counter_add_sharded (nsync_counter c, int32_t delta) {
+	counter_shard *s = counter_shard_of (c);
+	uint32_t decrement = (uint32_t) 0 - (uint32_t) delta;  /* -delta, if delta < 0 */
+	uint32_t credit = ATM_LOAD (&s->credit);
+	uint32_t value = 0;
+	/* The shard's credit may change if it stays non-zero, because then
+	   the counter's value does too. */
+	while (value == 0 && (delta > 0? credit != 0 : credit > decrement)) {
+		if (ATM_CAS_RELACQ (&s->credit, credit, credit+delta)) {
+			value = credit + delta;
+			ASSERT (delta < 0 || value > credit); /* Crash on overflow. */
+		} else {
+			credit = ATM_LOAD (&s->credit);
+		}
+	}
+	if (value == 0) {
+		uint32_t grant;
+		nsync_mu_lock (&c->counter_mu);
+		if (delta > 0) {
+			value = counter_value_add (c, delta);
+			/* It's illegal to increase the count from zero if
+			   there has been a waiter. */
+			ASSERT (value != (uint32_t) delta || !ATM_LOAD (&c->waited));
+			ASSERT (value > value - delta); /* Crash on overflow. */
+		} else {
+			if (ATM_LOAD (&c->value) <= decrement) {
+				int i;
+				for (i = 0; i != COUNTER_SHARDS; i++) {
+					do {
+						credit = ATM_LOAD (&c->shards[i].credit);
+					} while (!ATM_CAS_RELACQ (&c->shards[i].credit, credit, 0));
+					if (credit != 0) {
+						counter_value_add (c, (int32_t) credit);
+					}
+				}
+			}
+			value = counter_value_add (c, delta);
+			ASSERT (value < value - delta); /* Crash on overflow. */
+			if (value == 0) {
+				counter_wake_waiters (c);
+			}
+		}
+		/* Give the shard some credit, so that the calling thread's
+		   next few operations need not lock. */
+		grant = (value == 0? 0 : (value - 1) / (2 * COUNTER_SHARDS));
+		if (grant != 0) {
+			counter_value_add (c, -(int32_t) grant);
+			do {
+				credit = ATM_LOAD (&s->credit);
+			} while (!ATM_CAS_RELACQ (&s->credit, credit, credit+grant));
+		}
+		nsync_mu_unlock (&c->counter_mu);
+	}
+	return (value);
 }
 
 uint32_t nsync_counter_add (nsync_counter c, int32_t delta) {
@@ -54,10 +191,21 @@ uint32_t nsync_counter_add (nsync_counter c, int32_t delta) {
 	IGNORE_RACES_START ();
 	if (delta == 0) {
 		value = ATM_LOAD_ACQ (&c->value);
+	} else if (c->shards != NULL) {
+		value = counter_add_sharded (c, delta);
 	} else {
-		nsync_mu_lock (&c->counter_mu);
+		/* Only a change to or from zero needs counter_mu: waiters
+		   care only that the value has reached zero, and a thread
+		   that sees zero may free c once it can acquire counter_mu,
+		   so no other change may touch c after its CAS.  */
+		int locked = 0;
 		do {
 			value = ATM_LOAD (&c->value);
+			if (!locked && (value == 0 || value + delta == 0)) {
+				nsync_mu_lock (&c->counter_mu);
+				locked = 1;
+				value = ATM_LOAD (&c->value);
+			}
 		} while (!ATM_CAS_RELACQ (&c->value, value, value+delta));
 		value += delta;
 		if (delta > 0) {
@@ -69,15 +217,11 @@ uint32_t nsync_counter_add (nsync_counter c, int32_t delta) {
 			ASSERT (value < value - delta); /* Crash on overflow. */
 		}
 		if (value == 0) {
-			nsync_dll_element_ *p;
-			while ((p = nsync_dll_first_ (c->waiters)) != NULL) {
-				struct nsync_waiter_s *nw = DLL_NSYNC_WAITER (p);
-				c->waiters = nsync_dll_remove_ (c->waiters, p);
-				ATM_STORE_REL (&nw->waiting, 0);
-				nsync_mu_semaphore_v (nw->sem);
-			}
+			counter_wake_waiters (c);
+		}
+		if (locked) {
+			nsync_mu_unlock (&c->counter_mu);
 		}
-		nsync_mu_unlock (&c->counter_mu);
 	}
 	IGNORE_RACES_END ();
 	return (value);
@@ -87,6 +231,12 @@ uint32_t nsync_counter_value (nsync_counter c) {
 	uint32_t result;
 	IGNORE_RACES_START ();
 	result = ATM_LOAD_ACQ (&c->value);
+	if (c->shards != NULL && result != 0) {
+		int i;
+		for (i = 0; i != COUNTER_SHARDS; i++) {
+			result += ATM_LOAD_ACQ (&c->shards[i].credit);
+		}
+	}
 	IGNORE_RACES_END ();
 	return (result);
 }
@@ -98,9 +248,7 @@ uint32_t nsync_counter_wait (nsync_counter c, nsync_time abs_deadline) {
 	waitable.v = c;
 	waitable.funcs = &nsync_counter_waitable_funcs;
 	if (nsync_wait_n (NULL, NULL, NULL, abs_deadline, 1, &pwaitable) != 0) {
-		IGNORE_RACES_START ();
-		result = ATM_LOAD_ACQ (&c->value);
-		IGNORE_RACES_END ();
+		result = nsync_counter_value (c);
 	}
 	return (result);
 }
@@ -141,6 +289,21 @@ static int counter_dequeue (void *v, struct nsync_waiter_s *nw) {
 	return (value != 0);
 }
 
+nsync_atomic_uint32_ *nsync_counter_futex_word_ (void *v, uint32_t *value, nsync_time *deadline) {
+	nsync_counter c = (nsync_counter) v;
+	nsync_atomic_uint32_ *word = NULL;
+	/* The fence orders this store before the read of value; see
+	   counter_wake_waiters(). */
+	ATM_STORE (&c->waited, 1);
+	ATM_FENCE ();
+	*value = ATM_LOAD_ACQ (&c->value);
+	if (*value != 0) {
+		word = &c->value;
+		*deadline = nsync_time_no_deadline;
+	}
+	return (word);
+}
+
 const struct nsync_waitable_funcs_s nsync_counter_waitable_funcs = {
 	&counter_ready_time,
 	&counter_enqueue,
@@ -42,6 +42,8 @@ static void wake_waiters (nsync_dll_list_ to_wake_list, int all_readers) {
 	struct nsync_waiter_s *first_nw = DLL_NSYNC_WAITER (first_waiter);
 	waiter *first_w = NULL;
 	nsync_mu *pmu = NULL;
+	waiter *chain_first = NULL; /* first waiter to be woken via cv_wake_next */
+	waiter *chain_last = NULL;  /* last waiter to be woken via cv_wake_next */
 	if ((first_nw->flags & NSYNC_WAITER_FLAG_MUCV) != 0) {
 		first_w = DLL_WAITER (first_waiter);
 		pmu = first_w->cv_mu;
@@ -135,14 +137,37 @@ static void wake_waiters (nsync_dll_list_ to_wake_list, int all_readers) {
 		}
 	}
 
-	/* Wake any waiters we didn't manage to enqueue on the mu. */
+	/* Wake any waiters we didn't manage to enqueue on the mu.  Waiters that
+	   will reacquire the same lock that is not an nsync_mu cannot be moved
+	   to its queue, so they are chained through cv_wake_next instead: we
+	   wake only the first, and each passes the wakeup on once it holds the
+	   lock.  The cost to the waker does not grow with the number of such
+	   waiters, and they do not all contend for the lock at once.  */
 	for (p = nsync_dll_first_ (to_wake_list); p != NULL; p = next) {
 		struct nsync_waiter_s *p_nw = DLL_NSYNC_WAITER (p);
+		waiter *p_w = NULL;
+		if ((p_nw->flags & NSYNC_WAITER_FLAG_MUCV) != 0) {
+			p_w = DLL_WAITER (p);
+		}
 		next = nsync_dll_next_ (to_wake_list, p);
 		to_wake_list = nsync_dll_remove_ (to_wake_list, p);
-		/* Wake the waiter. */
-		ATM_STORE_REL (&p_nw->waiting, 0); /* release store */
-		nsync_mu_semaphore_v (p_nw->sem);
+		if (p_w != NULL && p_w->cv_lock != NULL &&
+		    (chain_first == NULL || p_w->cv_lock == chain_first->cv_lock)) {
+			if (chain_first == NULL) {
+				chain_first = p_w;
+			} else {
+				chain_last->cv_wake_next = p_w;
+			}
+			chain_last = p_w;
+		} else {
+			/* Wake the waiter. */
+			nsync_waiter_wake_ (p_nw);
+		}
+	}
+	/* Wake the first chained waiter, now that the chain is complete. */
+	if (chain_first != NULL) {
+		ATM_STORE_REL (&chain_first->nw.waiting, 0); /* release store */
+		nsync_mu_semaphore_v (&chain_first->sem);
 	}
 }
 
@@ -203,6 +228,7 @@ int nsync_cv_wait_with_deadline_generic (nsync_cv *pcv, void *pmu,
 		cv_mu = (nsync_mu *) pmu;
 	}
 	w->cv_mu = cv_mu;       /* If *pmu is an nsync_mu, record its address, else record NULL. */
+	w->cv_lock = (cv_mu == NULL? pmu : NULL);
 	is_reader_mu = 0; /* If true, an nsync_mu in reader mode. */
 	if (cv_mu == NULL) {
 		w->l_type = NULL;
@@ -273,6 +299,14 @@ int nsync_cv_wait_with_deadline_generic (nsync_cv *pcv, void *pmu,
 						old_word &= ~(CV_NON_EMPTY);
 					}
 					ATM_STORE_REL (&w->nw.waiting, 0); /* release store */
+				} else {
+					/* A waker has removed *w, and will wake
+					   it, though perhaps only after waiters
+					   chained before it have reacquired
+					   *pmu.  Block until then.  */
+					sem_outcome = 0;
+					abs_deadline = nsync_time_no_deadline;
+					cancel_note = NULL;
 				}
 			}
 			/* Release spinlock. */
@@ -288,6 +322,8 @@ int nsync_cv_wait_with_deadline_generic (nsync_cv *pcv, void *pmu,
 			attempts = nsync_spin_delay_ (attempts);
 		}
 	}
+	/* *w may have been moved to *pmu's queue and woken from there. */
+	nsync_mu_wake_batch_ (w);
 
 	if (cv_mu != NULL && w->cv_mu == NULL) { /* waiter was moved to *pmu's queue, and woken. */
 		/* Requeue on *pmu using existing waiter struct; current thread
@@ -296,12 +332,19 @@ int nsync_cv_wait_with_deadline_generic (nsync_cv *pcv, void *pmu,
 		nsync_waiter_free_ (w);
 	} else {
 		/* Traditional case: We've woken from the cv, and need to reacquire *pmu. */
+		waiter *wake_next = w->cv_wake_next;
+		w->cv_wake_next = NULL;
 		nsync_waiter_free_ (w);
 		if (is_reader_mu) {
 			nsync_mu_rlock (cv_mu);
 		} else {
 			(*lock) (pmu);
 		}
+		if (wake_next != NULL) {
+			/* Pass on the wakeup of a chain built by wake_waiters(). */
+			ATM_STORE_REL (&wake_next->nw.waiting, 0); /* release store */
+			nsync_mu_semaphore_v (&wake_next->sem);
+		}
 	}
 	IGNORE_RACES_END ();
 	return (outcome);
@@ -0,0 +1,153 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#include "nsync_cpp.h"
+#include "platform.h"
+#include "compiler.h"
+#include "cputype.h"
+#include "nsync.h"
+#include "nsync_eventfd.h"
+#include "dll.h"
+#include "sem.h"
+#include "wait_internal.h"
+#include "common.h"
+#include "atomic.h"
+
+NSYNC_CPP_START_
+
+/* Implementation notes
+
+   An nsync_eventfd holds a struct nsync_waiter_s with no semaphore, and
+   NSYNC_WAITER_FLAG_EVENTFD set, so that nsync_waiter_wake_() calls
+   nsync_eventfd_wake_() for it.  That writes to the eventfd before it sets
+   nw.waiting to zero, so once nw.waiting is zero, and the waiter is not
+   queued, no waker will touch the nsync_eventfd again.
+
+   The eventfd's count is drained only when the waiter is queued anew, so
+   the descriptor stays readable from the wakeup until nsync_eventfd_ready()
+   reports it.  */
+
+#if defined(EFD_CLOEXEC) && defined(EFD_NONBLOCK)
+
+struct nsync_eventfd_s_ {
+	struct nsync_waitable_s w;  /* the object, and its functions */
+	struct nsync_waiter_s nw;   /* queued on w.v while queued is non-zero */
+	int queued;                 /* whether nw has been queued on w.v */
+	int fd;                     /* the eventfd */
+};
+
+void nsync_eventfd_wake_ (struct nsync_waiter_s *nw) {
+	nsync_eventfd e = CONTAINER (struct nsync_eventfd_s_, nw, nw);
+	(void) eventfd_write (e->fd, 1);
+	ATM_STORE_REL (&nw->waiting, 0); /* release store */
+}
+
+/* Make e's descriptor unreadable, and queue e on its object.  If the object
+   is ready, make the descriptor readable instead, and return non-zero. */
+static int eventfd_requeue (nsync_eventfd e) {
+	eventfd_t count;
+	int ready = 0;
+	(void) eventfd_read (e->fd, &count);
+	if ((*e->w.funcs->enqueue) (e->w.v, &e->nw)) {
+		e->queued = 1;
+	} else {
+		(void) eventfd_write (e->fd, 1);
+		ready = 1;
+	}
+	return (ready);
+}
+
+nsync_eventfd nsync_eventfd_new (const struct nsync_waitable_s *w) {
+	nsync_eventfd e = (nsync_eventfd) malloc (sizeof (*e));
+	if (e != NULL) {
+		memset ((void *) e, 0, sizeof (*e));
+		e->fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (e->fd < 0) {
+			free (e);
+			e = NULL;
+		} else {
+			e->w = *w;
+			e->nw.tag = NSYNC_WAITER_TAG;
+			e->nw.sem = NULL;
+			nsync_dll_init_ (&e->nw.q, &e->nw);
+			ATM_STORE (&e->nw.waiting, 0);
+			e->nw.flags = NSYNC_WAITER_FLAG_EVENTFD;
+			IGNORE_RACES_START ();
+			eventfd_requeue (e);
+			IGNORE_RACES_END ();
+		}
+	}
+	return (e);
+}
+
+int nsync_eventfd_fd (nsync_eventfd e) {
+	return (e->fd);
+}
+
+int nsync_eventfd_ready (nsync_eventfd e) {
+	int ready = 0;
+	IGNORE_RACES_START ();
+	if (e->queued &&
+	    (ATM_LOAD_ACQ (&e->nw.waiting) == 0 ||
+	     nsync_time_cmp ((*e->w.funcs->ready_time) (e->w.v, &e->nw), nsync_time_zero) <= 0)) {
+		(*e->w.funcs->dequeue) (e->w.v, &e->nw);
+		e->queued = 0;
+		ready = 1;
+	}
+	if (!e->queued && eventfd_requeue (e)) {
+		ready = 1;
+	}
+	IGNORE_RACES_END ();
+	return (ready);
+}
+
+void nsync_eventfd_free (nsync_eventfd e) {
+	IGNORE_RACES_START ();
+	if (e->queued) {
+		unsigned attempts = 0;
+		(*e->w.funcs->dequeue) (e->w.v, &e->nw);
+		/* A waker that had already dequeued e may not yet have
+		   written to e->fd. */
+		while (ATM_LOAD_ACQ (&e->nw.waiting) != 0) {
+			attempts = nsync_spin_delay_ (attempts);
+		}
+	}
+	IGNORE_RACES_END ();
+	close (e->fd);
+	free (e);
+}
+
+#else
+
+void nsync_eventfd_wake_ (struct nsync_waiter_s *nw UNUSED) {
+}
+
+nsync_eventfd nsync_eventfd_new (const struct nsync_waitable_s *w UNUSED) {
+	return (NULL);
+}
+
+int nsync_eventfd_fd (nsync_eventfd e UNUSED) {
+	return (-1);
+}
+
+int nsync_eventfd_ready (nsync_eventfd e UNUSED) {
+	return (0);
+}
+
+void nsync_eventfd_free (nsync_eventfd e UNUSED) {
+}
+
+#endif
+
+NSYNC_CPP_END_
@@ -0,0 +1,274 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#include "nsync_cpp.h"
+#include "platform.h"
+#include "compiler.h"
+#include "cputype.h"
+#include "nsync.h"
+#include "nsync_fd.h"
+#include "dll.h"
+#include "sem.h"
+#include "wait_internal.h"
+#include "common.h"
+#include "atomic.h"
+
+NSYNC_CPP_START_
+
+/* Implementation notes
+
+   One poller thread per process blocks in epoll_wait() on every nsync_fd
+   that has waiters.  A descriptor is registered with EPOLLONESHOT when a
+   waiter is queued on its nsync_fd and the registration is not already
+   armed; when epoll reports it, the poller wakes all its waiters with
+   nsync_waiter_wake_(), which V's the semaphore of each waiting thread (or
+   writes an nsync_eventfd).  A waiter that leaves without being woken stays
+   registered; the poller may later find the nsync_fd with no waiters.
+
+   The poller may hold an event for an nsync_fd that has been removed from
+   the epoll set, so nsync_fd_free() does not free the nsync_fd, but passes
+   it to the poller, which frees it after it has handled the events it
+   received before the removal.  The poller's eventfd, registered with
+   data.ptr==NULL, wakes it to do so.  */
+
+#if defined(EPOLLONESHOT) && defined(EFD_CLOEXEC)
+
+struct nsync_fd_s_ {
+	int fd;                   /* the client's descriptor */
+	uint32_t events;          /* EPOLLIN and/or EPOLLOUT */
+	nsync_mu mu;              /* protects the fields below */
+	nsync_dll_list_ waiters;  /* of struct nsync_waiter_s */
+	int registered;           /* whether fd is in the poller's epoll set */
+	int armed;                /* whether fd's registration is armed */
+	struct nsync_fd_s_ *next_freed;  /* in fd_poller.freed */
+};
+
+static struct {
+	int epfd;                  /* the epoll set; -1 if it could not be created */
+	int wakefd;                /* eventfd that wakes the poller */
+	nsync_mu mu;               /* protects freed */
+	struct nsync_fd_s_ *freed; /* nsync_fds to be freed by the poller */
+} fd_poller;
+
+static nsync_once fd_poller_once = NSYNC_ONCE_INIT;
+
+/* Wake every waiter queued on f, whose registration has fired. */
+static void fd_wake_waiters (nsync_fd f) {
+	nsync_dll_element_ *p;
+	nsync_mu_lock (&f->mu);
+	f->armed = 0;
+	while ((p = nsync_dll_first_ (f->waiters)) != NULL) {
+		struct nsync_waiter_s *nw = DLL_NSYNC_WAITER (p);
+		f->waiters = nsync_dll_remove_ (f->waiters, p);
+		nsync_waiter_wake_ (nw);
+	}
+	nsync_mu_unlock (&f->mu);
+}
+
+/* The body of the poller thread. */
+static void *fd_poller_thread (void *arg UNUSED) {
+	struct epoll_event ev[64];
+	for (;;) {
+		nsync_fd freed;
+		int n = epoll_wait (fd_poller.epfd, ev, (int) (sizeof (ev) / sizeof (ev[0])), -1);
+		int i;
+		for (i = 0; i < n; i++) {
+			if (ev[i].data.ptr == NULL) {
+				eventfd_t count;
+				(void) eventfd_read (fd_poller.wakefd, &count);
+			} else {
+				fd_wake_waiters ((nsync_fd) ev[i].data.ptr);
+			}
+		}
+		/* Every nsync_fd on fd_poller.freed was removed from the epoll
+		   set before epoll_wait() returned above, so will not be
+		   reported again. */
+		nsync_mu_lock (&fd_poller.mu);
+		freed = fd_poller.freed;
+		fd_poller.freed = NULL;
+		nsync_mu_unlock (&fd_poller.mu);
+		while (freed != NULL) {
+			nsync_fd f = freed;
+			freed = f->next_freed;
+			free (f);
+		}
+	}
+	return (NULL);
+}
+
+/* Create the epoll set, and start the poller thread. */
+static void fd_poller_init (void) {
+	nsync_mu_init (&fd_poller.mu);
+	fd_poller.epfd = epoll_create1 (EPOLL_CLOEXEC);
+	fd_poller.wakefd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd_poller.epfd >= 0 && fd_poller.wakefd >= 0) {
+		struct epoll_event ev;
+		pthread_t t;
+		memset ((void *) &ev, 0, sizeof (ev));
+		ev.events = EPOLLIN;
+		ev.data.ptr = NULL;
+		if (epoll_ctl (fd_poller.epfd, EPOLL_CTL_ADD, fd_poller.wakefd, &ev) != 0 ||
+		    pthread_create (&t, NULL, &fd_poller_thread, NULL) != 0) {
+			close (fd_poller.epfd);
+			fd_poller.epfd = -1;
+		} else {
+			pthread_detach (t);
+		}
+	} else if (fd_poller.epfd >= 0) {
+		close (fd_poller.epfd);
+		fd_poller.epfd = -1;
+	}
+}
+
+nsync_fd nsync_fd_new (int fd, int events) {
+	nsync_fd f = NULL;
+	nsync_run_once (&fd_poller_once, &fd_poller_init);
+	if (fd_poller.epfd >= 0) {
+		f = (nsync_fd) malloc (sizeof (*f));
+	}
+	if (f != NULL) {
+		memset ((void *) f, 0, sizeof (*f));
+		f->fd = fd;
+		f->events = ((events & NSYNC_FD_READABLE) != 0? (uint32_t) EPOLLIN : 0) |
+			    ((events & NSYNC_FD_WRITABLE) != 0? (uint32_t) EPOLLOUT : 0);
+		nsync_mu_init (&f->mu);
+	}
+	return (f);
+}
+
+void nsync_fd_free (nsync_fd f) {
+	nsync_mu_lock (&f->mu);
+	ASSERT (nsync_dll_is_empty_ (f->waiters));
+	if (f->registered) {
+		(void) epoll_ctl (fd_poller.epfd, EPOLL_CTL_DEL, f->fd, NULL);
+		f->registered = 0;
+	}
+	nsync_mu_unlock (&f->mu);
+	nsync_mu_lock (&fd_poller.mu);
+	f->next_freed = fd_poller.freed;
+	fd_poller.freed = f;
+	nsync_mu_unlock (&fd_poller.mu);
+	(void) eventfd_write (fd_poller.wakefd, 1);
+}
+
+/* Return whether f's descriptor has any of its events pending now. */
+static int fd_is_ready (nsync_fd f) {
+	struct pollfd pfd;
+	memset ((void *) &pfd, 0, sizeof (pfd));
+	pfd.fd = f->fd;
+	pfd.events = ((f->events & EPOLLIN) != 0? POLLIN : 0) |
+		     ((f->events & EPOLLOUT) != 0? POLLOUT : 0);
+	return (poll (&pfd, 1, 0) == 1 && pfd.revents != 0);
+}
+
+/* The waitable functions.  Once a waiter has been queued, only the poller
+   decides that the descriptor is ready, so that ready_time() need not make
+   a system call each time a thread in nsync_wait_n() wakes. */
+static nsync_time fd_ready_time (void *v, struct nsync_waiter_s *nw) {
+	nsync_time r;
+	if (nw != NULL) {
+		r = (ATM_LOAD_ACQ (&nw->waiting) != 0? nsync_time_no_deadline : nsync_time_zero);
+	} else {
+		r = (fd_is_ready ((nsync_fd) v)? nsync_time_zero : nsync_time_no_deadline);
+	}
+	return (r);
+}
+
+static int fd_enqueue (void *v, struct nsync_waiter_s *nw) {
+	nsync_fd f = (nsync_fd) v;
+	int waiting = 0;
+	nsync_mu_lock (&f->mu);
+	if (!fd_is_ready (f)) {
+		struct epoll_event ev;
+		int ctl_result = 0;
+		f->waiters = nsync_dll_make_last_in_list_ (f->waiters, &nw->q);
+		ATM_STORE (&nw->waiting, 1);
+		waiting = 1;
+		if (!f->armed) {
+			/* epoll reports the descriptor at once if it became
+			   ready since the check above. */
+			memset ((void *) &ev, 0, sizeof (ev));
+			ev.events = f->events | EPOLLONESHOT;
+			ev.data.ptr = f;
+			ctl_result = epoll_ctl (fd_poller.epfd,
+						f->registered? EPOLL_CTL_MOD : EPOLL_CTL_ADD,
+						f->fd, &ev);
+			f->registered = 1;
+			f->armed = 1;
+		}
+		if (ctl_result != 0) {
+			/* The descriptor cannot be watched, for example because
+			   it is a regular file; treat it as ready. */
+			f->waiters = nsync_dll_remove_ (f->waiters, &nw->q);
+			ATM_STORE (&nw->waiting, 0);
+			f->registered = 0;
+			f->armed = 0;
+			waiting = 0;
+		}
+	} else {
+		ATM_STORE (&nw->waiting, 0);
+	}
+	nsync_mu_unlock (&f->mu);
+	return (waiting);
+}
+
+static int fd_dequeue (void *v, struct nsync_waiter_s *nw) {
+	nsync_fd f = (nsync_fd) v;
+	int was_queued = 0;
+	nsync_mu_lock (&f->mu);
+	if (ATM_LOAD_ACQ (&nw->waiting) != 0) {
+		f->waiters = nsync_dll_remove_ (f->waiters, &nw->q);
+		ATM_STORE (&nw->waiting, 0);
+		was_queued = 1;
+	}
+	nsync_mu_unlock (&f->mu);
+	return (was_queued);
+}
+
+const struct nsync_waitable_funcs_s nsync_fd_waitable_funcs = {
+	&fd_ready_time,
+	&fd_enqueue,
+	&fd_dequeue
+};
+
+#else
+
+nsync_fd nsync_fd_new (int fd UNUSED, int events UNUSED) {
+	return (NULL);
+}
+
+void nsync_fd_free (nsync_fd f UNUSED) {
+}
+
+static nsync_time fd_ready_time (void *v UNUSED, struct nsync_waiter_s *nw UNUSED) {
+	return (nsync_time_zero);
+}
+
+static int fd_enqueue (void *v UNUSED, struct nsync_waiter_s *nw UNUSED) {
+	return (0);
+}
+
+static int fd_dequeue (void *v UNUSED, struct nsync_waiter_s *nw UNUSED) {
+	return (0);
+}
+
+const struct nsync_waitable_funcs_s nsync_fd_waitable_funcs = {
+	&fd_ready_time,
+	&fd_enqueue,
+	&fd_dequeue
+};
+
+#endif
+
+NSYNC_CPP_END_
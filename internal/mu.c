@@ -38,16 +38,141 @@ static void mu_release_spinlock (nsync_mu *mu) {
 	}
 }
 
-/* Lock *mu using the specified lock_type, waiting on *w if necessary.
-   "clear" should be zero if the thread has not previously slept on *mu, and
-   MU_DESIG_WAKER if it has; this represents bits that nsync_mu_lock_slow_() must clear when
-   it either acquires or sleeps on *mu.  The caller owns *w on return; it is in a valid
-   state to be returned to the free pool. */
-void nsync_mu_lock_slow_ (nsync_mu *mu, waiter *w, uint32_t clear, lock_type *l_type) {
+/* Adaptive spinning.
+
+   A thread that finds *mu held polls mu->word for a while before queueing
+   itself, because a critical section that lasts a few hundred nanoseconds is
+   far cheaper to wait out than a sleep and a wakeup in the kernel.  Portable
+   code cannot tell whether the holder is running, so the spin length is
+   instead learned from the hold times observed on *mu: a spin that sees the
+   lock released moves the budget towards twice the number of polls it took,
+   while a spin that gives up decays it.  A mutex whose holders block or
+   are descheduled thus soon spins for only MU_SPIN_MIN polls.
+
+   Budgets are kept in a small table indexed by a hash of the mutex's address,
+   so that nsync_mu stays two words; mutexes that collide merely share a
+   budget.  Each entry has a cache line to itself, because unrelated mutexes
+   would otherwise contend for the line when the budgets are updated. */
+#define MU_SPIN_MIN 16       /* polls always made before sleeping */
+#define MU_SPIN_MAX 2048     /* polls never exceeded before sleeping */
+#define MU_SPIN_TABLE_SIZE 64 /* number of budgets; a power of two */
+
+static struct mu_spin_budget_s {
+	nsync_atomic_uint32_ budget; /* learned number of polls */
+	char pad[64 - sizeof (nsync_atomic_uint32_)];
+} mu_spin_budget[MU_SPIN_TABLE_SIZE];
+
+/* Return a pointer to the spin budget used for *mu. */
+static nsync_atomic_uint32_ *mu_spin_budget_for (nsync_mu *mu) {
+	uintptr_t h = ((uintptr_t) mu) / sizeof (*mu);
+	h ^= (h >> 6) ^ (h >> 12);
+	return (&mu_spin_budget[h & (MU_SPIN_TABLE_SIZE - 1)].budget);
+}
+
+/* Poll mu->word until none of the bits in "held" is set, or until some bit in
+   "give_up" is set, or until the spin budget for *mu is exhausted.  Updates
+   the spin budget of *mu according to the outcome.  */
+static void mu_spin (nsync_mu *mu, uint32_t held, uint32_t give_up) {
+	nsync_atomic_uint32_ *pbudget = mu_spin_budget_for (mu);
+	uint32_t budget = ATM_LOAD (pbudget);
+	uint32_t limit = MIN_ (2 * budget + MU_SPIN_MIN, MU_SPIN_MAX);
+	uint32_t polls = 0;
+	uint32_t new_budget;
+	uint32_t word = ATM_LOAD (&mu->word);
+	while ((word & held) != 0 && (word & give_up) == 0 && polls != limit) {
+		volatile int i;
+		for (i = 0; i != 4; i++) {
+		}
+		polls++;
+		word = ATM_LOAD (&mu->word);
+	}
+	if ((word & held) == 0) {
+		/* Move one eighth of the way towards twice the observed wait. */
+		new_budget = budget + ((int32_t) (2 * polls - budget)) / 8;
+	} else {
+		/* Decay; the holder has been seen to keep the lock for a long time. */
+		new_budget = budget - budget / 8;
+	}
+	if (new_budget != budget) {
+		/* Races on the budget merely lose an update to a heuristic. */
+		ATM_STORE (pbudget, new_budget);
+	}
+}
+
+/* Called after *w has been queued on *mu with remove_count equal to
+   w->remove_count.  Wait until *w is woken, abs_deadline passes, or
+   *cancel_note is notified.  Return 0 if *w was woken before the deadline or
+   cancellation.  Otherwise return ETIMEDOUT or ECANCELED; in that case, if
+   *removed is set to non-zero, *w has been removed from mu->waiters along with
+   the long_wait bit it set in mu->word, and if *removed is zero, *w was woken
+   after all, and so its thread is a designated waker.
+
+   An unlocker may have detached *w from mu->waiters in order to examine it
+   (see nsync_mu_unlock_slow_()).  An unlocker sets MU_DESIG_WAKER before it
+   detaches the queue and does not clear it until the queue is whole again,
+   so if the spinlock is held and MU_DESIG_WAKER is clear, *w is on
+   mu->waiters unless it has been woken, and can be removed in constant time.
+   Otherwise the unlocker will soon either wake *w, or return it to
+   mu->waiters and release the designated waker, which soon acquires *mu or
+   sleeps; the loop spins until one or the other.  The remove_count check
+   avoids taking the spinlock when *w is known to be about to be woken. */
+static int mu_wait_for_wakeup (nsync_mu *mu, waiter *w, uint32_t remove_count,
+			       uint32_t long_wait, nsync_time abs_deadline,
+			       nsync_note cancel_note, int *removed) {
+	int outcome = 0;
+	unsigned attempts = 0;
+	*removed = 0;
+	while (ATM_LOAD_ACQ (&w->nw.waiting) != 0 && outcome == 0) { /* acquire load */
+		outcome = nsync_sem_wait_with_cancel_ (w, abs_deadline, cancel_note);
+	}
+	while (ATM_LOAD_ACQ (&w->nw.waiting) != 0) {
+		if (ATM_LOAD (&w->remove_count) == remove_count &&
+		    (ATM_LOAD (&mu->word) & MU_DESIG_WAKER) == 0) {
+			uint32_t old_word = nsync_spin_test_and_set_ (&mu->word, MU_SPINLOCK,
+								      MU_SPINLOCK, 0);
+			if (ATM_LOAD (&w->nw.waiting) != 0 &&
+			    (old_word & MU_DESIG_WAKER) == 0) {
+				uint32_t clear = MU_SPINLOCK | long_wait;
+				mu->waiters = nsync_remove_from_mu_queue_ (mu->waiters, &w->nw.q);
+				ATM_STORE (&w->nw.waiting, 0);
+				/* No unlocker holds a detached part of the
+				   queue, so mu->waiters is the whole queue. */
+				if (nsync_dll_is_empty_ (mu->waiters)) {
+					clear |= MU_WAITING | MU_WRITER_WAITING |
+						 MU_CONDITION | MU_ALL_FALSE;
+				}
+				do {
+					old_word = ATM_LOAD (&mu->word);
+				} while (!ATM_CAS_REL (&mu->word, old_word, old_word & ~clear));
+				*removed = 1;
+			} else {
+				mu_release_spinlock (mu);
+			}
+		}
+		if (ATM_LOAD_ACQ (&w->nw.waiting) != 0) {
+			attempts = nsync_spin_delay_ (attempts);
+		}
+	}
+	return (outcome);
+}
+
+/* Lock *mu using the specified lock_type, waiting on *w if necessary, until
+   abs_deadline passes or *cancel_note is notified.  Return 0 if *mu was
+   acquired, and otherwise ETIMEDOUT or ECANCELED.  "clear" should be zero if
+   the thread has not previously slept on *mu, and MU_DESIG_WAKER if it has;
+   this represents bits that mu_lock_slow() must clear when it either acquires,
+   sleeps on, or gives up on *mu.  The caller owns *w on return; it is in a
+   valid state to be returned to the free pool. */
+static int mu_lock_slow (nsync_mu *mu, waiter *w, uint32_t clear, lock_type *l_type,
+			 nsync_time abs_deadline, nsync_note cancel_note) {
 	uint32_t zero_to_acquire;
 	uint32_t wait_count;
 	uint32_t long_wait;
 	unsigned attempts = 0; /* attempt count; used for spinloop backoff */
+	int spun = 0; /* whether mu_spin() was called since last woken */
+	int outcome = 0; /* ETIMEDOUT or ECANCELED once the wait has expired */
+	int has_deadline = (cancel_note != NULL ||
+			    nsync_time_cmp (abs_deadline, nsync_time_no_deadline) != 0);
 	w->cv_mu = NULL;      /* not a cv wait */
 	w->cond.f = NULL; /* Not using a conditional critical section. */
 	w->cond.v = NULL;
@@ -68,18 +193,34 @@ void nsync_mu_lock_slow_ (nsync_mu *mu, waiter *w, uint32_t clear, lock_type *l_
 			if (ATM_CAS_ACQ (&mu->word, old_word,
 					 (old_word+l_type->add_to_acquire) &
 					  ~(clear|long_wait|l_type->clear_on_acquire))) {
-				return;
+				return (0);
+			}
+		} else if (outcome != 0) {
+			/* Woken after the deadline or cancellation, and unable
+			   to acquire.  Give up, clearing MU_DESIG_WAKER; the
+			   thread holding *mu will wake a waiter when it
+			   releases. */
+			if (ATM_CAS (&mu->word, old_word, old_word & ~(clear|long_wait))) {
+				return (outcome);
 			}
+		} else if (!spun && (old_word & zero_to_acquire & ~MU_ANY_LOCK) == 0) {
+			/* Only a lock holder stands in the way; it may release
+			   soon, so poll for a while before sleeping.  */
+			mu_spin (mu, zero_to_acquire & MU_ANY_LOCK,
+				 zero_to_acquire & ~MU_ANY_LOCK);
+			spun = 1;
 		} else if ((old_word&MU_SPINLOCK) == 0 &&
 			   ATM_CAS_ACQ (&mu->word, old_word,
 					(old_word|MU_SPINLOCK|long_wait|
 					 l_type->set_when_waiting) & ~(clear | MU_ALL_FALSE))) {
+			uint32_t remove_count;
 
 			/* Spinlock is now held, and lock is held by someone
 			   else; MU_WAITING has also been set; queue ourselves.
 			   There's no need to adjust same_condition here,
 			   because w.condition==NULL.  */
 			ATM_STORE (&w->nw.waiting, 1);
+			remove_count = ATM_LOAD (&w->remove_count);
 			if (wait_count == 0) {
 				/* first wait goes to end of queue */
 				mu->waiters = nsync_dll_make_last_in_list_ (mu->waiters,
@@ -98,9 +239,20 @@ void nsync_mu_lock_slow_ (nsync_mu *mu, waiter *w, uint32_t clear, lock_type *l_
 			mu_release_spinlock (mu);
 
 			/* wait until awoken. */
-			while (ATM_LOAD_ACQ (&w->nw.waiting) != 0) { /* acquire load */
-				nsync_mu_semaphore_p (&w->sem);
+			if (!has_deadline) {
+				while (ATM_LOAD_ACQ (&w->nw.waiting) != 0) { /* acquire load */
+					nsync_mu_semaphore_p (&w->sem);
+				}
+			} else {
+				int removed;
+				outcome = mu_wait_for_wakeup (mu, w, remove_count, long_wait,
+							      abs_deadline, cancel_note,
+							      &removed);
+				if (removed) {
+					return (outcome);
+				}
 			}
+			nsync_mu_wake_batch_ (w);
 			wait_count++;
 			/* If the thread has been woken more than this many
 			   times, and still not acquired, it sets the
@@ -115,6 +267,7 @@ void nsync_mu_lock_slow_ (nsync_mu *mu, waiter *w, uint32_t clear, lock_type *l_
 			}
 
 			attempts = 0;
+			spun = 0;
 			clear = MU_DESIG_WAKER;
 			/* Threads that have been woken at least once don't care
 			   about waiting writers or long waiters. */
@@ -124,6 +277,15 @@ void nsync_mu_lock_slow_ (nsync_mu *mu, waiter *w, uint32_t clear, lock_type *l_
 	}
 }
 
+/* Lock *mu using the specified lock_type, waiting on *w if necessary.
+   "clear" should be zero if the thread has not previously slept on *mu, and
+   MU_DESIG_WAKER if it has; this represents bits that nsync_mu_lock_slow_() must clear when
+   it either acquires or sleeps on *mu.  The caller owns *w on return; it is in a valid
+   state to be returned to the free pool. */
+void nsync_mu_lock_slow_ (nsync_mu *mu, waiter *w, uint32_t clear, lock_type *l_type) {
+	mu_lock_slow (mu, w, clear, l_type, nsync_time_no_deadline, NULL);
+}
+
 /* Attempt to acquire *mu in writer mode without blocking, and return non-zero
    iff successful.  Return non-zero with high probability if *mu was free on
    entry.  */
@@ -177,6 +339,22 @@ int nsync_mu_rtrylock (nsync_mu *mu) {
 	return (result);
 }
 
+/* Block until *mu is free and then acquire it in writer mode, or until
+   abs_deadline passes or *cancel_note is notified.  Return 0 iff *mu was
+   acquired. */
+int nsync_mu_lock_with_deadline (nsync_mu *mu, nsync_time abs_deadline,
+				 nsync_note cancel_note) {
+	int outcome = 0;
+	IGNORE_RACES_START ();
+	if (!nsync_mu_trylock (mu)) {
+		waiter *w = nsync_waiter_new_ ();
+		outcome = mu_lock_slow (mu, w, 0, nsync_writer_type_, abs_deadline, cancel_note);
+		nsync_waiter_free_ (w);
+	}
+	IGNORE_RACES_END ();
+	return (outcome);
+}
+
 /* Block until *mu can be acquired in reader mode and then acquire it. */
 void nsync_mu_rlock (nsync_mu *mu) {
 	IGNORE_RACES_START ();
@@ -193,12 +371,93 @@ void nsync_mu_rlock (nsync_mu *mu) {
 	IGNORE_RACES_END ();
 }
 
+/* Block until *mu can be acquired in reader mode and then acquire it, or
+   until abs_deadline passes or *cancel_note is notified.  Return 0 iff *mu
+   was acquired. */
+int nsync_mu_rlock_with_deadline (nsync_mu *mu, nsync_time abs_deadline,
+				  nsync_note cancel_note) {
+	int outcome = 0;
+	IGNORE_RACES_START ();
+	if (!nsync_mu_rtrylock (mu)) {
+		waiter *w = nsync_waiter_new_ ();
+		outcome = mu_lock_slow (mu, w, 0, nsync_reader_type_, abs_deadline, cancel_note);
+		nsync_waiter_free_ (w);
+	}
+	IGNORE_RACES_END ();
+	return (outcome);
+}
+
 /* Invoke the condition associated with *p, which is an element of
    a "waiter" list. */
 static int condition_true (nsync_dll_element_ *p) {
 	return ((*DLL_WAITER (p)->cond.f) (DLL_WAITER (p)->cond.v));
 }
 
+/* A cond_memo records the values of the wait conditions evaluated during one
+   call to nsync_mu_unlock_slow_(), so that waiters with equal conditions
+   that are not adjacent in the queue (and so not linked by same_condition)
+   cause only one evaluation.  The values remain valid because the write
+   lock is held throughout.  The table is a set of hash chains threaded
+   through the waiters' cond_memo_next fields.  A condition with no eq
+   function hashes by function and argument; one with an eq function can
+   hash only by function, since eq may equate different arguments. */
+#define COND_MEMO_BUCKETS 64 /* a power of two */
+#define COND_MEMO_MAX_EQ 8
+typedef struct cond_memo_s {
+	nsync_dll_element_ *bucket[COND_MEMO_BUCKETS];
+} cond_memo;
+
+/* Initialize *m to be empty. */
+static void cond_memo_init (cond_memo *m) {
+	memset ((void *) m, 0, sizeof (*m));
+}
+
+/* Return the value of the condition of waiter *p, evaluating it and
+   recording its value in *m only if no equal condition is found there.
+
+   The memo is best-effort, so a condition may be evaluated more than once
+   per unlock:
+   - A condition with an eq function shares a chain with every condition that
+     has the same function, and at most COND_MEMO_MAX_EQ calls of eq are made
+     before the condition is simply evaluated, bounding the cost of a lookup
+     when there are many such conditions.
+   - Conditions with the same function and argument, one with an eq function
+     and one without, hash to different chains, and so are not found to be
+     equal.  */
+static int cond_memo_eval (cond_memo *m, nsync_dll_element_ *p) {
+	waiter *w = DLL_WAITER (p);
+	uintptr_t h = (uintptr_t) w->cond.f;
+	nsync_dll_element_ *e;
+	int eq_calls = 0;
+	int found = 0;
+	if (w->cond.eq == NULL) {
+		h ^= ((uintptr_t) w->cond.v) * 31;
+	}
+	h ^= (h >> 7) ^ (h >> 13);
+	h &= COND_MEMO_BUCKETS - 1;
+	for (e = m->bucket[h]; e != NULL && !found && eq_calls != COND_MEMO_MAX_EQ;
+	     e = DLL_WAITER (e)->cond_memo_next) {
+		waiter *x = DLL_WAITER (e);
+		if (x->cond.f == w->cond.f) {
+			if (x->cond.v == w->cond.v) {
+				found = 1;
+			} else if (w->cond.eq != NULL) {
+				eq_calls++;
+				found = (*w->cond.eq) (w->cond.v, x->cond.v);
+			}
+			if (found) {
+				w->cond_memo_value = x->cond_memo_value;
+			}
+		}
+	}
+	if (!found) {
+		w->cond_memo_value = condition_true (p);
+		w->cond_memo_next = m->bucket[h];
+		m->bucket[h] = p;
+	}
+	return (w->cond_memo_value);
+}
+
 /* If *p is an element of waiter_list (a list of "waiter" structs(, return a
    pointer to the next element of the list that has a different condition. */
 static nsync_dll_element_ *skip_past_same_condition (
@@ -216,9 +475,10 @@ static nsync_dll_element_ *skip_past_same_condition (
 }
 
 /* Merge the same_condition lists of *p and *n if they have the same non-NULL
-   condition.  */
+   condition and condition mask.  */
 void nsync_maybe_merge_conditions_ (nsync_dll_element_ *p, nsync_dll_element_ *n) {
 	if (p != NULL && n != NULL &&
+	    DLL_WAITER (p)->cond_mask == DLL_WAITER (n)->cond_mask &&
 	    WAIT_CONDITION_EQ (&DLL_WAITER (p)->cond, &DLL_WAITER (n)->cond)) {
 		nsync_dll_splice_after_ (&DLL_WAITER (p)->same_condition,
 				  &DLL_WAITER (n)->same_condition);
@@ -256,9 +516,62 @@ nsync_dll_list_ nsync_remove_from_mu_queue_ (nsync_dll_list_ mu_queue, nsync_dll
 	return (mu_queue);
 }
 
+/* Called by the thread of *w once *w has been woken from a mu's queue.
+   When nsync_mu_unlock_slow_() releases several readers, it wakes only the
+   first, which then wakes the others, so that the unlocking thread makes one
+   wake call however many readers are queued.  The waiters to be woken by *w
+   are the w->wake_batch waiters chained from w->wake_next.  *w wakes the
+   first of them, hands it the first half of the rest, and repeats with the
+   remainder, so every thread woken makes at most log2(n) wake calls, and
+   the last reader is woken after at most about log2(n) steps.  */
+void nsync_mu_wake_batch_ (waiter *w) {
+	while (w->wake_batch != 0) {
+		waiter *h = w->wake_next;           /* waiter to wake next */
+		int rest = w->wake_batch - 1;       /* waiters after *h */
+		int give = rest - (rest / 2);       /* number that *h will wake */
+		waiter *last_given = h;
+		int i;
+		for (i = 0; i != give; i++) {
+			last_given = last_given->wake_next;
+		}
+		w->wake_next = last_given->wake_next;
+		w->wake_batch = rest - give;
+		last_given->wake_next = NULL;
+		h->wake_batch = give;
+		ATM_STORE_REL (&h->nw.waiting, 0); /* release store */
+		nsync_mu_semaphore_v (&h->sem);
+	}
+	w->wake_next = NULL;
+}
+
 /* Unlock *mu and wake one or more waiters as appropriate after an unlock.
-   It is called with *mu held in mode l_type. */
-void nsync_mu_unlock_slow_ (nsync_mu *mu, lock_type *l_type) {
+   It is called with *mu held in mode l_type.  If l_type is
+   nsync_downgrade_type_, *mu is held in write mode and is left held in read
+   mode, so only readers are woken.  The conditions of waiters
+   whose condition masks have no bits in common with eval_mask are not
+   evaluated, but are assumed to remain false; see
+   nsync_mu_unlock_with_mask().
+
+   Threads that queue on *mu take the spinlock to append themselves to
+   mu->waiters, so the unlocker detaches the queue into a local list under
+   the spinlock, and then walks that list with the spinlock released while
+   mu->waiters collects new arrivals.  The spinlock is released only while
+   conditions are being tested, or if no waiter in the detached list has a
+   condition.  Once condition testing stops because a writer is to be woken,
+   the spinlock is held for the rest of the call, but then at most that one
+   writer is examined.  Arrivals are therefore not lock-free: they take the
+   spinlock, and may spin while the unlocker detaches the queue or puts it
+   back, but they do not wait for a walk of the queue.
+
+   Nothing else removes elements of the detached list meanwhile:
+   mu_try_acquire_after_timeout_or_cancel() needs the write lock, which is
+   held while conditions are tested, and a waiter that gives up in
+   mu_lock_slow() removes itself only while MU_DESIG_WAKER is clear, and
+   that bit is set from when the queue is detached until it is put back.
+   If no waiter has a condition, the arrivals are not examined: the rest of
+   the local list is put back in front of them, and the thread being woken
+   will wake them in turn. */
+void nsync_mu_unlock_slow_ (nsync_mu *mu, lock_type *l_type, uint32_t eval_mask) {
 	unsigned attempts = 0; /* attempt count; used for backoff */
 	for (;;) {
 		uint32_t old_word = ATM_LOAD (&mu->word);
@@ -298,6 +611,11 @@ void nsync_mu_unlock_slow_ (nsync_mu *mu, lock_type *l_type) {
 			lock_type *wake_type;
 			uint32_t clear_on_release;
 			uint32_t set_on_release;
+			/* whether no waiter in the queue has a condition */
+			int no_conditions = ((old_word & MU_CONDITION) == 0);
+			/* whether the caller retains a read lock, so that no writer can be woken */
+			int readers_only = (l_type == nsync_downgrade_type_);
+			cond_memo memo; /* conditions evaluated so far */
 			/* The spinlock is now held, and we've set the
 			   designated wake flag, since we're likely to wake a
 			   thread that will become that designated waker.  If
@@ -318,6 +636,10 @@ void nsync_mu_unlock_slow_ (nsync_mu *mu, lock_type *l_type) {
 			nsync_dll_list_ new_waiters = mu->waiters;
 			mu->waiters = NULL;
 
+			if (testing_conditions) {
+				cond_memo_init (&memo);
+			}
+
 			/* Remove a waiter from the queue, if possible. */
 			wake = NULL;       /* waiters to wake. */
 			wake_type = NULL; /* type of waiter(s) on wake, or NULL if wake is empty. */
@@ -331,7 +653,7 @@ void nsync_mu_unlock_slow_ (nsync_mu *mu, lock_type *l_type) {
 						/* No, because we're already waking a writer,
 						   and need wake no others.*/
 						testing_conditions = 0;
-					} else if (wake_type == NULL &&
+					} else if (wake_type == NULL && !readers_only &&
 						DLL_WAITER (p)->l_type != nsync_reader_type_ &&
 						DLL_WAITER (p)->cond.f == NULL) {
 						/* No, because we've woken no one, but the
@@ -344,8 +666,10 @@ void nsync_mu_unlock_slow_ (nsync_mu *mu, lock_type *l_type) {
 				/* If testing waiters' conditions, release the
 				   spinlock while still holding the write lock.
 				   This is so that the spinlock is not held
-				   while the conditions are evaluated.  */
-				if (testing_conditions) {
+				   while the conditions are evaluated.  If there
+				   are no conditions, release it so that arriving
+				   waiters need not wait for the walk below.  */
+				if (testing_conditions || no_conditions) {
 					mu_release_spinlock (mu);
 				}
 
@@ -361,11 +685,14 @@ void nsync_mu_unlock_slow_ (nsync_mu *mu, lock_type *l_type) {
 						nsync_panic_ ("checking a waiter condition "
 							      "while unlocked\n");
 					}
-					if (p_has_condition && !condition_true (p)) {
-						/* condition is false */
+					if (p_has_condition &&
+					    ((DLL_WAITER (p)->cond_mask & eval_mask) == 0 ||
+					     !cond_memo_eval (&memo, p))) {
+						/* condition is false, or is unaffected
+						   by the state changed under *mu */
 						/* skip to the end of the same_condition group. */
 						next = skip_past_same_condition (new_waiters, p);
-					} else if (wake_type == NULL ||
+					} else if ((wake_type == NULL && !readers_only) ||
 						   DLL_WAITER (p)->l_type == nsync_reader_type_) {
 						/* Wake this thread. */
 						new_waiters = nsync_remove_from_mu_queue_ (
@@ -388,9 +715,8 @@ void nsync_mu_unlock_slow_ (nsync_mu *mu, lock_type *l_type) {
 					set_on_release &= ~MU_ALL_FALSE;
 				}
 
-				/* If testing waiters' conditions, reacquire the spinlock
-				   released above. */
-				if (testing_conditions) {
+				/* Reacquire the spinlock if it was released above. */
+				if (testing_conditions || no_conditions) {
 					nsync_spin_test_and_set_ (&mu->word, MU_SPINLOCK,
 								  MU_SPINLOCK, 0);
 				}
@@ -400,8 +726,21 @@ void nsync_mu_unlock_slow_ (nsync_mu *mu, lock_type *l_type) {
 							       nsync_dll_first_ (new_waiters));
 				waiters = nsync_dll_make_last_in_list_ (waiters,
 								 nsync_dll_last_ (new_waiters));
-				/* Pick up the next set of new waiters. */
-				new_waiters = mu->waiters;
+				if (no_conditions) {
+					/* Leave the arrivals, which have not been
+					   examined, queued behind the waiters.  */
+					if (!nsync_dll_is_empty_ (mu->waiters)) {
+						set_on_release &= ~MU_ALL_FALSE;
+					}
+					nsync_maybe_merge_conditions_ (nsync_dll_last_ (waiters),
+								       nsync_dll_first_ (mu->waiters));
+					waiters = nsync_dll_make_last_in_list_ (waiters,
+									 nsync_dll_last_ (mu->waiters));
+					new_waiters = NULL;
+				} else {
+					/* Pick up the next set of new waiters. */
+					new_waiters = mu->waiters;
+				}
 				mu->waiters = NULL;
 			}
 
@@ -435,12 +774,26 @@ void nsync_mu_unlock_slow_ (nsync_mu *mu, lock_type *l_type) {
 					     ~clear_on_release)) { /* release CAS */
 				old_word = ATM_LOAD (&mu->word);
 			}
-			/* Wake the waiters. */
-			for (p = nsync_dll_first_ (wake); p != NULL; p = next) {
-				next = nsync_dll_next_ (wake, p);
+			/* Wake the waiters.  Only the first is woken here; the
+			   rest are chained behind it through wake_next, and
+			   it passes their wakeups on (see
+			   nsync_mu_wake_batch_()).  */
+			p = nsync_dll_first_ (wake);
+			if (p != NULL) {
+				waiter *first = DLL_WAITER (p);
+				waiter *last = first;
+				first->wake_batch = 0;
 				wake = nsync_dll_remove_ (wake, p);
-				ATM_STORE_REL (&DLL_NSYNC_WAITER (p)->waiting, 0);
-				nsync_mu_semaphore_v (&DLL_WAITER (p)->sem);
+				while (!nsync_dll_is_empty_ (wake)) {
+					p = nsync_dll_first_ (wake);
+					wake = nsync_dll_remove_ (wake, p);
+					last->wake_next = DLL_WAITER (p);
+					last = last->wake_next;
+					first->wake_batch++;
+				}
+				last->wake_next = NULL;
+				ATM_STORE_REL (&first->nw.waiting, 0);
+				nsync_mu_semaphore_v (&first->sem);
 			}
 			return;
 		}
@@ -456,6 +809,7 @@ void nsync_mu_unlock (nsync_mu *mu) {
 	   waiter.  Another thread could acquire, decrement a reference count
 	   and deallocate the mutex before the current thread touched the mutex
 	   word again. */
+	MU_BUMP_VERSION (mu);
 	if (!ATM_CAS_REL (&mu->word, MU_WLOCK, 0)) {
 		uint32_t old_word = ATM_LOAD (&mu->word);
                 /* Clear MU_ALL_FALSE because the critical section we're just
@@ -475,7 +829,7 @@ void nsync_mu_unlock (nsync_mu *mu) {
 			   !ATM_CAS_REL (&mu->word, old_word, new_word)) {
 			/* There are waiters and no designated waker, or
 			   our initial CAS attempt failed, to use slow path. */
-			nsync_mu_unlock_slow_ (mu, nsync_writer_type_);
+			nsync_mu_unlock_slow_ (mu, nsync_writer_type_, ~(uint32_t) 0);
 		}
 	}
 	IGNORE_RACES_END ();
@@ -503,15 +857,55 @@ void nsync_mu_runlock (nsync_mu *mu) {
                            reader is unlocking, and not all waiters have a
                            false condition.  So we must take the slow path to
                            attempt to wake a waiter.  */
-			nsync_mu_unlock_slow_ (mu, nsync_reader_type_);
+			nsync_mu_unlock_slow_ (mu, nsync_reader_type_, ~(uint32_t) 0);
 		} else if (!ATM_CAS_REL (&mu->word, old_word, old_word - MU_RLOCK)) {
 			/* CAS attempt failed, so take slow path. */
-			nsync_mu_unlock_slow_ (mu, nsync_reader_type_);
+			nsync_mu_unlock_slow_ (mu, nsync_reader_type_, ~(uint32_t) 0);
 		}
 	}
 	IGNORE_RACES_END ();
 }
 
+/* Convert the write lock on *mu into a read lock, waking readers if appropriate. */
+void nsync_mu_downgrade (nsync_mu *mu) {
+	IGNORE_RACES_START ();
+	/* See comment in nsync_mu_unlock(). */
+	MU_BUMP_VERSION (mu);
+	if (!ATM_CAS_REL (&mu->word, MU_WLOCK, MU_RLOCK)) {
+		uint32_t old_word = ATM_LOAD (&mu->word);
+		if ((old_word & (MU_RLOCK_FIELD | MU_WLOCK)) != MU_WLOCK) {
+			nsync_panic_ ("attempt to nsync_mu_downgrade() an nsync_mu "
+				      "not held in write mode\n");
+		}
+		/* The write critical section may have made conditions true,
+		   and readers may be waiting, so use the slow path. */
+		nsync_mu_unlock_slow_ (mu, nsync_downgrade_type_, ~(uint32_t) 0);
+	}
+	IGNORE_RACES_END ();
+}
+
+/* Attempt to convert the read lock on *mu into a write lock, returning
+   non-zero iff successful. */
+int nsync_mu_try_upgrade (nsync_mu *mu) {
+	int result = 0;
+	uint32_t old_word;
+	IGNORE_RACES_START ();
+	old_word = ATM_LOAD (&mu->word);
+	if ((old_word & MU_RLOCK_FIELD) == 0) {
+		nsync_panic_ ("attempt to nsync_mu_try_upgrade() an nsync_mu "
+			      "not held in read mode\n");
+	}
+	/* Retry only while the caller remains the sole reader; the word may
+	   change as waiters queue. */
+	while (!result && (old_word & MU_RLOCK_FIELD) == MU_RLOCK) {
+		result = ATM_CAS_ACQ (&mu->word, old_word,
+				      old_word - MU_RADD_TO_ACQUIRE + MU_WADD_TO_ACQUIRE);
+		old_word = ATM_LOAD (&mu->word);
+	}
+	IGNORE_RACES_END ();
+	return (result);
+}
+
 /* Abort if *mu is not held in write mode. */
 void nsync_mu_assert_held (const nsync_mu *mu) {
 	IGNORE_RACES_START ();
@@ -543,4 +937,41 @@ int nsync_mu_is_reader (const nsync_mu *mu) {
 	return ((word & MU_WLOCK) == 0);
 }
 
+/* Optimistic readers use the fact that a writer increments mu->version (with
+   MU_BUMP_VERSION) before it clears MU_WLOCK.  A reader that sees MU_WLOCK
+   clear and then reads the version will, when validating, see either
+   MU_WLOCK set or a different version if any writer acquired *mu in the
+   meantime.  */
+uint32_t nsync_mu_read_begin (const nsync_mu *mu) {
+	uint32_t version;
+	unsigned attempts = 0;
+	IGNORE_RACES_START ();
+	while ((ATM_LOAD_ACQ (&mu->word) & MU_WLOCK) != 0) { /* acquire load */
+		if (attempts < 7) { /* spin, as nsync_spin_delay_() does before it yields */
+			attempts = nsync_spin_delay_ (attempts);
+		} else {
+			/* The writer may hold *mu for some time; sleep rather
+			   than spin.  */
+			nsync_mu *m = (nsync_mu *) mu;
+			nsync_mu_rlock (m);
+			nsync_mu_runlock (m);
+		}
+	}
+	version = ATM_LOAD_ACQ (&mu->version); /* acquire load */
+	IGNORE_RACES_END ();
+	return (version);
+}
+
+int nsync_mu_read_validate (const nsync_mu *mu, uint32_t version) {
+	int valid;
+	IGNORE_RACES_START ();
+	/* Prevent the caller's reads of the protected data from being
+	   performed after the loads below.  */
+	ATM_FENCE ();
+	valid = ((ATM_LOAD_ACQ (&mu->word) & MU_WLOCK) == 0 &&
+		 ATM_LOAD (&mu->version) == version);
+	IGNORE_RACES_END ();
+	return (valid);
+}
+
 NSYNC_CPP_END_
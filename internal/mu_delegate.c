@@ -0,0 +1,165 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#include "nsync_cpp.h"
+#include "platform.h"
+#include "compiler.h"
+#include "cputype.h"
+#include "nsync.h"
+#include "dll.h"
+#include "sem.h"
+#include "wait_internal.h"
+#include "common.h"
+#include "atomic.h"
+
+NSYNC_CPP_START_
+
+/* Implementation notes
+
+   nsync_mu_run_locked() publishes a delegation record describing the call on
+   a list, and whichever thread next acquires the mu via
+   nsync_mu_run_locked() runs every call published for that mu, then releases
+   the mu once and wakes the publishers.  Only one thread per batch moves the
+   mu and the data it protects into its cache.
+
+   The lists live in a small table indexed by a hash of the mu's address, so
+   that an nsync_mu needs no extra space; a list may hold records for several
+   mus.  Each list is protected by a spinlock in its bucket's "word", which
+   also records whether the list is non-empty, so that a thread that acquires
+   a mu while nothing is published need not take the spinlock.
+
+   A publisher that finds no other record for its mu on the list is the
+   "combiner" for that mu: it acquires the mu with nsync_mu_lock(), and so
+   competes fairly with ordinary lockers.  Other publishers sleep on the
+   semaphore of a waiter struct until their call has been run.  A thread
+   holding the mu removes all the records for the mu from the list in one
+   step while holding the spinlock, so any record on the list was published
+   while a combiner's record for the same mu was also on the list, and that
+   combiner has yet to acquire the mu, or has acquired it and will then run
+   the call.  The combiner's own record may be run by another thread; once it
+   holds the mu it runs whatever has been published since, and then waits for
+   its record to be released, as other publishers do, because the thread that
+   ran the record may still be reading it.  */
+
+/* A delegation represents one call published by nsync_mu_run_locked(). */
+typedef struct delegation_s {
+	nsync_mu *mu;              /* the mu to hold while calling (*fn) (arg) */
+	void (*fn) (void *arg);    /* the call */
+	void *arg;
+	waiter *w;                 /* publisher sleeps on w->sem while w->nw.waiting */
+	nsync_dll_element_ e;      /* element of a delegation_bucket list */
+} delegation;
+
+/* A delegation_bucket holds the published delegations for mus whose
+   addresses hash to it. */
+#define DELEGATION_BUCKETS 32
+#define DELEGATION_SPINLOCK ((uint32_t) 1)  /* bucket's spinlock is held */
+#define DELEGATION_PUBLISHED ((uint32_t) 2) /* bucket's list is non-empty */
+typedef struct delegation_bucket_s {
+	nsync_atomic_uint32_ word; /* DELEGATION_* bits; spinlock protects list */
+	nsync_dll_list_ list;      /* of delegation.e */
+	char pad[64 - sizeof (nsync_atomic_uint32_) - sizeof (nsync_dll_list_)];
+} delegation_bucket;
+
+static delegation_bucket delegation_buckets[DELEGATION_BUCKETS];
+
+/* Return the bucket for delegations on *mu. */
+static delegation_bucket *delegation_bucket_for (nsync_mu *mu) {
+	uintptr_t h = ((uintptr_t) mu) >> 3;
+	h ^= (h >> 7) ^ (h >> 14);
+	return (&delegation_buckets[h % DELEGATION_BUCKETS]);
+}
+
+/* Acquire and release the spinlock of *b. */
+static void delegation_bucket_lock (delegation_bucket *b) {
+	nsync_spin_test_and_set_ (&b->word, DELEGATION_SPINLOCK, DELEGATION_SPINLOCK, 0);
+}
+static void delegation_bucket_unlock (delegation_bucket *b) {
+	ATM_STORE_REL (&b->word, nsync_dll_is_empty_ (b->list)? 0 : DELEGATION_PUBLISHED);
+}
+
+/* Called with *mu held in write mode.  Run every call published for *mu in
+   *b, release *mu, and then release the records of those calls, waking
+   their publishers other than *self.  */
+static void delegation_run_and_unlock (nsync_mu *mu, delegation_bucket *b,
+				       const delegation *self) {
+	nsync_dll_list_ batch = NULL;
+	nsync_dll_element_ *p;
+	nsync_dll_element_ *next;
+	if (ATM_LOAD_ACQ (&b->word) != 0) {
+		delegation_bucket_lock (b);
+		for (p = nsync_dll_first_ (b->list); p != NULL; p = next) {
+			next = nsync_dll_next_ (b->list, p);
+			if (((delegation *) p->container)->mu == mu) {
+				b->list = nsync_dll_remove_ (b->list, p);
+				batch = nsync_dll_make_last_in_list_ (batch, p);
+			}
+		}
+		delegation_bucket_unlock (b);
+	}
+	for (p = nsync_dll_first_ (batch); p != NULL; p = nsync_dll_next_ (batch, p)) {
+		delegation *d = (delegation *) p->container;
+		(*d->fn) (d->arg);
+	}
+	nsync_mu_unlock (mu);
+	for (p = nsync_dll_first_ (batch); p != NULL; p = next) {
+		delegation *d = (delegation *) p->container;
+		waiter *w = d->w;
+		/* *d may vanish once w->nw.waiting is zero; *w stays valid. */
+		next = nsync_dll_next_ (batch, p);
+		ATM_STORE_REL (&w->nw.waiting, 0);
+		if (d != self) {
+			nsync_mu_semaphore_v (&w->sem);
+		}
+	}
+}
+
+void nsync_mu_run_locked (nsync_mu *mu, void (*fn) (void *arg), void *arg) {
+	delegation_bucket *b = delegation_bucket_for (mu);
+	IGNORE_RACES_START ();
+	if (ATM_LOAD (&b->word) == 0 && nsync_mu_trylock (mu)) {
+		/* Nothing is published, so run the call directly, but still
+		   pick up anything published meanwhile.  */
+		(*fn) (arg);
+		delegation_run_and_unlock (mu, b, NULL);
+	} else {
+		delegation d;
+		nsync_dll_element_ *p;
+		int combiner = 1;
+		d.mu = mu;
+		d.fn = fn;
+		d.arg = arg;
+		d.w = nsync_waiter_new_ ();
+		nsync_dll_init_ (&d.e, &d);
+		ATM_STORE (&d.w->nw.waiting, 1);
+		delegation_bucket_lock (b);
+		for (p = nsync_dll_first_ (b->list); p != NULL && combiner;
+		     p = nsync_dll_next_ (b->list, p)) {
+			combiner = (((delegation *) p->container)->mu != mu);
+		}
+		b->list = nsync_dll_make_last_in_list_ (b->list, &d.e);
+		delegation_bucket_unlock (b);
+		if (combiner) {
+			nsync_mu_lock (mu);
+			delegation_run_and_unlock (mu, b, &d);
+		}
+		while (ATM_LOAD_ACQ (&d.w->nw.waiting) != 0) { /* acquire load */
+			nsync_mu_semaphore_p (&d.w->sem);
+		}
+		nsync_waiter_free_ (d.w);
+	}
+	IGNORE_RACES_END ();
+}
+
+NSYNC_CPP_END_
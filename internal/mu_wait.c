@@ -142,6 +142,20 @@ int nsync_mu_wait_with_deadline (nsync_mu *mu,
 				 const void *condition_arg,
 				 int (*condition_arg_eq) (const void *a, const void *b),
 				 nsync_time abs_deadline, nsync_note cancel_note) {
+	return (nsync_mu_wait_with_deadline_and_mask (mu, condition, condition_arg,
+						      condition_arg_eq, ~(uint32_t) 0,
+						      abs_deadline, cancel_note));
+}
+
+/* As nsync_mu_wait_with_deadline(), but the condition is evaluated by
+   unlockers only when the state they declare changed intersects mask.  See
+   nsync_mu_unlock_with_mask(). */
+int nsync_mu_wait_with_deadline_and_mask (nsync_mu *mu,
+					  int (*condition) (const void *condition_arg),
+					  const void *condition_arg,
+					  int (*condition_arg_eq) (const void *a, const void *b),
+					  uint32_t mask,
+					  nsync_time abs_deadline, nsync_note cancel_note) {
 	lock_type *l_type;
 	int first_wait;
 	int condition_is_true;
@@ -185,6 +199,7 @@ int nsync_mu_wait_with_deadline (nsync_mu *mu,
 		w->cond.f = condition;
 		w->cond.v = condition_arg;
 		w->cond.eq = condition_arg_eq;
+		w->cond_mask = mask;
 		has_condition = 0; /* set to MU_CONDITION if condition is non-NULL */
 		if (condition != NULL) {
 			has_condition = MU_CONDITION;
@@ -212,6 +227,9 @@ int nsync_mu_wait_with_deadline (nsync_mu *mu,
 							             &w->nw.q);
 		}
 		/* Release spinlock and *mu. */
+		if (l_type == nsync_writer_type_) {
+			MU_BUMP_VERSION (mu);
+		}
 		do {
 			old_word = ATM_LOAD (&mu->word);
 			add_to_acquire = l_type->add_to_acquire;
@@ -223,7 +241,7 @@ int nsync_mu_wait_with_deadline (nsync_mu *mu,
 		if (add_to_acquire == 0) {
 			/* The lock will be fully released, there are waiters, and
 			   no designated waker, so wake waiters. */
-			nsync_mu_unlock_slow_ (mu, l_type);
+			nsync_mu_unlock_slow_ (mu, l_type, ~(uint32_t) 0);
 		}
 
 		/* wait until awoken or a timeout. */
@@ -249,6 +267,7 @@ int nsync_mu_wait_with_deadline (nsync_mu *mu,
 				attempts = nsync_spin_delay_ (attempts); /* will ultimately yield */
 			}
 		}
+		nsync_mu_wake_batch_ (w);
 
 		if (!have_lock) {
 			/* If we didn't reacquire due to a cancellation/timeout, acquire now. */
@@ -295,11 +314,35 @@ void nsync_mu_wait (nsync_mu *mu, int (*condition) (const void *condition_arg),
      nsync_mu_wait/nsync_mu_wait_with_deadline waits, and
    - when performance is significantly improved by doing so.  */
 void nsync_mu_unlock_without_wakeup (nsync_mu *mu) {
+	nsync_mu_unlock_with_mask (mu, 0);
+}
+
+/* Unlock *mu, which must be held in write mode, and wake waiters, if
+   appropriate, evaluating only the conditions of waiters whose masks
+   intersect "changed".
+
+   MU_ALL_FALSE records that every waiter's condition was found false, and that
+   no critical section that might have made one true has ended since.  If it
+   is set, a waiter whose mask does not intersect "changed" still has a false
+   condition, and need not be evaluated.  If it is clear, some conditions may
+   be true for reasons unknown to this thread, so all are evaluated.  A
+   complete walk of the queue that finds all conditions false sets
+   MU_ALL_FALSE again.  */
+void nsync_mu_unlock_with_mask (nsync_mu *mu, uint32_t changed) {
 	IGNORE_RACES_START ();
 	/* See comment in nsync_mu_unlock(). */
+	MU_BUMP_VERSION (mu);
 	if (!ATM_CAS_REL (&mu->word, MU_WLOCK, 0)) {
 		uint32_t old_word = ATM_LOAD (&mu->word);
 		uint32_t new_word = old_word - MU_WLOCK;
+		uint32_t eval_mask = ~(uint32_t) 0;
+		if (changed != 0) {
+			/* Conditions that depend on "changed" may now be true. */
+			new_word &= ~MU_ALL_FALSE;
+		}
+		if ((old_word & MU_ALL_FALSE) != 0) {
+			eval_mask = changed;
+		}
 		if ((new_word & (MU_RLOCK_FIELD | MU_WLOCK)) != 0) {
 			if ((old_word & MU_RLOCK_FIELD) != 0) {
 				nsync_panic_ ("attempt to nsync_mu_unlock() an nsync_mu "
@@ -308,9 +351,9 @@ void nsync_mu_unlock_without_wakeup (nsync_mu *mu) {
 				nsync_panic_ ("attempt to nsync_mu_unlock() an nsync_mu "
 					      "not held in write mode\n");
 			}
-		} else if ((old_word & (MU_WAITING | MU_DESIG_WAKER | MU_ALL_FALSE)) ==
+		} else if ((new_word & (MU_WAITING | MU_DESIG_WAKER | MU_ALL_FALSE)) ==
 			   MU_WAITING || !ATM_CAS_REL (&mu->word, old_word, new_word)) {
-			nsync_mu_unlock_slow_ (mu, nsync_writer_type_);
+			nsync_mu_unlock_slow_ (mu, nsync_writer_type_, eval_mask);
 		}
 	}
 	IGNORE_RACES_END ();
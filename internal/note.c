@@ -46,10 +46,24 @@ NSYNC_CPP_START_
    release n->note_mu, and acquire n->parent->note_mu and n->note_mu is the
    correct order.  n->disconnecting!=0 indicates that a thread is already in
    the processes of disconnecting n from n->parent.  A thread freeing or
-   notifying the parent should not perform the disconnection of that child, but
-   should instead wait for the "children" list to become empty via
-   WAIT_FOR_NO_CHILDREN().  WAKEUP_NO_CHILDREN() should be used whenever this
-   condition could become true.  */
+   notifying the parent should not perform the disconnection of that child;
+   that thread will remove the child from the parent's list itself.  Free
+   waits for the "children" list to become empty via WAIT_FOR_PRED().
+
+   Notification does not recurse.  A notifier that holds a node's lock
+   detaches each of its children that is not disconnecting, all at once: it
+   notifies the child, sets its parent to NULL, and, if the child has children
+   of its own, increments the child's disconnecting count to "claim" it, and
+   moves it onto the notifier's own worklist, linked by its now unused
+   parent_child_link.  The notifier then releases the node, and later locks
+   each claimed child in turn to detach its children the same way.  So at most
+   a parent and one child are locked at once, and no notifier waits for
+   another thread.  A descendant that was being disconnected when its parent
+   was notified is notified by the thread disconnecting it (see
+   nsync_note_free()), so may become notified shortly after
+   nsync_note_notify() returns.  Free waits until no notifier has claimed the
+   node via WAIT_FOR_PRED() before freeing it.  WAKEUP_PRED() should be used
+   whenever a condition waited for could become true.  */
 
 /* Set the expiry time in *n to t */
 static void set_expiry_time (nsync_note n, nsync_time t) {
@@ -65,50 +79,121 @@ static int no_children (const void *v) {
 	return (nsync_dll_is_empty_ (((nsync_note)v)->children));
 }
 
-#define WAIT_FOR_NO_CHILDREN(pred_, n_) nsync_mu_wait (&(n_)->note_mu, &pred_, (n_), NULL)
-#define WAKEUP_NO_CHILDREN(n_) do { } while (0)
+/* Return whether the only thread disconnecting n is the caller, so that
+   no notifier has claimed n.  Assumes n->note_mu held. */
+static int no_claims (const void *v) {
+	return (((nsync_note)v)->disconnecting == 1);
+}
+
+#define WAIT_FOR_PRED(pred_, n_) nsync_mu_wait (&(n_)->note_mu, &pred_, (n_), NULL)
+#define WAKEUP_PRED(n_) do { } while (0)
 
 /*
 // These lines can be used in place of those above if conditional critical
 // sections have been removed from the source.
-#define WAIT_FOR_NO_CHILDREN(pred_, n_) do { \
+#define WAIT_FOR_PRED(pred_, n_) do { \
 		while (!pred_ (n_)) { nsync_cv_wait (&(n_)->no_children_cv, &(n_)->note_mu); } \
 	} while (0)
-#define WAKEUP_NO_CHILDREN(n_) nsync_cv_broadcast (&(n_)->no_children_cv)
+#define WAKEUP_PRED(n_) nsync_cv_broadcast (&(n_)->no_children_cv)
 */
 
-/* Notify *n and all its descendants that are not already disconnnecting.
-   n->note_mu is held.  May release and reacquire n->note_mu.
-   parent->note_mu is held if parent != NULL. */
-static void note_notify_child (nsync_note n, nsync_note parent) {
-	nsync_time t;
-	t = NOTIFIED_TIME (n);
-	if (nsync_time_cmp (t, nsync_time_zero) > 0) {
-		nsync_dll_element_ *p;
-		nsync_dll_element_ *next;
-		ATM_STORE_REL (&n->notified, 1);
-		while ((p = nsync_dll_first_ (n->waiters)) != NULL) {
-			struct nsync_waiter_s *nw = DLL_NSYNC_WAITER (p);
-			n->waiters = nsync_dll_remove_ (n->waiters, p);
-			ATM_STORE_REL (&nw->waiting, 0);
-			nsync_mu_semaphore_v (nw->sem);
-		}
-		for (p = nsync_dll_first_ (n->children); p != NULL; p = next) {
-			nsync_note child = DLL_NOTE (p);
-			next = nsync_dll_next_ (n->children, p);
-			nsync_mu_lock (&child->note_mu);
-			if (child->disconnecting == 0) {
-				note_notify_child (child, n);
+/* Return whether *n has a finite expiry time.  Such a note is added to the
+   timer heap (see note_timer.c) only if its expiry time is earlier than its
+   parent's, so that notifying a tree of notes that share their root's
+   expiry touches the heap only for the root.  n->timer_added records
+   whether it was added, and is protected by n->note_mu. */
+#define NOTE_IS_TIMED(n_) (nsync_time_cmp ((n_)->expiry_time, nsync_time_no_deadline) < 0)
+
+/* Add *n to the timer heap if it has an expiry time that it no longer
+   inherits from its parent, as when that parent has been freed.
+   n->note_mu is held, as is n->parent->note_mu if n->parent!=NULL. */
+static void note_timer_add_if_needed (nsync_note n) {
+	if (!n->timer_added && NOTE_IS_TIMED (n) && ATM_LOAD (&n->notified) == 0 &&
+	    (n->parent == NULL ||
+	     nsync_time_cmp (n->expiry_time, n->parent->expiry_time) < 0)) {
+		n->timer_added = 1;
+		nsync_note_timer_add_ (n);
+	}
+}
+
+/* Mark *n notified, wake its waiters, and remove it from the timer heap.
+   n->note_mu is held. */
+static void note_set_notified (nsync_note n) {
+	nsync_dll_element_ *p;
+	/* notified is zero, as the caller checked NOTIFIED_TIME(n).  The
+	   fence orders the write of notified before the read of futex_waited,
+	   pairing with the fence in nsync_note_futex_word_(): either a futex
+	   waiter sees notified set, or this thread sees futex_waited set. */
+	(void) ATM_CAS_RELACQ (&n->notified, 0, 1);
+	ATM_FENCE ();
+	if (ATM_LOAD (&n->futex_waited) != 0) {
+		nsync_wait_futex_wake_ (&n->notified);
+	}
+	while ((p = nsync_dll_first_ (n->waiters)) != NULL) {
+		struct nsync_waiter_s *nw = DLL_NSYNC_WAITER (p);
+		n->waiters = nsync_dll_remove_ (n->waiters, p);
+		nsync_waiter_wake_ (nw);
+	}
+	if (n->timer_added) {
+		nsync_note_timer_remove_ (n);
+	}
+}
+
+/* Detach from *n each child that is not already disconnecting.  If
+   adopter!=NULL, adopt such children into *adopter.  Otherwise, if
+   worklist!=NULL, notify them, and claim and append to *worklist those
+   that have children of their own, or else just leave them without a
+   parent.  Children that are not notified are added to the timer heap if
+   they inherited their expiry time from *n.  n->note_mu is held, as is
+   adopter->note_mu if adopter!=NULL.  */
+static void note_detach_children (nsync_note n, nsync_note adopter,
+				  nsync_dll_list_ *worklist) {
+	nsync_dll_element_ *p;
+	nsync_dll_element_ *next;
+	for (p = nsync_dll_first_ (n->children); p != NULL; p = next) {
+		nsync_note child = DLL_NOTE (p);
+		next = nsync_dll_next_ (n->children, p);
+		nsync_mu_lock (&child->note_mu);
+		if (child->disconnecting == 0) {
+			n->children = nsync_dll_remove_ (n->children, p);
+			if (adopter != NULL) {
+				child->parent = adopter;
+				adopter->children = nsync_dll_make_last_in_list_ (
+					adopter->children, p);
+				note_timer_add_if_needed (child);
+			} else {
+				child->parent = NULL;
+				if (worklist == NULL) {
+					note_timer_add_if_needed (child);
+				} else {
+					if (nsync_time_cmp (NOTIFIED_TIME (child), nsync_time_zero) > 0) {
+						note_set_notified (child);
+					}
+					if (!nsync_dll_is_empty_ (child->children)) {
+						child->disconnecting++;
+						*worklist = nsync_dll_make_last_in_list_ (*worklist, p);
+					}
+				}
 			}
-			nsync_mu_unlock (&child->note_mu);
-		}
-		WAIT_FOR_NO_CHILDREN (no_children, n);
-		if (parent != NULL) {
-			parent->children = nsync_dll_remove_ (parent->children,
-						              &n->parent_child_link);
-			WAKEUP_NO_CHILDREN (parent);
-			n->parent = NULL;
 		}
+		nsync_mu_unlock (&child->note_mu);
+	}
+	WAKEUP_PRED (n);
+}
+
+/* Detach and notify the descendants of each note on worklist, each of
+   which the caller has notified and claimed, except those that are
+   already disconnecting.  No locks are held. */
+static void note_notify_claimed (nsync_dll_list_ worklist) {
+	nsync_dll_element_ *p;
+	while ((p = nsync_dll_first_ (worklist)) != NULL) {
+		nsync_note n = DLL_NOTE (p);
+		worklist = nsync_dll_remove_ (worklist, p);
+		nsync_mu_lock (&n->note_mu);
+		note_detach_children (n, NULL, &worklist);
+		n->disconnecting--;
+		WAKEUP_PRED (n);
+		nsync_mu_unlock (&n->note_mu);
 	}
 }
 
@@ -116,6 +201,7 @@ static void note_notify_child (nsync_note n, nsync_note parent) {
    No locks are held. */
 static void notify (nsync_note n) {
 	nsync_time t;
+	nsync_dll_list_ worklist = NULL;
 	nsync_mu_lock (&n->note_mu);
 	t = NOTIFIED_TIME (n);
 	if (nsync_time_cmp (t, nsync_time_zero) > 0) {
@@ -127,18 +213,33 @@ static void notify (nsync_note n) {
 			nsync_mu_lock (&parent->note_mu);
 			nsync_mu_lock (&n->note_mu);
 		}
-		note_notify_child (n, parent);
+		if (nsync_time_cmp (NOTIFIED_TIME (n), nsync_time_zero) > 0) {
+			note_set_notified (n);
+		}
 		if (parent != NULL) {
+			/* Another thread notifying *n may also hold a pointer
+			   to the parent, so only the last one disconnects *n,
+			   after which the parent may be freed. */
+			if (n->disconnecting == 1) {
+				parent->children = nsync_dll_remove_ (parent->children,
+								      &n->parent_child_link);
+				WAKEUP_PRED (parent);
+				n->parent = NULL;
+			}
 			nsync_mu_unlock (&parent->note_mu);
 		}
+		note_detach_children (n, NULL, &worklist);
 		n->disconnecting--;
+		WAKEUP_PRED (n);
 	}
 	nsync_mu_unlock (&n->note_mu);
+	note_notify_claimed (worklist);
 }
 
 /* Return the deadline by which *n is certain to be notified,
    setting it to zero if it already has passed that time.
-   Requires n->note_mu not held on entry.
+   Requires n->note_mu not held on entry.  Takes no lock unless *n must
+   be notified, as n->expiry_time is read-only after initialization.
 
    Not static; used in sem_wait.c */
 nsync_time nsync_note_notified_deadline_ (nsync_note n) {
@@ -146,9 +247,7 @@ nsync_time nsync_note_notified_deadline_ (nsync_note n) {
 	if (ATM_LOAD_ACQ (&n->notified) != 0) {
 		ntime = nsync_time_zero;
 	} else {
-		nsync_mu_lock (&n->note_mu);
 		ntime = NOTIFIED_TIME (n);
-		nsync_mu_unlock (&n->note_mu);
 		if (nsync_time_cmp (ntime, nsync_time_zero) > 0) {
 			if (nsync_time_cmp (ntime, nsync_time_now ()) <= 0) {
 				notify (n);
@@ -167,26 +266,43 @@ int nsync_note_is_notified (nsync_note n) {
 	return (result);
 }
 
+nsync_slab_ nsync_note_slab_ = NSYNC_SLAB_INIT_ (sizeof (struct nsync_note_s_),
+						  NSYNC_SLAB_CACHE_NOTE_);
+
 nsync_note nsync_note_new (nsync_note parent,
 			   nsync_time abs_deadline) {
-	nsync_note n = (nsync_note) malloc (sizeof (*n));
+	nsync_note n = (nsync_note) nsync_slab_alloc_ (&nsync_note_slab_);
 	if (n != NULL) {
 		memset (n, 0, sizeof (*n));
 		nsync_dll_init_ (&n->parent_child_link, n);
 		set_expiry_time (n, abs_deadline);
-		if (!nsync_note_is_notified (n) && parent != NULL) {
-			nsync_time parent_time;
-			nsync_mu_lock (&parent->note_mu);
-			parent_time = NOTIFIED_TIME (parent);
-			if (nsync_time_cmp (parent_time, abs_deadline) < 0) {
-				set_expiry_time (n, parent_time);
+		if (!nsync_note_is_notified (n)) {
+			/* n is set up before it is linked to its parent, as a
+			   notifier of the parent may then read it. */
+			int timed = NOTE_IS_TIMED (n);
+			if (parent != NULL) {
+				nsync_time parent_time;
+				nsync_mu_lock (&parent->note_mu);
+				parent_time = NOTIFIED_TIME (parent);
+				if (nsync_time_cmp (parent_time, abs_deadline) <= 0) {
+					/* The parent's notification will reach n
+					   no later than n's own deadline. */
+					set_expiry_time (n, parent_time);
+					timed = 0;
+				}
+				n->timer_added = timed;
+				if (nsync_time_cmp (parent_time, nsync_time_zero) > 0) {
+					n->parent = parent;
+					parent->children = nsync_dll_make_last_in_list_ (parent->children,
+						&n->parent_child_link);
+				}
+				nsync_mu_unlock (&parent->note_mu);
+			} else {
+				n->timer_added = timed;
 			}
-			if (nsync_time_cmp (parent_time, nsync_time_zero) > 0) {
-				n->parent = parent;
-				parent->children = nsync_dll_make_last_in_list_ (parent->children,
-					&n->parent_child_link);
+			if (timed) {
+				nsync_note_timer_add_ (n);
 			}
-			nsync_mu_unlock (&parent->note_mu);
 		}
 	}
 	return (n);
@@ -194,45 +310,48 @@ nsync_note nsync_note_new (nsync_note parent,
 
 void nsync_note_free (nsync_note n) {
 	nsync_note parent;
-	nsync_dll_element_ *p;
-	nsync_dll_element_ *next;
+	nsync_dll_list_ worklist = NULL;
 	nsync_mu_lock (&n->note_mu);
 	n->disconnecting++;
+	if (n->timer_added) {
+		/* Now that n is disconnecting, no note_detach_children() will
+		   add it to the timer heap.  The timer thread may be notifying
+		   n, which needs n->note_mu. */
+		nsync_mu_unlock (&n->note_mu);
+		nsync_note_timer_free_ (n);
+		nsync_mu_lock (&n->note_mu);
+	}
 	ASSERT (nsync_dll_is_empty_ (n->waiters));
+	/* A notifier that has claimed *n may still use it. */
+	WAIT_FOR_PRED (no_claims, n);
 	parent = n->parent;
 	if (parent != NULL && !nsync_mu_trylock (&parent->note_mu)) {
 		nsync_mu_unlock (&n->note_mu);
 		nsync_mu_lock (&parent->note_mu);
 		nsync_mu_lock (&n->note_mu);
 	}
-	for (p = nsync_dll_first_ (n->children); p != NULL; p = next) {
-		nsync_note child = DLL_NOTE (p);
-		next = nsync_dll_next_ (n->children, p);
-		nsync_mu_lock (&child->note_mu);
-		if (child->disconnecting == 0) {
-			n->children = nsync_dll_remove_ (n->children,
-							 &child->parent_child_link);
-			if (parent != NULL) {
-				child->parent = parent;
-				parent->children = nsync_dll_make_last_in_list_ (
-					parent->children, &child->parent_child_link);
-			} else {
-				child->parent = NULL;
-			}
-		}
-		nsync_mu_unlock (&child->note_mu);
+	/* If the parent has been notified, it skipped *n because *n was
+	   disconnecting, so n's children must be notified here, rather than
+	   adopted by a parent that will not notify them. */
+	if (parent == NULL) {
+		note_detach_children (n, NULL, NULL);
+	} else if (ATM_LOAD_ACQ (&parent->notified) == 0) {
+		note_detach_children (n, parent, NULL);
+	} else {
+		note_detach_children (n, NULL, &worklist);
 	}
-	WAIT_FOR_NO_CHILDREN (no_children, n);
+	WAIT_FOR_PRED (no_children, n);
 	if (parent != NULL) {
 		parent->children = nsync_dll_remove_ (parent->children,
 						      &n->parent_child_link);
-		WAKEUP_NO_CHILDREN (parent);
+		WAKEUP_PRED (parent);
 		n->parent = NULL;
 		nsync_mu_unlock (&parent->note_mu);
 	}
 	n->disconnecting--;
 	nsync_mu_unlock (&n->note_mu);
-	free (n);
+	nsync_slab_free_ (&nsync_note_slab_, n);
+	note_notify_claimed (worklist);
 }
 
 void nsync_note_notify (nsync_note n) {
@@ -293,6 +412,21 @@ static int note_dequeue (void *v, struct nsync_waiter_s *nw) {
 	return (was_queued);
 }
 
+nsync_atomic_uint32_ *nsync_note_futex_word_ (void *v, uint32_t *value, nsync_time *deadline) {
+	nsync_note n = (nsync_note) v;
+	nsync_atomic_uint32_ *word = NULL;
+	/* The fence orders this store before the read of notified; see
+	   note_set_notified(). */
+	ATM_STORE (&n->futex_waited, 1);
+	ATM_FENCE ();
+	if (ATM_LOAD_ACQ (&n->notified) == 0) {
+		word = &n->notified;
+		*value = 0;
+		*deadline = (n->expiry_time_valid? n->expiry_time : nsync_time_no_deadline);
+	}
+	return (word);
+}
+
 const struct nsync_waitable_funcs_s nsync_note_waitable_funcs = {
 	&note_ready_time,
 	&note_enqueue,
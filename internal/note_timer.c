@@ -0,0 +1,234 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#include "nsync_cpp.h"
+#include "platform.h"
+#include "compiler.h"
+#include "cputype.h"
+#include "nsync.h"
+#include "dll.h"
+#include "sem.h"
+#include "wait_internal.h"
+#include "common.h"
+#include "atomic.h"
+
+NSYNC_CPP_START_
+
+/* Implementation notes
+
+   Every note with a finite expiry time earlier than its parent's that is
+   not notified when created is kept in a 4-ary min-heap ordered by expiry
+   time, so that insertion and removal take O(log n) time with millions of
+   pending notes.  A note whose expiry time is inherited is notified with
+   its ancestor, and is added only if it loses that ancestor; see note.c.
+   Each note records its position in n->timer_index.  One timer thread per
+   process sleeps on timer.cv until the earliest expiry time, then removes
+   the note from the heap, and notifies it, and thus its descendants, with
+   timer.mu released.
+
+   While the timer thread notifies a note, it is timer.firing, and
+   nsync_note_timer_free_() waits for it to finish before the note may be
+   freed.  A note is removed from the heap when it is notified, with its
+   note_mu held, so the lock order is note_mu before timer.mu.
+
+   Where no thread can be started, notes are not added to the heap; their
+   expiry is then noticed only when they are examined, as by a waiter whose
+   deadline is bounded by the expiry time.  The thread is started with
+   pthread_create(), so the heap exists only where <pthread.h> has been
+   included; the win32 and C++11 platforms emulate PTHREAD_ONCE_INIT, but
+   not pthread_create().  */
+
+#if defined(PTHREAD_CREATE_DETACHED)
+
+/* The number of children of each entry in timer.heap.  A wider heap is
+   shallower, so reordering it after a removal touches fewer cache lines. */
+#define TIMER_HEAP_ARITY 4
+
+/* The initial number of slots in timer.heap. */
+#define TIMER_HEAP_INITIAL 64
+
+/* An entry in timer.heap.  The expiry time is copied from the note so that
+   reordering the heap need not touch the notes it passes over. */
+struct timer_entry {
+	nsync_time expiry;  /* n->expiry_time */
+	nsync_note n;
+};
+
+static struct {
+	nsync_mu mu;                   /* protects the fields below, and each note's timer_index */
+	nsync_cv cv;                   /* signalled when heap[0] changes */
+	nsync_atomic_uint32_ running;  /* whether the timer thread was started */
+	struct timer_entry *heap;      /* heap[0..count-1], ordered by expiry */
+	uint32_t count;                /* number of notes in heap */
+	uint32_t capacity;             /* number of slots in heap */
+	nsync_note firing;             /* note being notified by the timer thread, or NULL */
+} timer;
+
+static nsync_once timer_once = NSYNC_ONCE_INIT;
+
+/* Place *e at index i of the heap.  timer.mu is held. */
+static void timer_heap_set (uint32_t i, const struct timer_entry *e) {
+	timer.heap[i] = *e;
+	e->n->timer_index = i + 1;
+}
+
+/* Move the entry at index i of the heap towards the root until its
+   parent's expiry is no later than its own, and return its new index.
+   timer.mu is held. */
+static uint32_t timer_heap_up (uint32_t i) {
+	struct timer_entry e = timer.heap[i];
+	while (i != 0 && nsync_time_cmp (timer.heap[(i-1)/TIMER_HEAP_ARITY].expiry, e.expiry) > 0) {
+		timer_heap_set (i, &timer.heap[(i-1)/TIMER_HEAP_ARITY]);
+		i = (i-1)/TIMER_HEAP_ARITY;
+	}
+	timer_heap_set (i, &e);
+	return (i);
+}
+
+/* Move the entry at index i of the heap towards the leaves until no
+   child's expiry is earlier than its own.  timer.mu is held. */
+static void timer_heap_down (uint32_t i) {
+	struct timer_entry e = timer.heap[i];
+	uint32_t first;
+	while ((first = TIMER_HEAP_ARITY*i + 1) < timer.count) {
+		uint32_t child = first;
+		uint32_t j;
+		for (j = first + 1; j < timer.count && j != first + TIMER_HEAP_ARITY; j++) {
+			if (nsync_time_cmp (timer.heap[j].expiry, timer.heap[child].expiry) < 0) {
+				child = j;
+			}
+		}
+		if (nsync_time_cmp (e.expiry, timer.heap[child].expiry) <= 0) {
+			break;
+		}
+		timer_heap_set (i, &timer.heap[child]);
+		i = child;
+	}
+	timer_heap_set (i, &e);
+}
+
+/* Remove n from the heap, if it is there.  timer.mu is held. */
+static void timer_heap_remove (nsync_note n) {
+	if (n->timer_index != 0) {
+		uint32_t i = n->timer_index - 1;
+		n->timer_index = 0;
+		timer.count--;
+		if (i != timer.count) {
+			timer_heap_set (i, &timer.heap[timer.count]);
+			timer_heap_down (timer_heap_up (i));
+		}
+		if (i == 0) {
+			nsync_cv_signal (&timer.cv);
+		}
+	}
+}
+
+/* The body of the timer thread. */
+static void *timer_thread (void *arg UNUSED) {
+	nsync_mu_lock (&timer.mu);
+	for (;;) {
+		if (timer.count == 0) {
+			nsync_cv_wait (&timer.cv, &timer.mu);
+		} else if (nsync_time_cmp (timer.heap[0].expiry, nsync_time_now ()) > 0) {
+			nsync_cv_wait_with_deadline (&timer.cv, &timer.mu,
+						     timer.heap[0].expiry, NULL);
+		} else {
+			nsync_note n = timer.heap[0].n;
+			timer_heap_remove (n);
+			timer.firing = n;
+			nsync_mu_unlock (&timer.mu);
+			nsync_note_notify (n);
+			nsync_mu_lock (&timer.mu);
+			timer.firing = NULL;
+		}
+	}
+	nsync_mu_unlock (&timer.mu);
+	return (NULL);
+}
+
+/* Start the timer thread. */
+static void timer_init (void) {
+	pthread_t t;
+	nsync_mu_init (&timer.mu);
+	nsync_cv_init (&timer.cv);
+	if (pthread_create (&t, NULL, &timer_thread, NULL) == 0) {
+		pthread_detach (t);
+		ATM_STORE_REL (&timer.running, 1);
+	}
+}
+
+void nsync_note_timer_add_ (nsync_note n) {
+	nsync_run_once (&timer_once, &timer_init);
+	if (ATM_LOAD_ACQ (&timer.running) != 0) {
+		nsync_mu_lock (&timer.mu);
+		if (timer.count == timer.capacity) {
+			uint32_t capacity = (timer.capacity == 0? TIMER_HEAP_INITIAL :
+					     2 * timer.capacity);
+			struct timer_entry *heap = (struct timer_entry *) realloc (
+				timer.heap, capacity * sizeof (timer.heap[0]));
+			if (heap != NULL) {
+				timer.heap = heap;
+				timer.capacity = capacity;
+			}
+		}
+		if (timer.count != timer.capacity) {
+			struct timer_entry e;
+			e.expiry = n->expiry_time;
+			e.n = n;
+			timer_heap_set (timer.count, &e);
+			timer.count++;
+			if (timer_heap_up (timer.count - 1) == 0) {
+				nsync_cv_signal (&timer.cv);
+			}
+		}
+		nsync_mu_unlock (&timer.mu);
+	}
+}
+
+void nsync_note_timer_remove_ (nsync_note n) {
+	if (ATM_LOAD_ACQ (&timer.running) != 0) {
+		nsync_mu_lock (&timer.mu);
+		timer_heap_remove (n);
+		nsync_mu_unlock (&timer.mu);
+	}
+}
+
+/* Return whether the timer thread is not notifying the note *v. */
+static int timer_not_firing (const void *v) {
+	return (timer.firing != (nsync_note) v);
+}
+
+void nsync_note_timer_free_ (nsync_note n) {
+	if (ATM_LOAD_ACQ (&timer.running) != 0) {
+		nsync_mu_lock (&timer.mu);
+		timer_heap_remove (n);
+		nsync_mu_wait (&timer.mu, &timer_not_firing, n, NULL);
+		nsync_mu_unlock (&timer.mu);
+	}
+}
+
+#else
+
+void nsync_note_timer_add_ (nsync_note n UNUSED) {
+}
+
+void nsync_note_timer_remove_ (nsync_note n UNUSED) {
+}
+
+void nsync_note_timer_free_ (nsync_note n UNUSED) {
+}
+
+#endif
+
+NSYNC_CPP_END_
@@ -0,0 +1,208 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#include "nsync_cpp.h"
+#include "platform.h"
+#include "compiler.h"
+#include "cputype.h"
+#include "nsync.h"
+#include "nsync_park.h"
+#include "dll.h"
+#include "sem.h"
+#include "wait_internal.h"
+#include "common.h"
+#include "park.h"
+#include "atomic.h"
+
+NSYNC_CPP_START_
+
+/* Implementation notes
+
+   Parked threads are queued on waiter structs in a table of buckets indexed
+   by a hash of the address parked on; a bucket's queue may hold threads
+   parked on several addresses, distinguished by waiter.park_addr.  Each
+   bucket has a cache line to itself, and its queue is protected by a
+   spinlock in the bucket's word.
+
+   As with nsync_cv, a thread that has been removed from a queue is woken by
+   setting nw.waiting to zero and then calling nsync_mu_semaphore_v(), after
+   the bucket's spinlock has been released.  A thread whose wait times out
+   or is cancelled removes itself only if its remove_count shows that it is
+   still queued; otherwise it waits for the thread that removed it.
+
+   The public nsync_park() and nsync_unpark_*() use the same queues as
+   nsync_cmu and nsync_ccv, with token 0; nsync_park.h forbids clients to
+   use the addresses of those objects.  */
+
+#define PARK_BUCKETS 256 /* a power of two */
+
+typedef struct park_bucket_s {
+	nsync_atomic_uint32_ word; /* spinlock; protects waiters */
+	nsync_dll_list_ waiters;   /* of waiter.nw.q, in the order they parked */
+	char pad[64 - sizeof (nsync_atomic_uint32_) - sizeof (nsync_dll_list_)];
+} park_bucket;
+
+static park_bucket park_buckets[PARK_BUCKETS];
+
+/* Return the bucket for threads parked on addr. */
+static park_bucket *park_bucket_for (const void *addr) {
+	uintptr_t h = ((uintptr_t) addr) >> 2;
+	h ^= (h >> 8) ^ (h >> 16);
+	return (&park_buckets[h & (PARK_BUCKETS - 1)]);
+}
+
+/* Acquire and release the spinlock of *b. */
+static void park_bucket_lock (park_bucket *b) {
+	nsync_spin_test_and_set_ (&b->word, 1, 1, 0);
+}
+static void park_bucket_unlock (park_bucket *b) {
+	ATM_STORE_REL (&b->word, 0); /* release store */
+}
+
+/* Called with the spinlock of *b held.  Remove *w from b->waiters, and
+   record the removal in w->remove_count. */
+static void park_remove (park_bucket *b, waiter *w) {
+	uint32_t old_value;
+	b->waiters = nsync_dll_remove_ (b->waiters, &w->nw.q);
+	w->park_addr = NULL;
+	do {
+		old_value = ATM_LOAD (&w->remove_count);
+	} while (!ATM_CAS (&w->remove_count, old_value, old_value+1));
+}
+
+int nsync_park_ (const void *addr, int (*validate) (const void *addr, void *validate_arg),
+		 void *validate_arg, uint32_t token, nsync_time abs_deadline,
+		 nsync_note cancel_note) {
+	park_bucket *b = park_bucket_for (addr);
+	int outcome = 0;
+	waiter *w;
+	IGNORE_RACES_START ();
+	w = nsync_waiter_new_ ();
+	park_bucket_lock (b);
+	if (validate != NULL && !(*validate) (addr, validate_arg)) {
+		park_bucket_unlock (b);
+		outcome = EAGAIN;
+	} else {
+		uint32_t remove_count;
+		int sem_outcome = 0;
+		unsigned attempts = 0;
+		w->park_addr = addr;
+		w->park_token = token;
+		ATM_STORE (&w->nw.waiting, 1);
+		b->waiters = nsync_dll_make_last_in_list_ (b->waiters, &w->nw.q);
+		remove_count = ATM_LOAD (&w->remove_count);
+		park_bucket_unlock (b);
+
+		while (ATM_LOAD_ACQ (&w->nw.waiting) != 0) { /* acquire load */
+			if (sem_outcome == 0) {
+				sem_outcome = nsync_sem_wait_with_cancel_ (w, abs_deadline, cancel_note);
+			}
+			if (sem_outcome != 0 && ATM_LOAD (&w->nw.waiting) != 0) {
+				/* A timeout or cancellation occurred; remove *w
+				   unless a waker has already removed it.  */
+				park_bucket_lock (b);
+				if (ATM_LOAD (&w->nw.waiting) != 0 &&
+				    remove_count == ATM_LOAD (&w->remove_count)) {
+					outcome = sem_outcome;
+					park_remove (b, w);
+					ATM_STORE_REL (&w->nw.waiting, 0); /* release store */
+				}
+				park_bucket_unlock (b);
+			}
+			if (ATM_LOAD (&w->nw.waiting) != 0) {
+				/* A waker may have dequeued *w, but not yet
+				   set w->nw.waiting to zero.  */
+				attempts = nsync_spin_delay_ (attempts);
+			}
+		}
+	}
+	nsync_waiter_free_ (w);
+	IGNORE_RACES_END ();
+	return (outcome);
+}
+
+int nsync_unpark_ (const void *addr, int (*select) (void *arg, uint32_t token),
+		   void (*done) (const void *addr, void *arg, int woken, int remaining),
+		   void *arg) {
+	park_bucket *b = park_bucket_for (addr);
+	nsync_dll_list_ wake = NULL;
+	nsync_dll_element_ *p;
+	nsync_dll_element_ *next;
+	int woken = 0;
+	int remaining = 0;
+	IGNORE_RACES_START ();
+	park_bucket_lock (b);
+	for (p = nsync_dll_first_ (b->waiters); p != NULL; p = next) {
+		waiter *w = DLL_WAITER (p);
+		next = nsync_dll_next_ (b->waiters, p);
+		if (w->park_addr == addr) {
+			if (select == NULL || (*select) (arg, w->park_token)) {
+				park_remove (b, w);
+				wake = nsync_dll_make_last_in_list_ (wake, p);
+				woken++;
+			} else {
+				remaining++;
+			}
+		}
+	}
+	if (done != NULL) {
+		(*done) (addr, arg, woken, remaining);
+	}
+	park_bucket_unlock (b);
+	while (!nsync_dll_is_empty_ (wake)) {
+		waiter *w;
+		/* Unlink *p before waking its thread, which may then
+		   reuse w->nw.q. */
+		p = nsync_dll_first_ (wake);
+		wake = nsync_dll_remove_ (wake, p);
+		w = DLL_WAITER (p);
+		ATM_STORE_REL (&w->nw.waiting, 0);
+		nsync_mu_semaphore_v (&w->sem);
+	}
+	IGNORE_RACES_END ();
+	return (woken);
+}
+
+/* ---------- */
+
+int nsync_park (const void *addr, int (*validate) (const void *addr, void *validate_arg),
+		void *validate_arg, nsync_time abs_deadline, nsync_note cancel_note) {
+	return (nsync_park_ (addr, validate, validate_arg, 0, abs_deadline, cancel_note));
+}
+
+/* The select function used by nsync_unpark_n(); *v is the number of threads
+   still to be woken. */
+static int park_select_n (void *v, uint32_t token) {
+	int *n = (int *) v;
+	int wake = (*n > 0);
+	(void) token;
+	if (wake) {
+		(*n)--;
+	}
+	return (wake);
+}
+
+int nsync_unpark_n (const void *addr, int n) {
+	return (n <= 0? 0 : nsync_unpark_ (addr, &park_select_n, NULL, &n));
+}
+
+int nsync_unpark_one (const void *addr) {
+	return (nsync_unpark_n (addr, 1));
+}
+
+int nsync_unpark_all (const void *addr) {
+	return (nsync_unpark_ (addr, NULL, NULL, NULL));
+}
+
+NSYNC_CPP_END_
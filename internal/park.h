@@ -0,0 +1,55 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#ifndef NSYNC_INTERNAL_PARK_H_
+#define NSYNC_INTERNAL_PARK_H_
+
+/* A parking lot: queues of blocked threads keyed by address, so that a
+   synchronization object need hold no queue of its own. */
+
+#include "nsync_cpp.h"
+#include "nsync_time.h"
+
+NSYNC_CPP_START_
+
+struct nsync_note_s_;
+
+/* Block the calling thread on addr until it is woken by nsync_unpark_() on
+   addr, abs_deadline passes, or *cancel_note is notified.  (*validate)
+   (addr, validate_arg) is first called with addr's queue locked; if it
+   returns zero, the thread does not block.  Thus a thread that validates
+   the state at addr cannot miss a wakeup by a thread that changes that state
+   and then calls nsync_unpark_().  validate may be NULL.  token is recorded
+   with the thread, for use by nsync_unpark_()'s select.
+
+   Returns 0 if woken by nsync_unpark_(), EAGAIN if (*validate) returned 0,
+   and otherwise ETIMEDOUT or ECANCELED.  */
+int nsync_park_ (const void *addr, int (*validate) (const void *addr, void *validate_arg),
+		 void *validate_arg, uint32_t token, nsync_time abs_deadline,
+		 struct nsync_note_s_ *cancel_note);
+
+/* Wake threads blocked in nsync_park_() on addr.  With addr's queue locked,
+   (*select) (arg, token) is called for each such thread in the order they
+   blocked, with the token it passed; the thread is woken iff it returns
+   non-zero.  Then, with the queue still locked, (*done) (addr, arg, woken,
+   remaining) is called with the numbers of threads woken and left blocked on
+   addr.  select and done may be NULL; a NULL select wakes every thread.
+   Returns the number of threads woken.  */
+int nsync_unpark_ (const void *addr, int (*select) (void *arg, uint32_t token),
+		   void (*done) (const void *addr, void *arg, int woken, int remaining),
+		   void *arg);
+
+NSYNC_CPP_END_
+
+#endif /*NSYNC_INTERNAL_PARK_H_*/
@@ -19,6 +19,7 @@
    It may be counting or binary, and it need have no destructor.  */
 
 #include "nsync_cpp.h"
+#include "nsync_atomic.h"
 
 NSYNC_CPP_START_
 
@@ -40,6 +41,18 @@ int nsync_mu_semaphore_p_with_deadline (nsync_semaphore *s, nsync_time abs_deadl
 /* Ensure that the count of *s is at least 1. */
 void nsync_mu_semaphore_v (nsync_semaphore *s);
 
+/* Counts of the calls that semaphore implementations make into the operating
+   system to block a thread (sleeps) and to wake one (wakes).  They are
+   maintained only while nsync_mu_semaphore_stats_enabled_ is non-zero, and only
+   by implementations that make such calls directly (currently the futex
+   implementation); others leave them zero.  For use by benchmarks. */
+extern nsync_atomic_uint32_ nsync_mu_semaphore_stats_enabled_;
+extern nsync_atomic_uint32_ nsync_mu_semaphore_sleeps_;
+extern nsync_atomic_uint32_ nsync_mu_semaphore_wakes_;
+
+/* If nsync_mu_semaphore_stats_enabled_ is non-zero, atomically increment *counter. */
+void nsync_mu_semaphore_count_ (nsync_atomic_uint32_ *counter);
+
 NSYNC_CPP_END_
 
 #endif /*NSYNC_INTERNAL_SEM_H_*/
@@ -0,0 +1,323 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#include "nsync_cpp.h"
+#include "platform.h"
+#include "compiler.h"
+#include "cputype.h"
+#include "nsync.h"
+#include "nsync_arena.h"
+#include "dll.h"
+#include "sem.h"
+#include "wait_internal.h"
+#include "common.h"
+#include "slab.h"
+#include "atomic.h"
+
+NSYNC_CPP_START_
+
+/* Implementation notes
+
+   A slab obtains memory in chunks, each holding a header and a number of
+   slots of the same size.  The last word of each slot points to the
+   header of its chunk, so that a freed object can be returned to its chunk.
+   Each chunk keeps a list of its free slots, and the slab keeps a list of
+   the chunks that have free slots, under the slab's spinlock.  When a chunk
+   becomes wholly free and the slab holds more free bytes than the high-water
+   mark, the chunk is returned to the allocator.
+
+   Slabs with a per-thread cache keep up to SLAB_CACHE_MAX free slots in the
+   calling thread's reserved waiter, so most allocations and frees touch no
+   shared memory; the cache is filled and drained SLAB_CACHE_BATCH slots at a
+   time under one acquisition of the slab's spinlock.  */
+
+#define SLAB_CHUNK_BYTES 8192 /* target size of a chunk */
+#define SLAB_CHUNK_MIN_SLOTS 4
+#define SLAB_CACHE_MAX 16
+#define SLAB_CACHE_BATCH 8
+#define SLAB_DEFAULT_HIGH_WATER 65536
+
+/* A slab_chunk is the header of a chunk. */
+typedef struct slab_chunk_s {
+	nsync_dll_element_ e; /* element of slab's "partial" list */
+	void *raw;            /* memory as returned by the allocator */
+	size_t raw_size;      /* size requested from the allocator */
+	int releasable;       /* whether raw may be returned to the allocator */
+	void (*release) (void *arg, void *p, size_t size); /* returns raw, or NULL for free() */
+	void *release_arg;
+	size_t slot_size;
+	unsigned slots;       /* number of slots in the chunk */
+	unsigned n_free;      /* number of slots in free */
+	void *free;           /* free slots, linked through their first word */
+} slab_chunk;
+
+/* Round n up to a multiple of NSYNC_SLAB_ALIGN_. */
+#define SLAB_ROUND_UP(n_) (((n_) + NSYNC_SLAB_ALIGN_ - 1) & ~(size_t) (NSYNC_SLAB_ALIGN_ - 1))
+
+nsync_atomic_uint32_ nsync_slab_chunk_allocs_;
+nsync_atomic_uint32_ nsync_slab_chunk_releases_;
+
+/* Atomically increment *counter. */
+static void slab_count (nsync_atomic_uint32_ *counter) {
+	uint32_t old_value;
+	do {
+		old_value = ATM_LOAD (counter);
+	} while (!ATM_CAS (counter, old_value, old_value + 1));
+}
+
+/* The arena set by nsync_set_arena(), if any. */
+static void *(*arena_alloc) (void *arg, size_t size);
+static void (*arena_release) (void *arg, void *p, size_t size);
+static void *arena_arg;
+
+/* One more than the high-water mark in bytes, or 0 for the default. */
+static nsync_atomic_uint32_ high_water_plus_1;
+
+void nsync_set_arena (void *(*alloc) (void *arg, size_t size),
+		      void (*release) (void *arg, void *p, size_t size), void *arg) {
+	arena_alloc = alloc;
+	arena_release = release;
+	arena_arg = arg;
+}
+
+void nsync_set_free_high_water (size_t bytes) {
+	uint32_t v = (uint32_t) -1;
+	if (bytes < (size_t) v) {
+		v = (uint32_t) bytes + 1;
+	}
+	ATM_STORE (&high_water_plus_1, v);
+}
+
+/* Return the high-water mark in bytes. */
+static size_t slab_high_water (void) {
+	uint32_t v = ATM_LOAD (&high_water_plus_1);
+	return (v == 0? SLAB_DEFAULT_HIGH_WATER : (size_t) (v - 1));
+}
+
+/* Return the size of the slots in *s. */
+static size_t slab_slot_size (const nsync_slab_ *s) {
+	return (SLAB_ROUND_UP (s->object_size + sizeof (slab_chunk *)));
+}
+
+/* Return the address of the chunk header pointer in slot *p of size slot_size. */
+#define SLAB_SLOT_CHUNK(p_, slot_size_) \
+	((slab_chunk **) (((char *) (p_)) + (slot_size_) - sizeof (slab_chunk *)))
+
+/* Return a new chunk for *s with all its slots free, or NULL. */
+static slab_chunk *slab_chunk_new (nsync_slab_ *s) {
+	size_t slot_size = slab_slot_size (s);
+	unsigned slots = (unsigned) (SLAB_CHUNK_BYTES / slot_size);
+	size_t header_size = SLAB_ROUND_UP (sizeof (slab_chunk));
+	size_t raw_size;
+	void *raw;
+	int releasable = 0;
+	void (*release) (void *arg, void *p, size_t size) = NULL;
+	void *release_arg = NULL;
+	slab_chunk *c = NULL;
+	if (slots < SLAB_CHUNK_MIN_SLOTS) {
+		slots = SLAB_CHUNK_MIN_SLOTS;
+	}
+	raw_size = header_size + slots * slot_size + NSYNC_SLAB_ALIGN_ - 1;
+	if (arena_alloc != NULL) {
+		raw = (*arena_alloc) (arena_arg, raw_size);
+		release = arena_release;
+		release_arg = arena_arg;
+		releasable = (release != NULL);
+	} else if (nsync_malloc_ptr_ != NULL) { /* Use client's malloc() */
+		raw = (*nsync_malloc_ptr_) (raw_size);
+	} else {
+		raw = malloc (raw_size);
+		releasable = 1;
+	}
+	if (raw != NULL) {
+		char *base = (char *) SLAB_ROUND_UP ((uintptr_t) raw);
+		unsigned i;
+		c = (slab_chunk *) base;
+		nsync_dll_init_ (&c->e, c);
+		c->raw = raw;
+		c->raw_size = raw_size;
+		c->releasable = releasable;
+		c->release = release;
+		c->release_arg = release_arg;
+		c->slot_size = slot_size;
+		c->slots = slots;
+		c->n_free = slots;
+		c->free = NULL;
+		for (i = slots; i != 0; i--) {
+			char *slot = base + header_size + (i - 1) * slot_size;
+			*SLAB_SLOT_CHUNK (slot, slot_size) = c;
+			*(void **) slot = c->free;
+			c->free = slot;
+		}
+		slab_count (&nsync_slab_chunk_allocs_);
+	}
+	return (c);
+}
+
+/* Return chunk *c to the allocator. */
+static void slab_chunk_release (slab_chunk *c) {
+	slab_count (&nsync_slab_chunk_releases_);
+	if (c->release != NULL) {
+		(*c->release) (c->release_arg, c->raw, c->raw_size);
+	} else {
+		free (c->raw);
+	}
+}
+
+/* Called with s->mu held.  Move up to n free slots from the chunks of *s to
+   the front of the list *list, and return the number moved. */
+static unsigned slab_take (nsync_slab_ *s, void **list, unsigned n) {
+	unsigned taken = 0;
+	while (taken != n && !nsync_dll_is_empty_ (s->partial)) {
+		nsync_dll_element_ *e = nsync_dll_first_ (s->partial);
+		slab_chunk *c = (slab_chunk *) e->container;
+		void *slot = c->free;
+		c->free = *(void **) slot;
+		c->n_free--;
+		if (c->n_free == 0) {
+			s->partial = nsync_dll_remove_ (s->partial, e);
+		}
+		*(void **) slot = *list;
+		*list = slot;
+		taken++;
+	}
+	s->free_slots -= taken;
+	return (taken);
+}
+
+/* Called with s->mu held.  Return slot *p to its chunk in *s.  Return the
+   chunk if it should now be released to the allocator, else NULL. */
+static slab_chunk *slab_put (nsync_slab_ *s, void *p) {
+	slab_chunk *c = *SLAB_SLOT_CHUNK (p, slab_slot_size (s));
+	slab_chunk *release = NULL;
+	*(void **) p = c->free;
+	c->free = p;
+	c->n_free++;
+	s->free_slots++;
+	if (c->n_free == 1) {
+		s->partial = nsync_dll_make_last_in_list_ (s->partial, &c->e);
+	}
+	if (c->n_free == c->slots && c->releasable &&
+	    (s->free_slots - c->slots) * c->slot_size >= slab_high_water ()) {
+		s->partial = nsync_dll_remove_ (s->partial, &c->e);
+		s->free_slots -= c->slots;
+		release = c;
+	}
+	return (release);
+}
+
+/* Return the chain of slots starting at *p and linked through their first
+   words to *s. */
+static void slab_put_list (nsync_slab_ *s, void *p) {
+	slab_chunk *release = NULL;
+	nsync_spin_test_and_set_ (&s->mu, 1, 1, 0);
+	while (p != NULL) {
+		void *next = *(void **) p;
+		slab_chunk *c = slab_put (s, p);
+		if (c != NULL) {
+			/* Release chunks after dropping the spinlock,
+			   chaining them meanwhile through their e.next.  */
+			c->e.next = (nsync_dll_element_ *) release;
+			release = c;
+		}
+		p = next;
+	}
+	ATM_STORE_REL (&s->mu, 0); /* release store */
+	while (release != NULL) {
+		slab_chunk *next = (slab_chunk *) release->e.next;
+		slab_chunk_release (release);
+		release = next;
+	}
+}
+
+/* Move up to n free slots of *s to the front of *list, allocating a chunk if
+   there are none, and return the number moved. */
+static unsigned slab_fill (nsync_slab_ *s, void **list, unsigned n) {
+	unsigned taken;
+	nsync_spin_test_and_set_ (&s->mu, 1, 1, 0);
+	taken = slab_take (s, list, n);
+	ATM_STORE_REL (&s->mu, 0); /* release store */
+	if (taken == 0) {
+		slab_chunk *c = slab_chunk_new (s);
+		if (c != NULL) {
+			nsync_spin_test_and_set_ (&s->mu, 1, 1, 0);
+			s->partial = nsync_dll_make_first_in_list_ (s->partial, &c->e);
+			s->free_slots += c->slots;
+			taken = slab_take (s, list, n);
+			ATM_STORE_REL (&s->mu, 0); /* release store */
+		}
+	}
+	return (taken);
+}
+
+void *nsync_slab_alloc_ (nsync_slab_ *s) {
+	void *p = NULL;
+	if (s->cache == NSYNC_SLAB_NO_CACHE_) {
+		slab_fill (s, &p, 1);
+	} else {
+		nsync_slab_cache_ *c = &nsync_thread_waiter_ ()->slab_cache[s->cache];
+		if (c->free == NULL) {
+			c->count = slab_fill (s, &c->free, SLAB_CACHE_BATCH);
+		}
+		p = c->free;
+		if (p != NULL) {
+			c->free = *(void **) p;
+			c->count--;
+		}
+	}
+	return (p);
+}
+
+void nsync_slab_free_ (nsync_slab_ *s, void *p) {
+	if (s->cache == NSYNC_SLAB_NO_CACHE_) {
+		*(void **) p = NULL;
+		slab_put_list (s, p);
+	} else {
+		nsync_slab_cache_ *c = &nsync_thread_waiter_ ()->slab_cache[s->cache];
+		*(void **) p = c->free;
+		c->free = p;
+		c->count++;
+		if (c->count > SLAB_CACHE_MAX) {
+			/* Keep SLAB_CACHE_BATCH slots; return the rest. */
+			void **last = &c->free;
+			unsigned i;
+			for (i = 0; i != SLAB_CACHE_BATCH; i++) {
+				last = (void **) *last;
+			}
+			p = *last;
+			*last = NULL;
+			c->count = SLAB_CACHE_BATCH;
+			slab_put_list (s, p);
+		}
+	}
+}
+
+/* The slabs that have per-thread caches, indexed by cache number. */
+static nsync_slab_ *const slab_for_cache[NSYNC_SLAB_CACHES_] = {
+	&nsync_note_slab_,
+	&nsync_counter_slab_
+};
+
+void nsync_slab_flush_caches_ (nsync_slab_cache_ *c) {
+	int i;
+	for (i = 0; i != NSYNC_SLAB_CACHES_; i++) {
+		if (c[i].free != NULL) {
+			slab_put_list (slab_for_cache[i], c[i].free);
+			c[i].free = NULL;
+			c[i].count = 0;
+		}
+	}
+}
+
+NSYNC_CPP_END_
@@ -0,0 +1,78 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#ifndef NSYNC_INTERNAL_SLAB_H_
+#define NSYNC_INTERNAL_SLAB_H_
+
+/* A slab allocator for nsync's small fixed-size objects. */
+
+#include "nsync_cpp.h"
+#include "nsync_atomic.h"
+#include "dll.h"
+
+NSYNC_CPP_START_
+
+/* Objects are placed in slots whose size is a multiple of
+   NSYNC_SLAB_ALIGN_, and whose addresses are aligned to it.  */
+#define NSYNC_SLAB_ALIGN_ 64
+
+/* Per-thread caches exist for the slabs numbered 0 to NSYNC_SLAB_CACHES_-1;
+   see the "cache" field of nsync_slab_. */
+#define NSYNC_SLAB_CACHE_NOTE_ 0
+#define NSYNC_SLAB_CACHE_COUNTER_ 1
+#define NSYNC_SLAB_CACHES_ 2
+#define NSYNC_SLAB_NO_CACHE_ (-1)
+
+/* A thread's cache of free slots of one slab.  It lives in the thread's
+   reserved waiter (see common.h), so that it is flushed when the thread
+   exits. */
+typedef struct nsync_slab_cache_s_ {
+	void *free;     /* free slots, linked through their first word */
+	unsigned count; /* number of slots in free */
+} nsync_slab_cache_;
+
+/* An nsync_slab_ allocates objects of one size.  Initialize statically with
+   NSYNC_SLAB_INIT_. */
+typedef struct nsync_slab_s_ {
+	size_t object_size;  /* size of objects allocated */
+	int cache;           /* index of per-thread cache, or NSYNC_SLAB_NO_CACHE_ */
+	nsync_atomic_uint32_ mu; /* spinlock; protects fields below */
+	nsync_dll_list_ partial; /* chunks with free slots */
+	size_t free_slots;   /* number of free slots in chunks */
+} nsync_slab_;
+#define NSYNC_SLAB_INIT_(size_, cache_) { (size_), (cache_), NSYNC_ATOMIC_UINT32_INIT_, NULL, 0 }
+
+/* The slabs for nsync_note and nsync_counter objects. */
+extern nsync_slab_ nsync_note_slab_;
+extern nsync_slab_ nsync_counter_slab_;
+
+/* Return a pointer to a new object from *s, aligned to NSYNC_SLAB_ALIGN_,
+   or NULL if memory is exhausted.  The contents are undefined. */
+void *nsync_slab_alloc_ (nsync_slab_ *s);
+
+/* Return *p, which was allocated from *s, to *s. */
+void nsync_slab_free_ (nsync_slab_ *s, void *p);
+
+/* Return the slots in the caches c[0, ..., NSYNC_SLAB_CACHES_-1] to their
+   slabs.  Called when a thread exits. */
+void nsync_slab_flush_caches_ (nsync_slab_cache_ *c);
+
+/* Counts of chunks of slots obtained from, and returned to, the underlying
+   allocator.  For use by benchmarks. */
+extern nsync_atomic_uint32_ nsync_slab_chunk_allocs_;
+extern nsync_atomic_uint32_ nsync_slab_chunk_releases_;
+
+NSYNC_CPP_END_
+
+#endif /*NSYNC_INTERNAL_SLAB_H_*/
@@ -25,11 +25,155 @@
 
 NSYNC_CPP_START_
 
-int nsync_wait_n (void *mu, void (*lock) (void *), void (*unlock) (void *),
-		  nsync_time abs_deadline,
-		  int count, struct nsync_waitable_s *waitable[]) {
+/* Implementation notes
+
+   Generally, nsync_wait_n() enqueues a struct nsync_waiter_s on each
+   waitable, all sharing one semaphore, and dequeues them on return.
+
+   Where the platform provides futex_waitv() (Linux 5.16 and later), and every
+   waitable is a note or a counter, it instead obtains from each object a word
+   that will change when the object becomes ready (see
+   nsync_note_futex_word_() and nsync_counter_futex_word_()), and blocks on
+   all the words at once.  It then acquires no locks, except to handle a
+   note's expiry.  The objects call nsync_wait_futex_wake_() on the word once
+   any thread has waited this way.  If the kernel lacks futex_waitv(), the
+   first attempt to use it fails with ENOSYS, and enqueueing is used from then
+   on.  */
+
+#if defined(SYS_futex_waitv) && defined(FUTEX_32) && defined(FUTEX_WAITV_MAX) && \
+    defined(FUTEX_PRIVATE_FLAG)
+#define WAIT_FUTEX_WAITV 1
+#endif
+
+#if defined(WAIT_FUTEX_WAITV)
+
+/* Set once futex_waitv() has been found not to work. */
+static nsync_atomic_uint32_ futex_waitv_missing;
+
+void nsync_wait_futex_wake_ (nsync_atomic_uint32_ *word) {
+	nsync_mu_semaphore_count_ (&nsync_mu_semaphore_wakes_);
+	syscall (SYS_futex, word, FUTEX_WAKE | FUTEX_PRIVATE_FLAG, INT_MAX, NULL, NULL, 0);
+}
+
+/* The type of nsync_note_futex_word_() and nsync_counter_futex_word_(). */
+typedef nsync_atomic_uint32_ *(*futex_word_func) (void *v, uint32_t *value, nsync_time *deadline);
+
+/* Return the function that yields a word to block on for *w, or NULL if
+   there is none. */
+static futex_word_func futex_word_func_of (const struct nsync_waitable_s *w) {
+	futex_word_func f = NULL;
+	if (w->funcs == &nsync_note_waitable_funcs) {
+		f = &nsync_note_futex_word_;
+	} else if (w->funcs == &nsync_counter_waitable_funcs) {
+		f = &nsync_counter_futex_word_;
+	}
+	return (f);
+}
+
+/* Behave as nsync_wait_n(), setting *ready to its result, and return 0; or,
+   if futex_waitv() cannot be used for these waitables, return ENOSYS,
+   having waited for nothing.  */
+static int wait_n_futex (void *mu, void (*lock) (void *), void (*unlock) (void *),
+			 nsync_time abs_deadline, int count,
+			 struct nsync_waitable_s *waitable[], int *ready) {
+	struct futex_waitv wv_set[4];
+	struct futex_waitv *wv = wv_set;
+	int result = 0;
+	int unlocked = 0;
+	int expired = 0;
+	int i;
+	if (count == 0 || count > FUTEX_WAITV_MAX || ATM_LOAD (&futex_waitv_missing) != 0) {
+		return (ENOSYS);
+	}
+	for (i = 0; i != count && futex_word_func_of (waitable[i]) != NULL; i++) {
+	}
+	if (i != count) {
+		return (ENOSYS);
+	}
+	if (count > (int) (sizeof (wv_set) / sizeof (wv_set[0]))) {
+		wv = (struct futex_waitv *) malloc (count * sizeof (wv[0]));
+	}
+	memset ((void *) wv, 0, count * sizeof (wv[0]));
+	*ready = count;
+	while (*ready == count && !expired && result == 0) {
+		nsync_time now = nsync_time_now ();
+		nsync_time min_deadline = abs_deadline;
+		for (i = 0; i != count && *ready == count; i++) {
+			uint32_t value;
+			nsync_time deadline;
+			nsync_atomic_uint32_ *word = (*futex_word_func_of (waitable[i])) (
+				waitable[i]->v, &value, &deadline);
+			if (word == NULL) {
+				*ready = i;
+			} else if (nsync_time_cmp (deadline, now) <= 0) {
+				/* The object's own code handles its expiry. */
+				if (nsync_time_cmp ((*waitable[i]->funcs->ready_time) (waitable[i]->v, NULL),
+						    nsync_time_zero) <= 0) {
+					*ready = i;
+				}
+			} else {
+				if (nsync_time_cmp (deadline, min_deadline) < 0) {
+					min_deadline = deadline;
+				}
+				wv[i].val = value;
+				wv[i].uaddr = (uintptr_t) word;
+				wv[i].flags = FUTEX_32 | FUTEX_PRIVATE_FLAG;
+			}
+		}
+		expired = (nsync_time_cmp (abs_deadline, now) <= 0);
+		if (*ready == count && !expired) {
+			struct timespec ts_buf;
+			const struct timespec *ts = NULL;
+			if (nsync_time_cmp (min_deadline, nsync_time_no_deadline) != 0) {
+				memset (&ts_buf, 0, sizeof (ts_buf));
+				ts_buf.tv_sec = NSYNC_TIME_SEC (min_deadline);
+				ts_buf.tv_nsec = NSYNC_TIME_NSEC (min_deadline);
+				ts = &ts_buf;
+			}
+			if (mu != NULL && !unlocked) {
+				(*unlock) (mu);
+				unlocked = 1;
+			}
+			nsync_mu_semaphore_count_ (&nsync_mu_semaphore_sleeps_);
+			if (syscall (SYS_futex_waitv, wv, count, 0, ts, CLOCK_REALTIME) == -1 &&
+			    errno != EAGAIN && errno != ETIMEDOUT && errno != EINTR) {
+				/* Most likely ENOSYS, from a kernel older than
+				   5.16; use the enqueueing path. */
+				ATM_STORE (&futex_waitv_missing, 1);
+				result = ENOSYS;
+			}
+		}
+	}
+	if (wv != wv_set) {
+		free (wv);
+	}
+	if (unlocked) {
+		(*lock) (mu);
+	}
+	return (result);
+}
+
+#else
+
+void nsync_wait_futex_wake_ (nsync_atomic_uint32_ *word UNUSED) {
+}
+
+#endif
+
+void nsync_waiter_wake_ (struct nsync_waiter_s *nw) {
+	if ((nw->flags & NSYNC_WAITER_FLAG_EVENTFD) != 0) {
+		nsync_eventfd_wake_ (nw);
+	} else {
+		ATM_STORE_REL (&nw->waiting, 0); /* release store */
+		nsync_mu_semaphore_v (nw->sem);
+	}
+}
+
+/* nsync_wait_n(), by enqueueing on each waitable. */
+static int wait_n_enqueue (void *mu, void (*lock) (void *), void (*unlock) (void *),
+			   nsync_time abs_deadline,
+			   int count, struct nsync_waitable_s *waitable[]) {
 	int ready;
-	IGNORE_RACES_START ();
 	for (ready = 0; ready != count &&
 			nsync_time_cmp ((*waitable[ready]->funcs->ready_time) (
 						waitable[ready]->v, NULL),
@@ -96,6 +240,21 @@ int nsync_wait_n (void *mu, void (*lock) (void *), void (*unlock) (void *),
 			(*lock) (mu);
 		}
 	}
+	return (ready);
+}
+
+int nsync_wait_n (void *mu, void (*lock) (void *), void (*unlock) (void *),
+		  nsync_time abs_deadline,
+		  int count, struct nsync_waitable_s *waitable[]) {
+	int ready;
+	IGNORE_RACES_START ();
+#if defined(WAIT_FUTEX_WAITV)
+	if (wait_n_futex (mu, lock, unlock, abs_deadline, count, waitable, &ready) != 0) {
+		ready = wait_n_enqueue (mu, lock, unlock, abs_deadline, count, waitable);
+	}
+#else
+	ready = wait_n_enqueue (mu, lock, unlock, abs_deadline, count, waitable);
+#endif
 	IGNORE_RACES_END ();
 	return (ready);
 }
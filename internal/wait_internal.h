@@ -27,9 +27,11 @@ struct nsync_waiter_s {
 	nsync_atomic_uint32_ waiting; /* non-zero <=> the waiter is waiting */
 	struct nsync_semaphore_s_ *sem; /* *sem will be Ved when waiter is woken */
 	uint32_t flags; /* see below */
+	uint32_t wait_arg; /* for use by the waitable while queued; e.g., an nsync_bcounter threshold */
 };
 
 #define NSYNC_WAITER_FLAG_MUCV 0x1 /* set if waiter is embedded in Mu/CV's internal structures */
+#define NSYNC_WAITER_FLAG_EVENTFD 0x2 /* set if waiter is embedded in an nsync_eventfd */
 
 NSYNC_CPP_END_
 
@@ -0,0 +1,240 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#include "nsync_cpp.h"
+#include "platform.h"
+#include "compiler.h"
+#include "cputype.h"
+#include "nsync.h"
+#include "nsync_waitset.h"
+#include "dll.h"
+#include "sem.h"
+#include "wait_internal.h"
+#include "common.h"
+#include "atomic.h"
+
+NSYNC_CPP_START_
+
+/* Implementation notes
+
+   Each waitable in a set has a registration, holding the struct
+   nsync_waiter_s that is queued on the object.  All the registrations of a
+   set share the set's semaphore, which the objects' wakers V.  A
+   registration is "armed" once it has been queued on its object, and stays
+   armed until the object is reported ready; it is armed again at the start
+   of the next wait, while the caller's lock is still held, so that a
+   condition variable cannot be signalled unseen.
+
+   An armed registration is ready when a waker has dequeued it (nw.waiting
+   is zero), or when the deadline the object reported at arming has passed.
+   Only then is the object's ready_time() consulted, and its dequeue()
+   called, so a wait in which nothing is ready reads nw.waiting and compares
+   a time for each registration, and takes only the set's own lock.
+
+   A wait that reports max objects stops scanning there, and the next scan
+   resumes with the registration that follows the last one reported, so
+   that objects that stay ready (such as notified notes) near the front of
+   the list cannot hide those behind them from a caller that passes a small
+   max.
+
+   ws->mu protects the list of registrations, and is released while the
+   waiting thread is blocked, so that other threads may add and remove
+   waitables.  The order of locks is: the caller's mu, then ws->mu, then
+   any lock of the waitables.  */
+
+/* The registration of a waitable in a set. */
+typedef struct waitset_reg_s {
+	struct nsync_waitable_s *w;   /* the client's waitable */
+	struct nsync_waiter_s nw;     /* queued on w->v while armed */
+	nsync_time deadline;          /* from w's ready_time() when armed */
+	int armed;                    /* whether nw has been queued on w->v */
+	nsync_dll_element_ reg_link;  /* in ws->regs */
+} waitset_reg;
+
+#define DLL_WAITSET_REG(e) ((waitset_reg *) ((e)->container))
+
+struct nsync_waitset_s_ {
+	nsync_mu mu;                 /* protects regs and resume */
+	nsync_dll_list_ regs;        /* of waitset_reg, in the order added */
+	nsync_dll_element_ *resume;  /* where the next scan starts; NULL: first */
+	nsync_semaphore sem;         /* V'd by wakers of every registration */
+};
+
+nsync_waitset nsync_waitset_new (void) {
+	nsync_waitset ws = (nsync_waitset) malloc (sizeof (*ws));
+	if (ws != NULL) {
+		memset ((void *) ws, 0, sizeof (*ws));
+		nsync_mu_init (&ws->mu);
+		nsync_mu_semaphore_init (&ws->sem);
+	}
+	return (ws);
+}
+
+/* Remove *r from ws->regs, dequeueing it from its object, and free it.
+   ws->mu is held. */
+static void waitset_reg_remove (nsync_waitset ws, waitset_reg *r) {
+	if (r->armed) {
+		(*r->w->funcs->dequeue) (r->w->v, &r->nw);
+	}
+	if (ws->resume == &r->reg_link) {
+		ws->resume = nsync_dll_next_ (ws->regs, &r->reg_link);
+	}
+	ws->regs = nsync_dll_remove_ (ws->regs, &r->reg_link);
+	free (r);
+}
+
+void nsync_waitset_free (nsync_waitset ws) {
+	nsync_dll_element_ *p;
+	nsync_mu_lock (&ws->mu);
+	while ((p = nsync_dll_first_ (ws->regs)) != NULL) {
+		waitset_reg_remove (ws, DLL_WAITSET_REG (p));
+	}
+	nsync_mu_unlock (&ws->mu);
+	free (ws);
+}
+
+int nsync_waitset_add (nsync_waitset ws, struct nsync_waitable_s *w) {
+	waitset_reg *r = (waitset_reg *) malloc (sizeof (*r));
+	if (r == NULL) {
+		return (0);
+	}
+	memset ((void *) r, 0, sizeof (*r));
+	r->w = w;
+	r->nw.tag = NSYNC_WAITER_TAG;
+	r->nw.sem = &ws->sem;
+	nsync_dll_init_ (&r->nw.q, &r->nw);
+	ATM_STORE (&r->nw.waiting, 0);
+	r->nw.flags = 0;
+	nsync_dll_init_ (&r->reg_link, r);
+	nsync_mu_lock (&ws->mu);
+	ws->regs = nsync_dll_make_last_in_list_ (ws->regs, &r->reg_link);
+	nsync_mu_unlock (&ws->mu);
+	/* Have any thread blocked on ws arm the new registration. */
+	nsync_mu_semaphore_v (&ws->sem);
+	return (1);
+}
+
+int nsync_waitset_remove (nsync_waitset ws, struct nsync_waitable_s *w) {
+	nsync_dll_element_ *p;
+	int found = 0;
+	nsync_mu_lock (&ws->mu);
+	for (p = nsync_dll_first_ (ws->regs); p != NULL && !found; ) {
+		waitset_reg *r = DLL_WAITSET_REG (p);
+		if (r->w == w) {
+			waitset_reg_remove (ws, r);  /* frees *p */
+			found = 1;
+		} else {
+			p = nsync_dll_next_ (ws->regs, p);
+		}
+	}
+	nsync_mu_unlock (&ws->mu);
+	return (found);
+}
+
+/* Arm each unarmed registration in ws, and place in ready[] any whose
+   objects are ready, up to max in total, starting from *n.  The scan starts
+   at ws->resume, wrapping around to the front of ws->regs, and leaves
+   ws->resume after the last registration reported.  Set *min_deadline to
+   the earliest of its initial value and the deadlines of the armed
+   registrations scanned.  ws->mu is held. */
+static void waitset_scan (nsync_waitset ws, int max, struct nsync_waitable_s *ready[],
+			  int *n, nsync_time *min_deadline) {
+	nsync_time now = nsync_time_zero;
+	int have_now = 0;
+	nsync_dll_element_ *start = ws->resume;
+	nsync_dll_element_ *p;
+	if (start == NULL) {
+		start = nsync_dll_first_ (ws->regs);
+	}
+	for (p = start; p != NULL && *n != max; ) {
+		waitset_reg *r = DLL_WAITSET_REG (p);
+		int is_ready = 0;
+		if (!r->armed) {
+			if ((*r->w->funcs->enqueue) (r->w->v, &r->nw)) {
+				r->armed = 1;
+				r->deadline = (*r->w->funcs->ready_time) (r->w->v, &r->nw);
+			} else {
+				is_ready = 1;
+			}
+		}
+		if (r->armed && nsync_time_cmp (r->deadline, nsync_time_no_deadline) != 0 &&
+		    !have_now) {
+			now = nsync_time_now ();
+			have_now = 1;
+		}
+		if (r->armed && (ATM_LOAD_ACQ (&r->nw.waiting) == 0 ||
+				 (have_now && nsync_time_cmp (r->deadline, now) <= 0))) {
+			/* The object may be ready; ask it. */
+			r->deadline = (*r->w->funcs->ready_time) (r->w->v, &r->nw);
+			if (nsync_time_cmp (r->deadline, nsync_time_zero) <= 0) {
+				(*r->w->funcs->dequeue) (r->w->v, &r->nw);
+				r->armed = 0;
+				is_ready = 1;
+			}
+		}
+		if (is_ready) {
+			ready[(*n)++] = r->w;
+			ws->resume = nsync_dll_next_ (ws->regs, p);
+		} else if (nsync_time_cmp (r->deadline, *min_deadline) < 0) {
+			*min_deadline = r->deadline;
+		}
+		p = nsync_dll_next_ (ws->regs, p);
+		if (p == NULL) {
+			p = nsync_dll_first_ (ws->regs);
+		}
+		if (p == start) {
+			p = NULL;
+		}
+	}
+}
+
+int nsync_waitset_wait (nsync_waitset ws, void *mu, void (*lock) (void *),
+			void (*unlock) (void *), nsync_time abs_deadline,
+			int max, struct nsync_waitable_s *ready[]) {
+	int n = 0;
+	int unlocked = 0;
+	int expired = 0;
+	IGNORE_RACES_START ();
+	nsync_mu_lock (&ws->mu);
+	while (n == 0 && !expired) {
+		nsync_time min_deadline = abs_deadline;
+		waitset_scan (ws, max, ready, &n, &min_deadline);
+		if (n == 0) {
+			nsync_mu_unlock (&ws->mu);
+			if (mu != NULL && !unlocked) {
+				(*unlock) (mu);
+				unlocked = 1;
+			}
+			if (nsync_time_cmp (min_deadline, nsync_time_zero) > 0) {
+				nsync_mu_semaphore_p_with_deadline (&ws->sem, min_deadline);
+			}
+			expired = (nsync_time_cmp (abs_deadline, nsync_time_now ()) <= 0);
+			nsync_mu_lock (&ws->mu);
+			if (expired) {
+				/* Report any object that became ready at the
+				   deadline. */
+				min_deadline = abs_deadline;
+				waitset_scan (ws, max, ready, &n, &min_deadline);
+			}
+		}
+	}
+	nsync_mu_unlock (&ws->mu);
+	if (unlocked) {
+		(*lock) (mu);
+	}
+	IGNORE_RACES_END ();
+	return (n);
+}
+
+NSYNC_CPP_END_
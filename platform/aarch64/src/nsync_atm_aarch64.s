@@ -117,3 +117,13 @@ nsync_atm_store_:
 nsync_atm_store_rel_:
 	stlr	w1, [x0]
 	ret
+
+/* A barrier ordering all preceding memory operations before all following
+   ones:
+	void nsync_atm_fence_ (void) { } */
+	.align	3
+	.global	nsync_atm_fence_
+	.type	nsync_atm_fence_, %function
+nsync_atm_fence_:
+	dmb	ish
+	ret
@@ -155,3 +155,16 @@ nsync_atm_store_rel_:
 	stl	a1, (a0)
 	ret	(ra)
 	.end 	nsync_atm_store_rel_
+
+/* A barrier ordering all preceding memory operations before all following
+   ones:
+	void nsync_atm_fence_ (void) { } */
+	.align	4
+	.globl  nsync_atm_fence_
+	.ent 	nsync_atm_fence_
+nsync_atm_fence_:
+	.frame  $sp, 0, ra
+	.prologue 0
+	mb
+	ret	(ra)
+	.end 	nsync_atm_fence_
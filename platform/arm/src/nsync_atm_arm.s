@@ -136,3 +136,13 @@ nsync_atm_store_rel_:
 	dmb	sy
 	str	r1, [r0]
 	bx	lr
+
+/* A barrier ordering all preceding memory operations before all following
+   ones:
+	void nsync_atm_fence_ (void) { } */
+	.align	3
+	.global	nsync_atm_fence_
+	.type	nsync_atm_fence_, %function
+nsync_atm_fence_:
+	dmb	sy
+	bx	lr
@@ -58,6 +58,12 @@
    // A *_REL variant is available,
    // with the barrier semantics described above.
    void ATM_STORE (nsync_atomic_uint32_ *p, uint32_t value);
+
+   // Ensures that memory operations performed by the calling thread before
+   // the call appear to complete before those it performs after the call,
+   // as seen by other threads.  Unlike the barriers above, this orders a
+   // preceding store before a following load.
+   void ATM_FENCE (void);
  */
 
 #include "compiler.h"
@@ -73,6 +79,7 @@ uint32_t nsync_atm_load_ (const nsync_atomic_uint32_ *p);
 uint32_t nsync_atm_load_acq_ (const nsync_atomic_uint32_ *p);
 void nsync_atm_store_ (nsync_atomic_uint32_ *p, uint32_t value);
 void nsync_atm_store_rel_ (nsync_atomic_uint32_ *p, uint32_t value);
+void nsync_atm_fence_ (void);
 
 #define ATM_CAS nsync_atm_cas_
 #define ATM_CAS_ACQ nsync_atm_cas_acq_
@@ -82,6 +89,7 @@ void nsync_atm_store_rel_ (nsync_atomic_uint32_ *p, uint32_t value);
 #define ATM_LOAD_ACQ nsync_atm_load_acq_
 #define ATM_STORE nsync_atm_store_
 #define ATM_STORE_REL nsync_atm_store_rel_
+#define ATM_FENCE nsync_atm_fence_
 
 NSYNC_CPP_END_
 
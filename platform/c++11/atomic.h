@@ -58,6 +58,12 @@
    // A *_REL variant is available,
    // with the barrier semantics described above.
    void ATM_STORE (nsync_atomic_uint32_ *p, uint32_t value);
+
+   // Ensures that memory operations performed by the calling thread before
+   // the call appear to complete before those it performs after the call,
+   // as seen by other threads.  Unlike the barriers above, this orders a
+   // preceding store before a following load.
+   void ATM_FENCE (void);
  */
 
 #include "nsync_cpp.h"
@@ -95,6 +101,8 @@ static INLINE int atm_cas_relacq_u32_ (nsync_atomic_uint32_ *p, uint32_t o, uint
 #define ATM_STORE(p,v)      (std::atomic_store_explicit (NSYNC_ATOMIC_UINT32_PTR_ (p), (uint32_t) (v), std::memory_order_relaxed))
 #define ATM_STORE_REL(p,v)  (std::atomic_store_explicit (NSYNC_ATOMIC_UINT32_PTR_ (p), (uint32_t) (v), std::memory_order_release))
 
+#define ATM_FENCE()         (std::atomic_thread_fence (std::memory_order_seq_cst))
+
 NSYNC_CPP_END_
 
 #endif /*NSYNC_PLATFORM_CPP11_ATOMIC_H_*/
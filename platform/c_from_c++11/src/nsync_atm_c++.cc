@@ -56,6 +56,12 @@
    // A *_REL variant is available,
    // with the barrier semantics described above.
    void ATM_STORE (nsync_atomic_uint32_ *p, uint32_t value);
+
+   // Ensures that memory operations performed by the calling thread before
+   // the call appear to complete before those it performs after the call,
+   // as seen by other threads.  Unlike the barriers above, this orders a
+   // preceding store before a following load.
+   void ATM_FENCE (void);
    */
 
 #include <atomic>
@@ -109,4 +115,8 @@ void nsync_atm_store_rel_ (nsync_atomic_uint32_ *p, uint32_t value) {
 	std::atomic_store_explicit ((nsync_atomic_uint32_cpp_ *) p, value, std::memory_order_release);
 }
 
+void nsync_atm_fence_ (void) {
+	std::atomic_thread_fence (std::memory_order_seq_cst);
+}
+
 NSYNC_C_END_
@@ -59,6 +59,12 @@
    // A *_REL variant is available,
    // with the barrier semantics described above.
    void ATM_STORE (nsync_atomic_uint32_ *p, uint32_t value);
+
+   // Ensures that memory operations performed by the calling thread before
+   // the call appear to complete before those it performs after the call,
+   // as seen by other threads.  Unlike the barriers above, this orders a
+   // preceding store before a following load.
+   void ATM_FENCE (void);
    */
 
 #if !defined(__GNUC__) || \
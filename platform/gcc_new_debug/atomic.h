@@ -58,6 +58,12 @@
    // A *_REL variant is available,
    // with the barrier semantics described above.
    void ATM_STORE (nsync_atomic_uint32_ *p, uint32_t value);
+
+   // Ensures that memory operations performed by the calling thread before
+   // the call appear to complete before those it performs after the call,
+   // as seen by other threads.  Unlike the barriers above, this orders a
+   // preceding store before a following load.
+   void ATM_FENCE (void);
  */
 
 #include "compiler.h" 
@@ -119,6 +125,8 @@ static __inline__ int atm_cas_relacq_u32_ (nsync_atomic_uint32_ *p, uint32_t o,
 			     __atomic_store_n (NSYNC_ATOMIC_UINT32_PTR_ (p), (v), \
 			     __ATOMIC_RELEASE))
 
+#define ATM_FENCE()         (__atomic_thread_fence (__ATOMIC_SEQ_CST))
+
 NSYNC_CPP_END_
 
 #endif /*NSYNC_PLATFORM_GCC_NEW_DEBUG_ATOMIC_H_*/
@@ -129,3 +129,17 @@ nsync_atm_store_rel_:
 	st4.rel [r32] = r33
 	br.ret.sptk.many b0
 	.endp nsync_atm_store_rel_#
+
+/* A barrier ordering all preceding memory operations before all following
+   ones:
+	void nsync_atm_fence_ (void) { } */
+	.align 16
+	.global nsync_atm_fence_#
+	.type	nsync_atm_fence_#, @function
+	.proc nsync_atm_fence_#
+nsync_atm_fence_:
+	.prologue
+	.body
+	mf
+	br.ret.sptk.many b0
+	.endp nsync_atm_fence_#
@@ -29,6 +29,9 @@
 #include <limits.h>
 #include <linux/futex.h>
 #include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/epoll.h>
 #include <pthread.h>
 #include <semaphore.h>
 
@@ -44,6 +44,16 @@ static const int assert_int_size = 1 /
 
 #define ASSERT(x) do { if (!(x)) { *(volatile int *)0 = 0; } } while (0)
 
+/* The low half of the futex word holds the semaphore's count, which is
+   0 or 1; the semaphore is binary, as sem.h permits.  The high half counts the
+   threads that have announced that they are about to sleep, or are sleeping,
+   in FUTEX_WAIT_, so that nsync_mu_semaphore_v() need enter the kernel only
+   when some thread might be blocked.  A thread announces itself with the same
+   atomic operation that verifies that the count is zero, and sleeps only if
+   the word is unchanged, so a v() that sees no sleepers cannot miss one.  */
+#define FUTEX_COUNT_ ((uint32_t) 0xffff)   /* mask for count */
+#define FUTEX_SLEEPER_ ((uint32_t) 0x10000) /* one sleeper in high half */
+
 struct futex {
 	int i;  /* lo half=count; hi half=waiter count */
 };
@@ -60,16 +70,28 @@ void nsync_mu_semaphore_init (nsync_semaphore *s) {
 /* Wait until the count of *s exceeds 0, and decrement it. */
 void nsync_mu_semaphore_p (nsync_semaphore *s) {
 	struct futex *f = (struct futex *) s;
-	int i;
-	do {
-		i = ATM_LOAD ((nsync_atomic_uint32_ *) &f->i);
-		if (i == 0) {
-                        int futex_result = futex (&f->i, FUTEX_WAIT_, i, NULL,
-                                                  NULL, FUTEX_WAIT_BITS_);
+	nsync_atomic_uint32_ *pi = (nsync_atomic_uint32_ *) &f->i;
+	uint32_t sleeper = 0; /* FUTEX_SLEEPER_ once counted as a sleeper */
+	uint32_t i;
+	for (;;) {
+		i = ATM_LOAD (pi);
+		if ((i & FUTEX_COUNT_) != 0) {
+			if (ATM_CAS_ACQ (pi, i, i - 1 - sleeper)) {
+				break;
+			}
+		} else if (sleeper != 0 || ATM_CAS (pi, i, i + FUTEX_SLEEPER_)) {
+			int futex_result;
+			if (sleeper == 0) {
+				sleeper = FUTEX_SLEEPER_;
+				i += FUTEX_SLEEPER_;
+			}
+			nsync_mu_semaphore_count_ (&nsync_mu_semaphore_sleeps_);
+			futex_result = futex (&f->i, FUTEX_WAIT_, (int) i, NULL,
+					      NULL, FUTEX_WAIT_BITS_);
 			ASSERT (futex_result == 0 || errno == EINTR ||
 				errno == EWOULDBLOCK);
 		}
-	} while (i == 0 || !ATM_CAS_ACQ ((nsync_atomic_uint32_ *) &f->i, i, i-1));
+	}
 }
 
 /* Wait until one of:
@@ -77,14 +99,30 @@ void nsync_mu_semaphore_p (nsync_semaphore *s) {
    or abs_deadline expires, in which case return ETIMEDOUT. */
 int nsync_mu_semaphore_p_with_deadline (nsync_semaphore *s, nsync_time abs_deadline) {
 	struct futex *f = (struct futex *)s;
-	int i;
+	nsync_atomic_uint32_ *pi = (nsync_atomic_uint32_ *) &f->i;
+	uint32_t sleeper = 0; /* FUTEX_SLEEPER_ once counted as a sleeper */
+	uint32_t i;
 	int result = 0;
-	do {
-		i = ATM_LOAD ((nsync_atomic_uint32_ *) &f->i);
-		if (i == 0) {
+	for (;;) {
+		i = ATM_LOAD (pi);
+		if ((i & FUTEX_COUNT_) != 0) {
+			if (ATM_CAS_ACQ (pi, i, i - 1 - sleeper)) {
+				result = 0;
+				break;
+			}
+		} else if (result != 0) {
+			/* Timed out; stop being counted as a sleeper. */
+			if (ATM_CAS (pi, i, i - sleeper)) {
+				break;
+			}
+		} else if (sleeper != 0 || ATM_CAS (pi, i, i + FUTEX_SLEEPER_)) {
 			int futex_result;
 			struct timespec ts_buf;
 			const struct timespec *ts = NULL;
+			if (sleeper == 0) {
+				sleeper = FUTEX_SLEEPER_;
+				i += FUTEX_SLEEPER_;
+			}
 			if (nsync_time_cmp (abs_deadline, nsync_time_no_deadline) != 0) {
 				memset (&ts_buf, 0, sizeof (ts_buf));
 				if (FUTEX_TIMEOUT_IS_ABSOLUTE) {
@@ -105,7 +143,8 @@ int nsync_mu_semaphore_p_with_deadline (nsync_semaphore *s, nsync_time abs_deadl
 				}
 				ts = &ts_buf;
 			}
-			futex_result = futex (&f->i, FUTEX_WAIT_, i, ts, NULL, FUTEX_WAIT_BITS_);
+			nsync_mu_semaphore_count_ (&nsync_mu_semaphore_sleeps_);
+			futex_result = futex (&f->i, FUTEX_WAIT_, (int) i, ts, NULL, FUTEX_WAIT_BITS_);
 			ASSERT (futex_result == 0 || errno == EINTR || errno == EWOULDBLOCK ||
 				errno == ETIMEDOUT);
 			/* Some systems don't wait as long as they are told. */ 
@@ -114,18 +153,26 @@ int nsync_mu_semaphore_p_with_deadline (nsync_semaphore *s, nsync_time abs_deadl
 				result = ETIMEDOUT;
 			}
 		}
-	} while (result == 0 && (i == 0 || !ATM_CAS_ACQ ((nsync_atomic_uint32_ *) &f->i, i, i - 1)));
+	}
 	return (result);
 }
 
 /* Ensure that the count of *s is at least 1. */
 void nsync_mu_semaphore_v (nsync_semaphore *s) {
 	struct futex *f = (struct futex *) s;
-        uint32_t old_value;
-        do {    
-                old_value = ATM_LOAD ((nsync_atomic_uint32_ *) &f->i);
-        } while (!ATM_CAS_REL ((nsync_atomic_uint32_ *) &f->i, old_value, old_value+1));
-	ASSERT (futex (&f->i, FUTEX_WAKE_, 1, NULL, NULL, 0) >= 0);
+	nsync_atomic_uint32_ *pi = (nsync_atomic_uint32_ *) &f->i;
+	uint32_t old_value;
+	do {
+		old_value = ATM_LOAD (pi);
+	} while ((old_value & FUTEX_COUNT_) == 0 &&
+		 !ATM_CAS_REL (pi, old_value, old_value+1));
+	/* Enter the kernel only if this call made the count non-zero, and some
+	   thread may be sleeping.  If the count was already non-zero, whichever
+	   call made it so has woken any sleeper. */
+	if ((old_value & FUTEX_COUNT_) == 0 && (old_value & ~FUTEX_COUNT_) != 0) {
+		nsync_mu_semaphore_count_ (&nsync_mu_semaphore_wakes_);
+		ASSERT (futex (&f->i, FUTEX_WAKE_, 1, NULL, NULL, 0) >= 0);
+	}
 }
 
 NSYNC_CPP_END_
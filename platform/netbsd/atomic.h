@@ -58,6 +58,12 @@
    // A *_REL variant is available,
    // with the barrier semantics described above.
    void ATM_STORE (nsync_atomic_uint32_ *p, uint32_t value);
+
+   // Ensures that memory operations performed by the calling thread before
+   // the call appear to complete before those it performs after the call,
+   // as seen by other threads.  Unlike the barriers above, this orders a
+   // preceding store before a following load.
+   void ATM_FENCE (void);
  */
 
 #include "compiler.h"
@@ -112,6 +118,9 @@ static INLINE uint32_t atm_load_acq_u32_ (nsync_atomic_uint32_ *p) {
 #define ATM_STORE(p,v)     ATM_STORE_X_ ((p), (v), ;             , ;       )
 #define ATM_STORE_REL(p,v) ATM_STORE_X_ ((p), (v), ATM_ST_REL_ (), ;       )
 
+/*----*/
+#define ATM_FENCE() membar_sync ()
+
 NSYNC_CPP_END_
 
 #endif /*NSYNC_PLATFORM_NETBSD_ATOMIC_H_*/
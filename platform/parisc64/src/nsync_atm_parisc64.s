@@ -155,6 +155,20 @@ nsync_atm_load_acq_:
 	.EXIT
 	.PROCEND
 
+/* A barrier ordering all preceding memory operations before all following
+   ones:
+	void nsync_atm_fence_ (void) { } */
+	.align 4
+	.globl nsync_atm_fence_
+nsync_atm_fence_:
+	.PROC
+	.CALLINFO FRAME=0,NO_CALLS
+	.ENTRY
+	sync
+	bv,n %r0(%r2)
+	.EXIT
+	.PROCEND
+
 	.data
 	.align 4
 locks:
@@ -132,3 +132,14 @@ nsync_atm_store_rel_:
 	lwsync
 	stw     %r4,0(%r3)
 	blr
+
+/* A barrier ordering all preceding memory operations before all following
+   ones.  lwsync does not order a store before a following load, so sync is
+   used:
+	void nsync_atm_fence_ (void) { } */
+	.align	3
+	.global	nsync_atm_fence_
+	.type	nsync_atm_fence_, %function
+nsync_atm_fence_:
+	sync
+	blr
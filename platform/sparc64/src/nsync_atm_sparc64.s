@@ -108,3 +108,14 @@ nsync_atm_store_rel_:
 	membar	15
 	retl
 	st	%o1, [%o0]
+
+/* A barrier ordering all preceding memory operations before all following
+   ones:
+	void nsync_atm_fence_ (void) { } */
+	.align 4
+	.global nsync_atm_fence_
+	.type	nsync_atm_fence_, #function
+nsync_atm_fence_:
+	membar	15
+	retl
+	nop
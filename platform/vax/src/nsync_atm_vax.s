@@ -23,6 +23,7 @@
    guarantee isolation between the bits.  */
 	.data
 	.lcomm  locks,128
+	.lcomm  fence,4
 
 	.text
 
@@ -97,3 +98,16 @@ nsync_atm_store_rel_:
 3:
 	calls	$0, nsync_yield_
 	jmp   1b
+
+/* A barrier ordering all preceding memory operations before all following
+   ones, using the interlocked instructions on a bit reserved for the purpose:
+	void nsync_atm_fence_ (void) { } */
+	.align 1
+	.globl nsync_atm_fence_
+nsync_atm_fence_:
+	.word 0x0
+	bbssi $0, fence, 1f
+1:
+	bbcci $0, fence, 2f
+2:
+	ret
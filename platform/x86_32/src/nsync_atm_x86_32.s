@@ -67,3 +67,13 @@ nsync_atm_store_rel_:
 	movl	4(%eax), %eax
 	movl	%edx, (%eax)
 	ret
+
+/* Atomically, with acquire and release barrier semantics, and ordering
+   preceding stores before following loads,
+	void nsync_atm_fence_ (void) { }
+   A locked operation is used because mfence needs SSE2. */
+	.globl nsync_atm_fence_
+	.type	nsync_atm_fence_, @function
+nsync_atm_fence_:
+	lock orl	$0, (%esp)
+	ret
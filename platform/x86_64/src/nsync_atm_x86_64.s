@@ -59,3 +59,12 @@ nsync_atm_store_:
 nsync_atm_store_rel_:
 	movl	%esi, (%rdi)
 	ret
+
+/* Atomically, with acquire and release barrier semantics, and ordering
+   preceding stores before following loads,
+	void nsync_atm_fence_ (void) { } */
+	.globl nsync_atm_fence_
+	.type	nsync_atm_fence_, @function
+nsync_atm_fence_:
+	mfence
+	ret
@@ -20,8 +20,16 @@
 #include "nsync_cv.h"
 #include "nsync_note.h"
 #include "nsync_counter.h"
+#include "nsync_bcounter.h"
 #include "nsync_waiter.h"
 #include "nsync_once.h"
+#include "nsync_brmu.h"
+#include "nsync_cmu.h"
+#include "nsync_park.h"
+#include "nsync_waitset.h"
+#include "nsync_eventfd.h"
+#include "nsync_fd.h"
+#include "nsync_arena.h"
 #include "nsync_debug.h"
 
 #endif /*NSYNC_PUBLIC_NSYNC_H_*/
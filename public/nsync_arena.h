@@ -0,0 +1,56 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#ifndef NSYNC_PUBLIC_NSYNC_ARENA_H_
+#define NSYNC_PUBLIC_NSYNC_ARENA_H_
+
+#include <stddef.h>
+#include "nsync_cpp.h"
+
+NSYNC_CPP_START_
+
+/* nsync allocates the memory for its waiter structs, nsync_note objects and
+   nsync_counter objects in chunks, each holding many objects of one kind,
+   and keeps freed objects for reuse.  By default chunks come from malloc().
+
+   nsync_set_arena() makes nsync obtain chunks with (*alloc) (arg, size), which
+   should return size bytes, or NULL if none are available, and return them
+   with (*release) (arg, p, size), where p and size are those of the
+   allocation.  Embedders may use it to place nsync's objects in an arena of
+   their own.  It should be called before other threads use nsync; it affects
+   chunks obtained after the call, while earlier chunks are still returned to
+   the allocator that supplied them.  release may be NULL, in which case
+   chunks are never returned.  If alloc is NULL, malloc() is used again.
+
+   Waiter structs are never returned once allocated, since some platforms'
+   semaphores cannot be destroyed.  */
+void nsync_set_arena (void *(*alloc) (void *arg, size_t size),
+		      void (*release) (void *arg, void *p, size_t size), void *arg);
+
+/* Set the number of bytes of free objects of each kind that nsync retains
+   before it returns wholly free chunks to the allocator.  The default is
+   65536.  May be called at any time.  */
+void nsync_set_free_high_water (size_t bytes);
+
+/* Give the calling thread the waiter structs it needs to block in nsync
+   calls, so that its first blocking calls need not allocate them.  Calling
+   it is optional; a thread that starts by waiting on a contended lock or
+   condition variable, or that must not allocate once running, may call it
+   early to move that cost elsewhere.  The structs are recycled when the
+   thread exits.  */
+void nsync_thread_prewarm (void);
+
+NSYNC_CPP_END_
+
+#endif /*NSYNC_PUBLIC_NSYNC_ARENA_H_*/
@@ -0,0 +1,81 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#ifndef NSYNC_PUBLIC_NSYNC_BCOUNTER_H_
+#define NSYNC_PUBLIC_NSYNC_BCOUNTER_H_
+
+#include <inttypes.h>
+#include "nsync_cpp.h"
+#include "nsync_time.h"
+#include "nsync_waiter.h"
+
+NSYNC_CPP_START_
+
+/* An nsync_bcounter ("bounded counter") represents an unsigned integer that
+   can count up and down, and wake waiters when it drops to at most a
+   threshold chosen by each waiter.  Unlike an nsync_counter, it may be
+   incremented at any time, so it can bound the amount of work in flight.
+   Waiters are kept in order of threshold, and a decrement wakes only those
+   whose thresholds it crosses.
+
+   Example: allow at most 100 requests in flight.
+	nsync_bcounter in_flight = nsync_bcounter_new (0);
+	...
+	// before issuing a request
+	while (nsync_bcounter_add (in_flight, 1) > 100) {
+		nsync_bcounter_add (in_flight, -1);
+		nsync_bcounter_wait (in_flight, 99, nsync_time_no_deadline);
+	}
+	...
+	// when a request completes
+	nsync_bcounter_add (in_flight, -1);
+   */
+typedef struct nsync_bcounter_s_ *nsync_bcounter;
+
+/* Return a freshly allocated nsync_bcounter with the specified value, or NULL
+   if an nsync_bcounter cannot be created.  Any non-NULL returned value should
+   be passed to nsync_bcounter_free() when no longer needed.  */
+nsync_bcounter nsync_bcounter_new (uint32_t value);
+
+/* Free resources associated with b.  Requires that b was allocated by
+   nsync_bcounter_new(), and that no thread is in, or will start, any
+   operation on b.  */
+void nsync_bcounter_free (nsync_bcounter b);
+
+/* Add delta to b, and return its new value.  It is a checkable runtime error
+   to decrement b below 0, or to increment it beyond 2**32-1.  */
+uint32_t nsync_bcounter_add (nsync_bcounter b, int32_t delta);
+
+/* Return the current value of b.  */
+uint32_t nsync_bcounter_value (nsync_bcounter b);
+
+/* Wait until the value of b is at most threshold, or until abs_deadline, then
+   return the value of b.  The value may have risen again by the time the
+   call returns.  If abs_deadline==nsync_time_no_deadline, the deadline is
+   far in the future. */
+uint32_t nsync_bcounter_wait (nsync_bcounter b, uint32_t threshold, nsync_time abs_deadline);
+
+/* To wait for a bounded counter with nsync_wait_n(), set the v field of a
+   struct nsync_waitable_s to point to a struct nsync_bcounter_wait_s, and
+   its funcs field to &nsync_bcounter_waitable_funcs.  The object is ready
+   once the value of b has been at most threshold.  */
+struct nsync_bcounter_wait_s {
+	nsync_bcounter b;
+	uint32_t threshold;
+};
+extern const struct nsync_waitable_funcs_s nsync_bcounter_waitable_funcs;
+
+NSYNC_CPP_END_
+
+#endif /*NSYNC_PUBLIC_NSYNC_BCOUNTER_H_*/
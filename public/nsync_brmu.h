@@ -0,0 +1,135 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#ifndef NSYNC_PUBLIC_NSYNC_BRMU_H_
+#define NSYNC_PUBLIC_NSYNC_BRMU_H_
+
+#include "nsync_cpp.h"
+#include "nsync_atomic.h"
+#include "nsync_mu.h"
+#include "nsync_cv.h"
+#include "nsync_time.h"
+
+NSYNC_CPP_START_
+
+struct nsync_note_s_; /* forward declaration for an nsync_note */
+
+/* An nsync_brmu is a "big reader" lock: a reader/writer lock for data that is
+   read far more often than it is written.  If initialized to all zeroes, it is
+   valid and unlocked.
+
+   Every acquisition of an nsync_mu in read mode modifies the word in the
+   nsync_mu, so on machines with many processors the cache line holding that
+   word moves between the readers, limiting read throughput even when no
+   writer is present.  An nsync_brmu instead records each reader in one of
+   several slots, chosen per thread, so that readers running on different
+   processors usually write to different cache lines.  The cost is borne by
+   writers, which must wait for every slot to drain, and by space: an
+   nsync_brmu occupies a few kilobytes.  Use an nsync_mu unless
+   profiling shows that readers contend on it.
+
+   The rules for holding an nsync_brmu are those of nsync_mu: a thread that
+   acquires it should release it, it may not be released by another thread,
+   and it may not be reacquired by a thread that holds it in any mode.
+
+   nsync_brmu_wait() and nsync_brmu_wait_with_deadline() provide conditional
+   critical sections, as nsync_mu_wait() does for nsync_mu, and
+   nsync_brmu_cv_wait() and nsync_brmu_cv_wait_with_deadline() allow an
+   nsync_cv to be used with an nsync_brmu.  Either may be called with the
+   lock held in read or write mode; they return with it held in the same mode.
+
+   Example usage:
+	static struct config {
+		nsync_brmu mu; // protects fields below
+		int limit;
+	} cfg;
+	...
+	nsync_brmu_rlock (&cfg.mu);
+	l = cfg.limit;
+	nsync_brmu_runlock (&cfg.mu);
+   */
+#define NSYNC_BRMU_SLOTS_ 32 /* number of reader slots; internal use only */
+typedef struct nsync_brmu_s_ {
+	nsync_mu mu;    /* internal use only */
+	nsync_atomic_uint32_ writer; /* internal use only */
+	nsync_mu drain_mu; /* internal use only */
+	nsync_cv drain_cv; /* internal use only */
+	char pad[64];   /* internal use only */
+	struct {
+		nsync_atomic_uint32_ readers; /* internal use only */
+		char pad[64 - sizeof (nsync_atomic_uint32_)]; /* internal use only */
+	} slot[NSYNC_BRMU_SLOTS_]; /* internal use only */
+} nsync_brmu;
+
+/* Initialize *b.  Equivalent to setting *b to all zeroes. */
+void nsync_brmu_init (nsync_brmu *b);
+
+/* Block until *b is free and then acquire it in writer mode.
+   Requires that the calling thread not already hold *b in any mode.  */
+void nsync_brmu_lock (nsync_brmu *b);
+
+/* Unlock *b, which must have been acquired in write mode by the calling
+   thread, and wake waiters, if appropriate.  */
+void nsync_brmu_unlock (nsync_brmu *b);
+
+/* Block until *b can be acquired in reader mode and then acquire it.
+   Requires that the calling thread not already hold *b in any mode. */
+void nsync_brmu_rlock (nsync_brmu *b);
+
+/* Unlock *b, which must have been acquired in read mode by the calling
+   thread, and wake waiters, if appropriate.  */
+void nsync_brmu_runlock (nsync_brmu *b);
+
+/* May abort if *b is not held in write mode by the calling thread. */
+void nsync_brmu_assert_held (const nsync_brmu *b);
+
+/* Return whether *b is held in read mode.
+   Requires that the calling thread holds *b in some mode. */
+int nsync_brmu_is_reader (const nsync_brmu *b);
+
+/* Return when (*condition) (condition_arg) is true.  Perhaps unlock and relock
+   *b while blocked waiting for the condition to become true.
+   Requires that *b be held on entry, in either mode, and returns with *b held
+   in that mode.  The requirements on *condition and *condition_arg_eq are
+   those of nsync_mu_wait().  Conditions are reevaluated when a writer releases
+   *b. */
+void nsync_brmu_wait (nsync_brmu *b, int (*condition) (const void *condition_arg),
+		      const void *condition_arg,
+		      int (*condition_arg_eq) (const void *a, const void *b));
+
+/* As nsync_brmu_wait(), but return early if abs_deadline expires or
+   *cancel_note is notified.  Return 0 iff the (*condition) (condition_arg) is
+   true on return, and otherwise either ETIMEDOUT or ECANCELED.  See
+   nsync_mu_wait_with_deadline().  */
+int nsync_brmu_wait_with_deadline (nsync_brmu *b,
+				   int (*condition) (const void *condition_arg),
+				   const void *condition_arg,
+				   int (*condition_arg_eq) (const void *a, const void *b),
+				   nsync_time abs_deadline,
+				   struct nsync_note_s_ *cancel_note);
+
+/* Atomically release *b and block the calling thread on *cv, as
+   nsync_cv_wait() does for an nsync_mu.  Requires that *b be held on entry,
+   in either mode, and returns with *b held in that mode.  */
+void nsync_brmu_cv_wait (nsync_cv *cv, nsync_brmu *b);
+
+/* As nsync_brmu_cv_wait(), but with a deadline and cancellation note, with
+   the results of nsync_cv_wait_with_deadline().  */
+int nsync_brmu_cv_wait_with_deadline (nsync_cv *cv, nsync_brmu *b,
+				      nsync_time abs_deadline,
+				      struct nsync_note_s_ *cancel_note);
+
+NSYNC_CPP_END_
+
+#endif /*NSYNC_PUBLIC_NSYNC_BRMU_H_*/
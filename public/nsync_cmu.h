@@ -0,0 +1,145 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#ifndef NSYNC_PUBLIC_NSYNC_CMU_H_
+#define NSYNC_PUBLIC_NSYNC_CMU_H_
+
+#include "nsync_cpp.h"
+#include "nsync_atomic.h"
+#include "nsync_time.h"
+
+NSYNC_CPP_START_
+
+struct nsync_note_s_; /* forward declaration for an nsync_note */
+
+/* An nsync_cmu is a compact reader/writer lock: it occupies a single 32-bit
+   word, where an nsync_mu also holds a pointer to its queue of waiters.  It
+   suits locks embedded in very many objects, such as hash table entries,
+   few of which are ever contended.  Threads that block on an nsync_cmu
+   are queued in a table shared by all nsync_cmu and nsync_ccv objects and
+   keyed by address, so contended acquisitions are somewhat slower than
+   with nsync_mu.  If initialized to all zeroes, it is valid and unlocked.
+
+   The rules for holding an nsync_cmu are those of nsync_mu: it may be held
+   by one thread in write mode or by many in read mode, a thread that
+   acquires it should release it, it may not be released by another thread,
+   and it may not be reacquired by a thread that holds it in any mode.  As
+   with nsync_mu, a thread that has not yet blocked does not acquire in read
+   mode while a writer is blocked, so that writers are not starved.
+   nsync_cmu has no conditional critical sections; use an nsync_ccv.
+
+   Example usage:
+	struct entry {
+		nsync_cmu mu; // protects value
+		int value;
+	};
+	...
+	nsync_cmu_lock (&e->mu);
+	e->value++;
+	nsync_cmu_unlock (&e->mu);
+   */
+typedef struct nsync_cmu_s_ {
+	nsync_atomic_uint32_ word; /* internal use only */
+} nsync_cmu;
+
+/* An nsync_cmu should be zeroed to initialize, which can be accomplished by
+   initializing with static initializer NSYNC_CMU_INIT, or by setting the
+   entire structure to all zeroes, or using nsync_cmu_init().  */
+#define NSYNC_CMU_INIT { NSYNC_ATOMIC_UINT32_INIT_ }
+void nsync_cmu_init (nsync_cmu *mu);
+
+/* Block until *mu is free and then acquire it in writer mode.
+   Requires that the calling thread not already hold *mu in any mode.  */
+void nsync_cmu_lock (nsync_cmu *mu);
+
+/* Unlock *mu, which must have been acquired in write mode by the calling
+   thread, and wake waiters, if appropriate.  */
+void nsync_cmu_unlock (nsync_cmu *mu);
+
+/* Attempt to acquire *mu in writer mode without blocking, and return non-zero
+   iff successful.  Return non-zero with high probability if *mu was free
+   on entry.  */
+int nsync_cmu_trylock (nsync_cmu *mu);
+
+/* Block until *mu can be acquired in reader mode and then acquire it.
+   Requires that the calling thread not already hold *mu in any mode.  */
+void nsync_cmu_rlock (nsync_cmu *mu);
+
+/* Unlock *mu, which must have been acquired in read mode by the calling
+   thread, and wake waiters, if appropriate.  */
+void nsync_cmu_runlock (nsync_cmu *mu);
+
+/* Attempt to acquire *mu in reader mode without blocking, and return non-zero
+   iff successful.  Return non-zero with high probability if *mu was free on
+   entry.  It may fail to acquire if a writer is waiting, to avoid
+   starvation.  */
+int nsync_cmu_rtrylock (nsync_cmu *mu);
+
+/* May abort if *mu is not held in write mode by the calling thread. */
+void nsync_cmu_assert_held (const nsync_cmu *mu);
+
+/* May abort if *mu is not held in read or write mode
+   by the calling thread. */
+void nsync_cmu_rassert_held (const nsync_cmu *mu);
+
+/* Return whether *mu is held in read mode.
+   Requires that the calling thread holds *mu in some mode. */
+int nsync_cmu_is_reader (const nsync_cmu *mu);
+
+/* An nsync_ccv is a condition variable for use with an nsync_cmu, occupying
+   a single 32-bit word.  It is used as an nsync_cv is used with an nsync_mu,
+   and wakeups are similarly imprecise, so waits must be in a loop that tests
+   the predicate anew; see nsync_cv.h.  If initialized to all zeroes, it is
+   valid.
+
+   Example usage:
+	nsync_cmu_lock (&e->mu);
+	while (e->value == 0) {
+		nsync_ccv_wait (&e->cv, &e->mu);
+	}
+	nsync_cmu_unlock (&e->mu);
+   */
+typedef struct nsync_ccv_s_ {
+	nsync_atomic_uint32_ word; /* internal use only */
+} nsync_ccv;
+
+/* An nsync_ccv should be zeroed to initialize, which can be accomplished by
+   initializing with static initializer NSYNC_CCV_INIT, or by setting the
+   entire struct to 0, or using nsync_ccv_init().  */
+#define NSYNC_CCV_INIT { NSYNC_ATOMIC_UINT32_INIT_ }
+void nsync_ccv_init (nsync_ccv *cv);
+
+/* Wake at least one thread if any are currently blocked on *cv. */
+void nsync_ccv_signal (nsync_ccv *cv);
+
+/* Wake all threads currently blocked on *cv. */
+void nsync_ccv_broadcast (nsync_ccv *cv);
+
+/* Atomically release *mu (which must be held on entry, in either mode) and
+   block the caller on *cv.  Wait until awakened by a call to
+   nsync_ccv_signal() or nsync_ccv_broadcast(), or a spurious wakeup; then
+   reacquire *mu in the mode in which it was held, and return.  */
+void nsync_ccv_wait (nsync_ccv *cv, nsync_cmu *mu);
+
+/* As nsync_ccv_wait(), but return also when the time reaches abs_deadline
+   or cancel_note is notified.  In all cases, reacquire *mu and return the
+   reason for the call returned (0, ETIMEDOUT, or ECANCELED), as
+   nsync_cv_wait_with_deadline() does.  */
+int nsync_ccv_wait_with_deadline (nsync_ccv *cv, nsync_cmu *mu,
+				  nsync_time abs_deadline,
+				  struct nsync_note_s_ *cancel_note);
+
+NSYNC_CPP_END_
+
+#endif /*NSYNC_PUBLIC_NSYNC_CMU_H_*/
@@ -36,9 +36,17 @@ typedef struct nsync_counter_s_ *nsync_counter;
    longer needed.  */
 nsync_counter nsync_counter_new (uint32_t value);
 
+/* As nsync_counter_new(), but return a counter that spreads its value over
+   several cache lines, so that many threads can add to it concurrently
+   without contending for one.  Use it to track the completion of very many
+   small tasks.  Waits are as for any nsync_counter, but
+   nsync_counter_add() returns the exact new value only when that is zero;
+   otherwise it returns some non-zero value no larger.  */
+nsync_counter nsync_counter_new_sharded (uint32_t value);
+
 /* Free resources associated with c.  Requires that c was allocated by
-   nsync_counter_new(), and no concurrent or future operations are applied to
-   c.  */
+   nsync_counter_new() or nsync_counter_new_sharded(), and no concurrent or
+   future operations are applied to c.  */
 void nsync_counter_free (nsync_counter c);
 
 /* Add delta to c, and return its new value.  It is a checkable runtime error
@@ -0,0 +1,81 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#ifndef NSYNC_PUBLIC_NSYNC_EVENTFD_H_
+#define NSYNC_PUBLIC_NSYNC_EVENTFD_H_
+
+#include "nsync_cpp.h"
+#include "nsync_waiter.h"
+
+NSYNC_CPP_START_
+
+/* An nsync_eventfd binds a waitable (see nsync_waiter.h) to a Linux eventfd,
+   which becomes readable when the object is ready, so that an event loop
+   built on epoll, poll, or select can wait for nsync_notes, nsync_counters,
+   and nsync_cvs alongside its sockets, without a helper thread.  The
+   eventfd is queued on the object as a thread in nsync_wait_n() would be,
+   and the thread that readies the object writes to it.
+
+   A note or counter keeps the descriptor readable for as long as it is
+   ready.  A condition variable makes it readable when signalled; the
+   signal is consumed by nsync_eventfd_ready(), which should be called with
+   the condition variable's lock held.  A note that expires is notified by a
+   timer thread shared by the process, so its descriptor becomes readable
+   without the note being examined.  On platforms where nsync cannot start
+   such a thread, expiry is noticed only when the note is examined, so a
+   portable loop that waits for a note with an expiry should bound its wait
+   by nsync_note_expiry().
+
+   Example:
+	struct nsync_waitable_s w = { cancel_note, &nsync_note_waitable_funcs };
+	nsync_eventfd e = nsync_eventfd_new (&w);
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = e;
+	epoll_ctl (epfd, EPOLL_CTL_ADD, nsync_eventfd_fd (e), &ev);
+	...
+	// when epoll_wait() reports the descriptor readable:
+	if (nsync_eventfd_ready (e)) {
+		// cancel_note has been notified.
+	}
+	...
+	epoll_ctl (epfd, EPOLL_CTL_DEL, nsync_eventfd_fd (e), NULL);
+	nsync_eventfd_free (e);
+   */
+typedef struct nsync_eventfd_s_ *nsync_eventfd;
+
+/* Return a freshly allocated nsync_eventfd bound to the object described by
+   *w, or NULL if one cannot be created, as on platforms without eventfd.
+   *w is copied; the object it points to must remain valid until the
+   nsync_eventfd is freed.  The descriptor is non-blocking and close-on-exec,
+   and is readable at once if the object is already ready.  */
+nsync_eventfd nsync_eventfd_new (const struct nsync_waitable_s *w);
+
+/* Return the file descriptor of e.  It is closed by nsync_eventfd_free(). */
+int nsync_eventfd_fd (nsync_eventfd e);
+
+/* Return whether e's object has become ready since e was created or
+   nsync_eventfd_ready() last returned non-zero, or is ready now.  If the
+   object is not now ready, as after a condition variable's signal has been
+   consumed, the descriptor is made unreadable until the object is next
+   ready.  Requires that calls on e are not concurrent.  */
+int nsync_eventfd_ready (nsync_eventfd e);
+
+/* Dequeue e from its object, close its descriptor, and free e.  Requires
+   that no concurrent or future operations are applied to e.  */
+void nsync_eventfd_free (nsync_eventfd e);
+
+NSYNC_CPP_END_
+
+#endif /*NSYNC_PUBLIC_NSYNC_EVENTFD_H_*/
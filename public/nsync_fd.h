@@ -0,0 +1,73 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#ifndef NSYNC_PUBLIC_NSYNC_FD_H_
+#define NSYNC_PUBLIC_NSYNC_FD_H_
+
+#include "nsync_cpp.h"
+#include "nsync_waiter.h"
+
+NSYNC_CPP_START_
+
+/* An nsync_fd makes a file descriptor's readiness for I/O waitable with
+   nsync_wait_n() or an nsync_waitset, so that a thread can wait in one call
+   for "socket readable, or cancel note notified, or deadline".  The object
+   is ready when the descriptor is readable or writable, as requested, or
+   has an error or hang-up pending.
+
+   Waiting threads are queued on the nsync_fd as on any other waitable, and
+   are woken through the semaphore that nsync_wait_n() shares among its
+   objects.  A single thread per process, started when the first nsync_fd is
+   created, watches every descriptor being waited for with epoll.  Where
+   epoll is unavailable, nsync_fd_new() returns NULL.
+
+   Example:
+	nsync_fd f = nsync_fd_new (sock, NSYNC_FD_READABLE);
+	struct nsync_waitable_s w[2] = {
+		{ NULL, &nsync_fd_waitable_funcs },
+		{ NULL, &nsync_note_waitable_funcs }
+	};
+	struct nsync_waitable_s *pw[2] = { &w[0], &w[1] };
+	w[0].v = f;
+	w[1].v = cancel_note;
+	switch (nsync_wait_n (NULL, NULL, NULL, abs_deadline, 2, pw)) {
+	case 0:  // sock is readable
+	case 1:  // cancel_note was notified
+	case 2:  // abs_deadline passed
+	}
+	...
+	nsync_fd_free (f);
+   */
+typedef struct nsync_fd_s_ *nsync_fd;
+
+/* Values for the events argument of nsync_fd_new(); they may be or-ed. */
+#define NSYNC_FD_READABLE 0x1
+#define NSYNC_FD_WRITABLE 0x2
+
+/* Return a freshly allocated nsync_fd that is ready when file descriptor fd
+   has any of the given events pending, or NULL if one cannot be created.
+   fd must remain open until the nsync_fd is freed, and at most one nsync_fd
+   may exist for a given fd at a time.  */
+nsync_fd nsync_fd_new (int fd, int events);
+
+/* Free resources associated with f.  Requires that no thread is waiting on
+   f, and that no concurrent or future operations are applied to f.  */
+void nsync_fd_free (nsync_fd f);
+
+/* The "struct nsync_waitable_s" functions for an nsync_fd. */
+extern const struct nsync_waitable_funcs_s nsync_fd_waitable_funcs;
+
+NSYNC_CPP_END_
+
+#endif /*NSYNC_PUBLIC_NSYNC_FD_H_*/
@@ -18,10 +18,12 @@
 #include <inttypes.h>
 #include "nsync_cpp.h"
 #include "nsync_atomic.h"
+#include "nsync_time.h"
 
 NSYNC_CPP_START_
 
 struct nsync_dll_element_s_;
+struct nsync_note_s_; /* forward declaration for an nsync_note */
 
 /* An nsync_mu is a lock.  If initialized to all zeroes, it is valid and unlocked.
 
@@ -61,13 +63,14 @@ struct nsync_dll_element_s_;
 	nsync_mu_unlock (&p.mu); */
 typedef struct nsync_mu_s_ {
 	nsync_atomic_uint32_ word; /* internal use only */
+	nsync_atomic_uint32_ version; /* internal use only */
 	struct nsync_dll_element_s_ *waiters; /* internal use only */
 } nsync_mu;
 
 /* An nsync_mu should be zeroed to initialize, which can be accomplished by
    initializing with static initializer NSYNC_MU_INIT, or by setting the entire
    structure to all zeroes, or using nsync_mu_init().  */
-#define NSYNC_MU_INIT { NSYNC_ATOMIC_UINT32_INIT_, 0 }
+#define NSYNC_MU_INIT { NSYNC_ATOMIC_UINT32_INIT_, NSYNC_ATOMIC_UINT32_INIT_, 0 }
 void nsync_mu_init (nsync_mu *mu);
 
 /* Block until *mu is free and then acquire it in writer mode.
@@ -87,6 +90,19 @@ int nsync_mu_trylock (nsync_mu *mu);
    Requires that the calling thread not already hold *mu in any mode. */
 void nsync_mu_rlock (nsync_mu *mu);
 
+/* As nsync_mu_lock(), but give up if abs_deadline expires or *cancel_note is
+   notified first.  Return 0 iff *mu was acquired in write mode, and otherwise
+   ETIMEDOUT or ECANCELED, in which case *mu is not held.  A cancel_note of NULL
+   means no cancellation note; nsync_time_no_deadline means no deadline.  */
+int nsync_mu_lock_with_deadline (nsync_mu *mu, nsync_time abs_deadline,
+				 struct nsync_note_s_ *cancel_note);
+
+/* As nsync_mu_rlock(), but give up if abs_deadline expires or *cancel_note is
+   notified first.  Return 0 iff *mu was acquired in read mode, and otherwise
+   ETIMEDOUT or ECANCELED, in which case *mu is not held.  */
+int nsync_mu_rlock_with_deadline (nsync_mu *mu, nsync_time abs_deadline,
+				  struct nsync_note_s_ *cancel_note);
+
 /* Unlock *mu, which must have been acquired in read mode by the calling
    thread, and wake waiters, if appropriate.  */
 void nsync_mu_runlock (nsync_mu *mu);
@@ -97,6 +113,54 @@ void nsync_mu_runlock (nsync_mu *mu);
    */
 int nsync_mu_rtrylock (nsync_mu *mu);
 
+/* Convert the write lock on *mu held by the calling thread into a read lock,
+   without letting any writer acquire *mu in between, and wake threads
+   waiting to acquire *mu in read mode, if appropriate.  The caller must later
+   release *mu with nsync_mu_runlock().  */
+void nsync_mu_downgrade (nsync_mu *mu);
+
+/* Attempt to convert the read lock on *mu held by the calling thread into a
+   write lock, without blocking.  Return non-zero iff successful, in which case
+   the caller must later release *mu with nsync_mu_unlock().  Fails if other
+   threads hold *mu in read mode; on failure, the caller still holds its read
+   lock.  Because no other thread can have written the data protected by *mu
+   in between, a successful upgrade need not be followed by a recheck of what
+   was read.  */
+int nsync_mu_try_upgrade (nsync_mu *mu);
+
+/* Call (*fn) (arg) with *mu held in write mode, and return once the call has
+   completed.  The call may be made by another thread that holds *mu, which
+   runs a batch of such calls before releasing *mu once; this keeps *mu and
+   the data it protects in one processor's cache when many threads contend
+   for small critical sections.  Threads using nsync_mu_run_locked() may share
+   *mu with threads using nsync_mu_lock() and the other operations on *mu.
+   Requires that the calling thread not hold *mu in any mode.  (*fn) must not
+   block, acquire or release *mu, or rely on the identity of the calling
+   thread.  */
+void nsync_mu_run_locked (nsync_mu *mu, void (*fn) (void *arg), void *arg);
+
+/* Begin an optimistic read of the data protected by *mu, and return a version
+   to pass to nsync_mu_read_validate().  Waits while *mu is held in write mode,
+   but otherwise performs no stores, so readers do not contend with one
+   another.  The reads that follow may race with a writer and see
+   inconsistent values; they should copy what they need, must not act on it
+   (for example by following pointers into structures that a writer may free),
+   and must discard it unless nsync_mu_read_validate() then returns non-zero.
+   Example:
+	do {
+		v = nsync_mu_read_begin (&cfg.mu);
+		limit = cfg.limit;
+	} while (!nsync_mu_read_validate (&cfg.mu, v));
+   The calling thread may not hold *mu in write mode.  Writers need do
+   nothing special; every release of the write lock invalidates earlier
+   versions.  */
+uint32_t nsync_mu_read_begin (const nsync_mu *mu);
+
+/* Return non-zero iff no thread has held *mu in write mode since the call to
+   nsync_mu_read_begin() that returned version, so that the values read since
+   that call are consistent.  */
+int nsync_mu_read_validate (const nsync_mu *mu, uint32_t version);
+
 /* May abort if *mu is not held in write mode by the calling thread. */
 void nsync_mu_assert_held (const nsync_mu *mu);
 
@@ -108,6 +172,8 @@ void nsync_mu_rassert_held (const nsync_mu *mu);
    Requires that the calling thread holds *mu in some mode. */
 int nsync_mu_is_reader (const nsync_mu *mu);
 
+NSYNC_MU_CPP_OVERLOAD_
+
 NSYNC_CPP_END_
 
 #endif /*NSYNC_PUBLIC_NSYNC_MU_H_*/
@@ -122,6 +122,46 @@ int nsync_mu_wait_with_deadline (nsync_mu *mu,
    - when performance is significantly improved by using this call. */
 void nsync_mu_unlock_without_wakeup (nsync_mu *mu);
 
+/* Change hints.  A client may divide the state protected by a mutex into up
+   to 32 parts, named by the bits of a mask, and declare which parts each wait
+   condition reads and which parts each critical section may have written.
+   Unlocks then skip the evaluation of conditions that cannot have changed,
+   which matters when many threads wait on a busy mutex.  The meaning of the
+   bits is up to the client; a mask of all ones is always safe.
+
+   nsync_mu_wait_with_deadline_and_mask() is nsync_mu_wait_with_deadline() for
+   a condition that depends only on the parts of the state named in "mask".
+
+   nsync_mu_unlock_with_mask() unlocks *mu, which must be held in write mode,
+   and wakes waiters, if appropriate, declaring that the critical section
+   modified only the parts of the state named in "changed".  The
+   implementation may then skip the evaluation of conditions whose masks have
+   no bits in common with "changed".  nsync_mu_unlock() is equivalent to
+   nsync_mu_unlock_with_mask (mu, ~(uint32_t) 0), and
+   nsync_mu_unlock_without_wakeup() to nsync_mu_unlock_with_mask (mu, 0).
+
+   Example:
+      #define QUEUE_ITEMS ((uint32_t) 1)  // "count" below
+      #define QUEUE_STATS ((uint32_t) 2)  // "gets" below
+      ...
+      nsync_mu_lock (&q->mu);
+      nsync_mu_wait_with_deadline_and_mask (&q->mu, &queue_non_empty, q, NULL,
+                                            QUEUE_ITEMS, nsync_time_no_deadline,
+                                            NULL);
+      ...
+      nsync_mu_lock (&q->mu);
+      q->gets++;
+      nsync_mu_unlock_with_mask (&q->mu, QUEUE_STATS); // wakes no getter
+   */
+int nsync_mu_wait_with_deadline_and_mask (nsync_mu *mu,
+					  int (*condition) (const void *condition_arg),
+					  const void *condition_arg,
+					  int (*condition_arg_eq) (const void *a, const void *b),
+					  uint32_t mask,
+					  nsync_time abs_deadline,
+					  struct nsync_note_s_ *cancel_note);
+void nsync_mu_unlock_with_mask (nsync_mu *mu, uint32_t changed);
+
 NSYNC_MU_WAIT_CPP_OVERLOAD_
 NSYNC_CPP_END_
 
@@ -32,7 +32,9 @@ typedef struct nsync_note_s_ *nsync_note;
 
    If parent!=NULL, the allocated nsync_note's parent will be parent.  The
    newaly allocated note will be automatically notified at abs_deadline, and is
-   notified at initialization if abs_deadline==nsync_zero_time.
+   notified at initialization if abs_deadline==nsync_zero_time.  Where
+   threads are available, a timer thread shared by the process notifies it,
+   and its descendants, at abs_deadline even if no thread is waiting for it.
 
    nsync_notes should be passed to nsync_note_free() when no longer needed.  */
 nsync_note nsync_note_new (nsync_note parent, nsync_time abs_deadline);
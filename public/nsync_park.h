@@ -0,0 +1,85 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#ifndef NSYNC_PUBLIC_NSYNC_PARK_H_
+#define NSYNC_PUBLIC_NSYNC_PARK_H_
+
+#include "nsync_cpp.h"
+#include "nsync_time.h"
+
+NSYNC_CPP_START_
+
+struct nsync_note_s_; /* forward declaration for an nsync_note */
+
+/* nsync_park() and nsync_unpark_*() allow a thread to block until woken by
+   another thread, using any address as the key.  They are for building
+   synchronization objects, such as lock-free queues or event counts, whose
+   state lives in the client's own memory; nsync_cmu and nsync_ccv are built
+   on them.  The address is used only as a key, and is never dereferenced
+   by nsync, but it must not be the address of an nsync_cmu or nsync_ccv.
+
+   To avoid lost wakeups, nsync_park() calls a validation function with the
+   queue for the address locked, and blocks only if it returns non-zero.  A
+   thread that changes the state and then calls nsync_unpark_*() either
+   precedes the validation, which can then see the change, or finds the
+   parked thread and wakes it.
+
+   Example: waiting for a flag to be set.
+	static int flag_is_clear (const void *addr, void *arg) {
+		return (load_acquire ((int *) arg) == 0);
+	}
+	...
+	// waiter
+	while (load_acquire (&flag) == 0) {
+		nsync_park (&flag, &flag_is_clear, &flag, nsync_time_no_deadline, NULL);
+	}
+	...
+	// waker
+	store_release (&flag, 1);
+	nsync_unpark_all (&flag);
+
+   Wakeups may be spurious: a thread may return from nsync_park() with 0 when
+   woken by nsync_unpark_*() calls made for an earlier state, so callers
+   should test their state in a loop, as above.  */
+
+/* Block the calling thread on addr until woken by nsync_unpark_*() on addr,
+   the time reaches abs_deadline, or cancel_note is notified.  If validate is
+   non-NULL, first call (*validate) (addr, validate_arg), and return without
+   blocking if it returns zero.  validate is called while nsync holds a
+   spinlock that is shared with other addresses, so it should be brief, and
+   it must not block or call nsync_park() or nsync_unpark_*().
+
+   Return 0 if woken by nsync_unpark_*(), EAGAIN if validate returned zero,
+   ETIMEDOUT if abs_deadline expired, or ECANCELED if cancel_note was
+   notified.  Use abs_deadline==nsync_time_no_deadline for no deadline, and
+   cancel_note==NULL for no cancellation.  */
+int nsync_park (const void *addr, int (*validate) (const void *addr, void *validate_arg),
+		void *validate_arg, nsync_time abs_deadline,
+		struct nsync_note_s_ *cancel_note);
+
+/* Wake the thread that has been blocked longest in nsync_park() on addr,
+   if any.  Return the number of threads woken.  */
+int nsync_unpark_one (const void *addr);
+
+/* Wake the n threads that have been blocked longest in nsync_park() on addr,
+   or all of them if there are fewer.  Return the number of threads woken.  */
+int nsync_unpark_n (const void *addr, int n);
+
+/* Wake all threads blocked in nsync_park() on addr.  Return the number of
+   threads woken.  */
+int nsync_unpark_all (const void *addr);
+
+NSYNC_CPP_END_
+
+#endif /*NSYNC_PUBLIC_NSYNC_PARK_H_*/
@@ -130,6 +130,17 @@ nsync_cpp_time_point_ nsync_to_time_point_ (nsync_time);
 				nsync_from_time_point_ (abs_deadline), \
 				cancel_note)); \
 	}
+#define NSYNC_MU_CPP_OVERLOAD_ \
+	static inline int nsync_mu_lock_with_deadline (nsync_mu *mu, \
+		nsync_cpp_time_point_ abs_deadline, struct nsync_note_s_ *cancel_note) { \
+		return (nsync_mu_lock_with_deadline (mu, nsync_from_time_point_ (abs_deadline), \
+						     cancel_note)); \
+	} \
+	static inline int nsync_mu_rlock_with_deadline (nsync_mu *mu, \
+		nsync_cpp_time_point_ abs_deadline, struct nsync_note_s_ *cancel_note) { \
+		return (nsync_mu_rlock_with_deadline (mu, nsync_from_time_point_ (abs_deadline), \
+						      cancel_note)); \
+	}
 #define NSYNC_MU_WAIT_CPP_OVERLOAD_ \
 	static inline int nsync_mu_wait_with_deadline (nsync_mu *mu, \
 		int (*condition) (const void *condition_arg), const void *condition_arg, \
@@ -139,6 +150,15 @@ nsync_cpp_time_point_ nsync_to_time_point_ (nsync_time);
 						     condition_arg_eq, \
 						     nsync_from_time_point_ (abs_deadline), \
 						     cancel_note)); \
+	} \
+	static inline int nsync_mu_wait_with_deadline_and_mask (nsync_mu *mu, \
+		int (*condition) (const void *condition_arg), const void *condition_arg, \
+		int (*condition_arg_eq) (const void *a, const void *b), uint32_t mask, \
+		nsync_cpp_time_point_ abs_deadline, struct nsync_note_s_ *cancel_note) { \
+		return (nsync_mu_wait_with_deadline_and_mask (mu, condition, condition_arg, \
+							      condition_arg_eq, mask, \
+							      nsync_from_time_point_ (abs_deadline), \
+							      cancel_note)); \
 	}
 #define NSYNC_NOTE_CPP_OVERLOAD_ \
 	static inline nsync_note nsync_note_new (nsync_note parent, \
@@ -176,6 +196,7 @@ NSYNC_CPP_END_
 #if !defined(NSYNC_COUNTER_CPP_OVERLOAD_)
 #define NSYNC_COUNTER_CPP_OVERLOAD_
 #define NSYNC_CV_CPP_OVERLOAD_
+#define NSYNC_MU_CPP_OVERLOAD_
 #define NSYNC_MU_WAIT_CPP_OVERLOAD_
 #define NSYNC_NOTE_CPP_OVERLOAD_
 #define NSYNC_WAITER_CPP_OVERLOAD_
@@ -0,0 +1,97 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+#ifndef NSYNC_PUBLIC_NSYNC_WAITSET_H_
+#define NSYNC_PUBLIC_NSYNC_WAITSET_H_
+
+#include "nsync_cpp.h"
+#include "nsync_time.h"
+#include "nsync_waiter.h"
+
+NSYNC_CPP_START_
+
+/* An nsync_waitset holds a set of waitables (see nsync_waiter.h) on which a
+   thread waits repeatedly.  It is to nsync_wait_n() as epoll is to poll():
+   nsync_wait_n() queues the caller on every object, and dequeues it from
+   every object, on each call, while an nsync_waitset queues itself on each
+   object once, and stays queued across waits until the object is reported
+   ready.  A wait on a set in which nothing has become ready reads one word
+   per object, and acquires none of their locks.
+
+   A wait reports every ready object, up to a limit.  Notes and counters are
+   reported for as long as they are ready.  A condition variable is reported
+   once for each time it has been signalled (or broadcast) since it was last
+   reported; as with nsync_wait_n(), the lock passed to
+   nsync_waitset_wait() must then protect the predicates of all the
+   condition variables in the set, and must be held when they are signalled.
+
+   Example:
+	struct nsync_waitable_s w[2] = {
+		{ NULL, &nsync_note_waitable_funcs },
+		{ NULL, &nsync_counter_waitable_funcs }
+	};
+	struct nsync_waitable_s *ready[2];
+	nsync_waitset ws = nsync_waitset_new ();
+	w[0].v = note;
+	w[1].v = counter;
+	nsync_waitset_add (ws, &w[0]);
+	nsync_waitset_add (ws, &w[1]);
+	for (;;) {
+		int i;
+		int n = nsync_waitset_wait (ws, NULL, NULL, NULL,
+					    nsync_time_no_deadline, 2, ready);
+		for (i = 0; i != n; i++) {
+			// ready[i]->v is ready.
+		}
+		...
+	}
+	nsync_waitset_free (ws);
+   */
+typedef struct nsync_waitset_s_ *nsync_waitset;
+
+/* Return a freshly allocated, empty nsync_waitset, or NULL if one cannot be
+   created.  nsync_waitsets should be passed to nsync_waitset_free() when no
+   longer needed.  */
+nsync_waitset nsync_waitset_new (void);
+
+/* Free resources associated with ws, first removing all its waitables.
+   Requires that no concurrent or future operations are applied to ws.  */
+void nsync_waitset_free (nsync_waitset ws);
+
+/* Add *w to ws.  *w, and the object it points to, must remain valid until
+   *w is removed from ws, or ws is freed.  Requires that *w is not already
+   in ws.  Return 1 on success, or 0 if *w could not be added because memory
+   could not be allocated.  If a thread is blocked in nsync_waitset_wait()
+   on ws, it will consider *w before returning.  */
+int nsync_waitset_add (nsync_waitset ws, struct nsync_waitable_s *w);
+
+/* Remove *w from ws, and return whether it was in ws.  */
+int nsync_waitset_remove (nsync_waitset ws, struct nsync_waitable_s *w);
+
+/* Wait until at least one of the waitables in ws is ready, or abs_deadline
+   is reached.  Place pointers to at most max of the ready waitables in
+   ready[0,..,max-1], and return the number placed, which is zero if the
+   deadline expired first.  Ready waitables that do not fit are reported
+   by the next call, which first considers the waitables after the last
+   one reported, so that waitables that stay ready do not starve others.
+   If mu!=NULL, (*unlock)(mu) is called after ws is queued on its waitables,
+   and (*lock)(mu) is called before return, as in nsync_wait_n().
+   Requires max > 0, and that at most one thread at a time waits on ws.  */
+int nsync_waitset_wait (nsync_waitset ws, void *mu, void (*lock) (void *),
+			void (*unlock) (void *), nsync_time abs_deadline,
+			int max, struct nsync_waitable_s *ready[]);
+
+NSYNC_CPP_END_
+
+#endif /*NSYNC_PUBLIC_NSYNC_WAITSET_H_*/
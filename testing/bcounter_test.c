@@ -0,0 +1,203 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+/* This tests nsync_bcounter. */
+
+#include "platform.h"
+#include "nsync.h"
+#include "atomic.h"
+#include "time_extra.h"
+#include "smprintf.h"
+#include "closure.h"
+#include "testing.h"
+
+NSYNC_CPP_USING_
+
+/* Increment *a. */
+static void atm_incr (nsync_atomic_uint32_ *a) {
+	uint32_t old_value;
+	do {
+		old_value = ATM_LOAD (a);
+	} while (!ATM_CAS (a, old_value, old_value+1));
+}
+
+/* The state shared by the threads of test_bcounter_thresholds(). */
+typedef struct thresholds_s {
+	testing t;
+	nsync_bcounter b;
+	nsync_atomic_uint32_ woken;  /* number of waiters that have returned */
+	nsync_counter done;
+} thresholds;
+
+/* Wait for ts->b to drop to at most threshold. */
+static void threshold_waiter (thresholds *ts, uint32_t threshold) {
+	uint32_t value = nsync_bcounter_wait (ts->b, threshold, nsync_time_no_deadline);
+	if (value > threshold) {
+		TEST_ERROR (ts->t, ("nsync_bcounter_wait (%u) returned %u", threshold, value));
+	}
+	atm_incr (&ts->woken);
+	nsync_counter_add (ts->done, -1);
+}
+
+CLOSURE_DECL_BODY2 (threshold_waiter, thresholds *, uint32_t)
+
+/* Test that waiters on a bounded counter return when, and only when, the
+   value falls to their thresholds. */
+static void test_bcounter_thresholds (testing t) {
+	static const uint32_t threshold[] = { 8, 2, 5, 5, 0 };
+	int nthreshold = (int) (sizeof (threshold) / sizeof (threshold[0]));
+	thresholds ts;
+	uint32_t value;
+	int i;
+	memset ((void *) &ts, 0, sizeof (ts));
+	ts.t = t;
+	ts.b = nsync_bcounter_new (10);
+	ts.done = nsync_counter_new (nthreshold);
+	for (i = 0; i != nthreshold; i++) {
+		closure_fork (closure_threshold_waiter (&threshold_waiter, &ts, threshold[i]));
+	}
+	nsync_time_sleep (nsync_time_ms (20));
+	for (value = 10; value-- != 0; ) {
+		int want = 0;
+		nsync_bcounter_add (ts.b, -1);
+		for (i = 0; i != nthreshold; i++) {
+			want += (threshold[i] >= value);
+		}
+		/* Give woken waiters time to return. */
+		nsync_time_sleep (nsync_time_ms (10));
+		if (ATM_LOAD (&ts.woken) != (uint32_t) want) {
+			TEST_ERROR (t, ("at value %u, %u waiters returned, want %d",
+					value, ATM_LOAD (&ts.woken), want));
+		}
+		/* Increments, which wake no one, are allowed at any time. */
+		nsync_bcounter_add (ts.b, 1);
+		nsync_bcounter_add (ts.b, -1);
+	}
+	nsync_counter_wait (ts.done, nsync_time_no_deadline);
+	nsync_counter_free (ts.done);
+	nsync_bcounter_free (ts.b);
+}
+
+/* --------------------------------------- */
+
+/* Decrement b after delay. */
+static void decrement_after (nsync_bcounter b, nsync_time delay) {
+	nsync_time_sleep (delay);
+	nsync_bcounter_add (b, -1);
+}
+
+CLOSURE_DECL_BODY2 (decrement_after, nsync_bcounter, nsync_time)
+
+/* Test nsync_wait_n() on a bounded counter and a note. */
+static void test_bcounter_wait_n (testing t) {
+	nsync_bcounter b = nsync_bcounter_new (3);
+	nsync_note n = nsync_note_new (NULL, nsync_time_no_deadline);
+	struct nsync_bcounter_wait_s bw;
+	struct nsync_waitable_s w[2];
+	struct nsync_waitable_s *pw[2];
+	int i;
+	bw.b = b;
+	bw.threshold = 2;
+	w[0].v = &bw;
+	w[0].funcs = &nsync_bcounter_waitable_funcs;
+	w[1].v = n;
+	w[1].funcs = &nsync_note_waitable_funcs;
+	pw[0] = &w[0];
+	pw[1] = &w[1];
+	i = nsync_wait_n (NULL, NULL, NULL,
+			  nsync_time_add (nsync_time_now (), nsync_time_ms (10)), 2, pw);
+	if (i != 2) {
+		TEST_ERROR (t, ("nsync_wait_n() above threshold returned %d, want 2", i));
+	}
+	closure_fork (closure_decrement_after (&decrement_after, b, nsync_time_ms (10)));
+	i = nsync_wait_n (NULL, NULL, NULL, nsync_time_no_deadline, 2, pw);
+	if (i != 0) {
+		TEST_ERROR (t, ("nsync_wait_n() returned %d after decrement, want 0", i));
+	}
+	if (nsync_bcounter_value (b) != 2) {
+		TEST_ERROR (t, ("bounded counter is %u, want 2", nsync_bcounter_value (b)));
+	}
+	nsync_note_free (n);
+	nsync_bcounter_free (b);
+}
+
+/* --------------------------------------- */
+
+/* The limit on work in flight in test_bcounter_limit(). */
+#define LIMIT 3
+
+/* The state shared by the threads of test_bcounter_limit(). */
+typedef struct limit_s {
+	nsync_bcounter in_flight;
+	nsync_mu mu;       /* protects running and max_running */
+	int running;
+	int max_running;
+	nsync_counter done;
+} limit;
+
+/* Run n pieces of work, at most LIMIT at a time across all threads, as
+   in the example in nsync_bcounter.h. */
+static void limit_worker (limit *l, int n) {
+	int i;
+	for (i = 0; i != n; i++) {
+		while (nsync_bcounter_add (l->in_flight, 1) > LIMIT) {
+			nsync_bcounter_add (l->in_flight, -1);
+			nsync_bcounter_wait (l->in_flight, LIMIT - 1, nsync_time_no_deadline);
+		}
+		nsync_mu_lock (&l->mu);
+		l->running++;
+		if (l->running > l->max_running) {
+			l->max_running = l->running;
+		}
+		nsync_mu_unlock (&l->mu);
+		nsync_mu_lock (&l->mu);
+		l->running--;
+		nsync_mu_unlock (&l->mu);
+		nsync_bcounter_add (l->in_flight, -1);
+	}
+	nsync_counter_add (l->done, -1);
+}
+
+CLOSURE_DECL_BODY2 (limit_worker, limit *, int)
+
+/* Test that a bounded counter limits the work in flight. */
+static void test_bcounter_limit (testing t) {
+	limit l;
+	int i;
+	memset ((void *) &l, 0, sizeof (l));
+	l.in_flight = nsync_bcounter_new (0);
+	l.done = nsync_counter_new (8);
+	for (i = 0; i != 8; i++) {
+		closure_fork (closure_limit_worker (&limit_worker, &l, 2000));
+	}
+	nsync_counter_wait (l.done, nsync_time_no_deadline);
+	if (l.max_running > LIMIT) {
+		TEST_ERROR (t, ("%d pieces of work ran at once, want at most %d",
+				l.max_running, LIMIT));
+	}
+	if (nsync_bcounter_value (l.in_flight) != 0) {
+		TEST_ERROR (t, ("bounded counter is %u at end, want 0",
+				nsync_bcounter_value (l.in_flight)));
+	}
+	nsync_counter_free (l.done);
+	nsync_bcounter_free (l.in_flight);
+}
+
+int main (int argc, char *argv[]) {
+	testing_base tb = testing_new (argc, argv, 0);
+	TEST_RUN (tb, test_bcounter_thresholds);
+	TEST_RUN (tb, test_bcounter_wait_n);
+	TEST_RUN (tb, test_bcounter_limit);
+	return (testing_base_exit (tb));
+}
@@ -14,6 +14,7 @@
 
 #include "platform.h"
 #include "nsync.h"
+#include "atomic.h"
 #include "time_extra.h"
 #include "smprintf.h"
 #include "closure.h"
@@ -146,10 +147,104 @@ static void test_counter_decrement (testing t) {
 	nsync_counter_free (c);
 }
 
+/* The number of threads and iterations used by test_counter_sharded(). */
+#define SHARDED_THREADS 8
+#define SHARDED_ITERATIONS 2000
+
+/* Add +3 and then -4 to c, n times, counting the iterations in *started
+   before each decrement, then decrement done. */
+static void sharded_adder (nsync_counter c, nsync_atomic_uint32_ *started, int n,
+			   nsync_counter done) {
+	int i;
+	uint32_t old_value;
+	for (i = 0; i != n; i++) {
+		nsync_counter_add (c, 3);
+		do {
+			old_value = ATM_LOAD (started);
+		} while (!ATM_CAS (started, old_value, old_value+1));
+		nsync_counter_add (c, -4);
+	}
+	nsync_counter_add (done, -1);
+}
+
+CLOSURE_DECL_BODY4 (sharded_adder, nsync_counter, nsync_atomic_uint32_ *, int, nsync_counter)
+
+/* Test that a sharded counter reaches zero only after its last decrement,
+   and wakes a waiter then. */
+static void test_counter_sharded (testing t) {
+	int n = SHARDED_THREADS * SHARDED_ITERATIONS;
+	nsync_atomic_uint32_ started;
+	nsync_counter c = nsync_counter_new_sharded (n);
+	nsync_counter done = nsync_counter_new (SHARDED_THREADS);
+	int i;
+	ATM_STORE (&started, 0);
+	if (nsync_counter_value (c) != (uint32_t) n) {
+		TEST_ERROR (t, ("sharded counter is %u, want %d",
+				nsync_counter_value (c), n));
+	}
+	for (i = 0; i != SHARDED_THREADS; i++) {
+		closure_fork (closure_sharded_adder (&sharded_adder, c, &started,
+						     SHARDED_ITERATIONS, done));
+	}
+	if (nsync_counter_wait (c, nsync_time_no_deadline) != 0) {
+		TEST_ERROR (t, ("sharded counter wait returned non-zero"));
+	}
+	if (ATM_LOAD (&started) != (uint32_t) n) {
+		TEST_ERROR (t, ("sharded counter reached zero after %u of %d decrements",
+				ATM_LOAD (&started), n));
+	}
+	if (nsync_counter_value (c) != 0) {
+		TEST_ERROR (t, ("sharded counter is %u after wait, want 0",
+				nsync_counter_value (c)));
+	}
+	nsync_counter_wait (done, nsync_time_no_deadline);
+	nsync_counter_free (done);
+	nsync_counter_free (c);
+}
+
+/* Add +1 and then -1 to c, n times, then decrement done. */
+static void add_pairs (nsync_counter c, int n, nsync_counter done) {
+	int i;
+	for (i = 0; i != n; i++) {
+		nsync_counter_add (c, 1);
+		nsync_counter_add (c, -1);
+	}
+	nsync_counter_add (done, -1);
+}
+
+CLOSURE_DECL_BODY3 (add_pairs, nsync_counter, int, nsync_counter)
+
+/* Measure the cost of nsync_counter_add() on c, shared by four threads. */
+static void counter_add_run (testing t, nsync_counter c) {
+	int n = testing_n (t);
+	int i;
+	nsync_counter done = nsync_counter_new (4);
+	for (i = 0; i != 4; i++) {
+		closure_fork (closure_add_pairs (&add_pairs, c, n / 8, done));
+	}
+	nsync_counter_wait (done, nsync_time_no_deadline);
+	nsync_counter_free (done);
+	nsync_counter_free (c);
+}
+
+/* Measure the cost of nsync_counter_add() on a counter shared by four
+   threads, whose value never reaches zero. */
+static void benchmark_counter_add (testing t) {
+	counter_add_run (t, nsync_counter_new (1 << 20));
+}
+
+/* As benchmark_counter_add(), but with a sharded counter. */
+static void benchmark_counter_add_sharded (testing t) {
+	counter_add_run (t, nsync_counter_new_sharded (1 << 20));
+}
+
 int main (int argc, char *argv[]) {
 	testing_base tb = testing_new (argc, argv, 0);
 	TEST_RUN (tb, test_counter_zero);
 	TEST_RUN (tb, test_counter_non_zero);
 	TEST_RUN (tb, test_counter_decrement);
+	TEST_RUN (tb, test_counter_sharded);
+	BENCHMARK_RUN (tb, benchmark_counter_add);
+	BENCHMARK_RUN (tb, benchmark_counter_add_sharded);
 	return (testing_base_exit (tb));
 }
@@ -763,6 +763,95 @@ static void test_cv_transfer (testing t) {
 }
 
 
+/* --------------------------- */
+
+/* Number of waiter threads in test_cv_generic_broadcast(). */
+#define GENERIC_WAITERS 16
+
+/* A struct cv_generic is used to test nsync_cv_broadcast() with waiters that
+   use locks other than nsync_mu, which are woken via a chain.  (See the code in
+   cv.c, wake_waiters().)  Waiter i uses mu[i%2]. */
+struct cv_generic {
+	nsync_cv cv;         /* broadcast when go[] is set */
+	nsync_cmu mu[2];     /* mu[j] protects go[j] and woken[j] */
+	int go[2];           /* waiters on mu[j] wait for go[j] to be non-zero */
+	int woken[2];        /* number of waiters on mu[j] that saw go[j] */
+	nsync_counter queued;  /* number of waiters yet to first hold their mu */
+	nsync_counter done;    /* number of waiters yet to finish */
+};
+
+/* Versions of nsync_cmu_lock() and nsync_cmu_unlock() that take "void *"
+   arguments, for nsync_cv_wait_with_deadline_generic().  */
+static void void_cmu_lock (void *mu) {
+	nsync_cmu_lock ((nsync_cmu *) mu);
+}
+static void void_cmu_unlock (void *mu) {
+	nsync_cmu_unlock ((nsync_cmu *) mu);
+}
+
+/* Wait for cg->go[i%2] to become non-zero, or for the wait to time out,
+   if timeout_ms is non-zero.  Used as the body of the waiter threads created
+   by test_cv_generic_broadcast(). */
+static void generic_waiter_thread (testing t, struct cv_generic *cg, int i, int timeout_ms) {
+	nsync_cmu *mu = &cg->mu[i%2];
+	nsync_time deadline = nsync_time_no_deadline;
+	int outcome = 0;
+	if (timeout_ms != 0) {
+		deadline = nsync_time_add (nsync_time_now (), nsync_time_ms (timeout_ms));
+	}
+	nsync_cmu_lock (mu);
+	nsync_counter_add (cg->queued, -1);
+	while (!cg->go[i%2] && outcome == 0) {
+		outcome = nsync_cv_wait_with_deadline_generic (&cg->cv, mu, &void_cmu_lock,
+							       &void_cmu_unlock, deadline, NULL);
+	}
+	if (cg->go[i%2]) {
+		cg->woken[i%2]++;
+	} else if (outcome != ETIMEDOUT) {
+		TEST_ERROR (t, ("nsync_cv_wait_with_deadline_generic() returned %d", outcome));
+	}
+	nsync_cmu_unlock (mu);
+	nsync_counter_add (cg->done, -1);
+}
+
+CLOSURE_DECL_BODY4 (generic_waiter_thread, testing, struct cv_generic *, int, int)
+
+/* Test that nsync_cv_broadcast() wakes all the waiters that use locks other
+   than nsync_mu, including those whose deadlines expire while they wait for
+   other woken waiters to reacquire their lock.  */
+static void test_cv_generic_broadcast (testing t) {
+	struct cv_generic Xcg;
+	struct cv_generic *cg = &Xcg;  /* So all accesses are of form cg-> */
+	int want = 0;
+	int i;
+	memset ((void *) cg, 0, sizeof (*cg));
+	cg->queued = nsync_counter_new (GENERIC_WAITERS);
+	cg->done = nsync_counter_new (GENERIC_WAITERS);
+	for (i = 0; i != GENERIC_WAITERS; i++) {
+		/* Every fourth waiter times out while the locks are held below. */
+		closure_fork (closure_generic_waiter_thread (&generic_waiter_thread, t, cg, i,
+							     (i % 4) == 3? 50 : 0));
+		want += ((i % 4) != 3);
+	}
+	nsync_counter_wait (cg->queued, nsync_time_no_deadline);
+	/* Each waiter has released its lock only by waiting on cg->cv. */
+	nsync_cmu_lock (&cg->mu[0]);
+	nsync_cmu_lock (&cg->mu[1]);
+	cg->go[0] = 1;
+	cg->go[1] = 1;
+	nsync_cv_broadcast (&cg->cv);
+	nsync_time_sleep (nsync_time_ms (100));
+	nsync_cmu_unlock (&cg->mu[1]);
+	nsync_cmu_unlock (&cg->mu[0]);
+	nsync_counter_wait (cg->done, nsync_time_no_deadline);
+	if (cg->woken[0] + cg->woken[1] < want) {
+		TEST_ERROR (t, ("%d waiters saw the broadcast, want at least %d",
+				cg->woken[0] + cg->woken[1], want));
+	}
+	nsync_counter_free (cg->queued);
+	nsync_counter_free (cg->done);
+}
+
 /* --------------------------- */
 
 int main (int argc, char *argv[]) {
@@ -778,5 +867,6 @@ int main (int argc, char *argv[]) {
 	TEST_RUN (tb, test_cv_cancel);
 	TEST_RUN (tb, test_cv_debug);
 	TEST_RUN (tb, test_cv_transfer);
+	TEST_RUN (tb, test_cv_generic_broadcast);
 	return (testing_base_exit (tb));
 }
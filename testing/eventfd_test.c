@@ -0,0 +1,215 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+/* This tests nsync_eventfd. */
+
+#include "platform.h"
+#include "nsync.h"
+#include "time_extra.h"
+#include "smprintf.h"
+#include "closure.h"
+#include "testing.h"
+
+NSYNC_CPP_USING_
+
+#if defined(POLLIN)
+
+/* Return whether fd becomes readable within timeout_ms milliseconds. */
+static int fd_readable (int fd, int timeout_ms) {
+	struct pollfd pfd;
+	memset ((void *) &pfd, 0, sizeof (pfd));
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	return (poll (&pfd, 1, timeout_ms) == 1 && (pfd.revents & POLLIN) != 0);
+}
+
+static void notify_after (nsync_note n, nsync_time delay) {
+	nsync_time_sleep (delay);
+	nsync_note_notify (n);
+}
+
+CLOSURE_DECL_BODY2 (notify_after, nsync_note, nsync_time)
+
+static void decrement_after (nsync_counter c, nsync_time delay) {
+	nsync_time_sleep (delay);
+	nsync_counter_add (c, -1);
+}
+
+CLOSURE_DECL_BODY2 (decrement_after, nsync_counter, nsync_time)
+
+/* Test that an nsync_eventfd on a note or counter becomes readable when the
+   object becomes ready in another thread, and stays readable. */
+static void test_eventfd_note_counter (testing t) {
+	struct nsync_waitable_s w[2];
+	nsync_eventfd e[2];
+	nsync_note n = nsync_note_new (NULL, nsync_time_no_deadline);
+	nsync_counter c = nsync_counter_new (1);
+	int i;
+	w[0].v = n;
+	w[0].funcs = &nsync_note_waitable_funcs;
+	w[1].v = c;
+	w[1].funcs = &nsync_counter_waitable_funcs;
+	for (i = 0; i != 2; i++) {
+		e[i] = nsync_eventfd_new (&w[i]);
+		if (e[i] == NULL) {
+			TEST_FATAL (t, ("nsync_eventfd_new() failed"));
+		}
+		if (fd_readable (nsync_eventfd_fd (e[i]), 10)) {
+			TEST_ERROR (t, ("eventfd %d readable before its object is ready", i));
+		}
+		if (nsync_eventfd_ready (e[i])) {
+			TEST_ERROR (t, ("nsync_eventfd_ready (%d) before its object is ready", i));
+		}
+	}
+	closure_fork (closure_notify_after (&notify_after, n, nsync_time_ms (10)));
+	closure_fork (closure_decrement_after (&decrement_after, c, nsync_time_ms (10)));
+	for (i = 0; i != 2; i++) {
+		if (!fd_readable (nsync_eventfd_fd (e[i]), 10000)) {
+			TEST_ERROR (t, ("eventfd %d not readable after its object is ready", i));
+		}
+		if (!nsync_eventfd_ready (e[i])) {
+			TEST_ERROR (t, ("nsync_eventfd_ready (%d) returned 0 after readability", i));
+		}
+		if (!fd_readable (nsync_eventfd_fd (e[i]), 0) || !nsync_eventfd_ready (e[i])) {
+			TEST_ERROR (t, ("eventfd %d did not stay ready", i));
+		}
+		nsync_eventfd_free (e[i]);
+	}
+	nsync_note_free (n);
+	nsync_counter_free (c);
+}
+
+/* Test that an nsync_eventfd on a note becomes readable when an ancestor
+   of the note expires, though no thread examines either note. */
+static void test_eventfd_note_expiry (testing t) {
+	nsync_time start = nsync_time_now ();
+	nsync_note parent = nsync_note_new (NULL, nsync_time_add (start, nsync_time_ms (50)));
+	nsync_note n = nsync_note_new (parent, nsync_time_no_deadline);
+	struct nsync_waitable_s w;
+	nsync_eventfd e;
+	nsync_time waited;
+	w.v = n;
+	w.funcs = &nsync_note_waitable_funcs;
+	e = nsync_eventfd_new (&w);
+	if (e == NULL) {
+		TEST_FATAL (t, ("nsync_eventfd_new() failed"));
+	}
+	if (!fd_readable (nsync_eventfd_fd (e), 10000)) {
+		TEST_ERROR (t, ("eventfd not readable after the note's parent expired"));
+	}
+	waited = nsync_time_sub (nsync_time_now (), start);
+	if (nsync_time_cmp (waited, nsync_time_ms (40)) < 0) {
+		TEST_ERROR (t, ("eventfd readable after %s, before the note's parent expired",
+				nsync_time_str (waited, 2)));
+	}
+	if (!nsync_eventfd_ready (e)) {
+		TEST_ERROR (t, ("nsync_eventfd_ready() false after the note's parent expired"));
+	}
+	nsync_eventfd_free (e);
+	nsync_note_free (n);
+	nsync_note_free (parent);
+}
+
+/* Test that a note that inherited its expiry time from a parent still
+   expires on time after the parent is freed. */
+static void test_eventfd_note_orphan_expiry (testing t) {
+	nsync_time start = nsync_time_now ();
+	nsync_note parent = nsync_note_new (NULL, nsync_time_add (start, nsync_time_ms (50)));
+	nsync_note n = nsync_note_new (parent, nsync_time_no_deadline);
+	struct nsync_waitable_s w;
+	nsync_eventfd e;
+	nsync_time waited;
+	nsync_note_free (parent);
+	w.v = n;
+	w.funcs = &nsync_note_waitable_funcs;
+	e = nsync_eventfd_new (&w);
+	if (e == NULL) {
+		TEST_FATAL (t, ("nsync_eventfd_new() failed"));
+	}
+	if (!fd_readable (nsync_eventfd_fd (e), 10000)) {
+		TEST_ERROR (t, ("eventfd not readable after the orphaned note expired"));
+	}
+	waited = nsync_time_sub (nsync_time_now (), start);
+	if (nsync_time_cmp (waited, nsync_time_ms (40)) < 0) {
+		TEST_ERROR (t, ("eventfd readable after %s, before the orphaned note expired",
+				nsync_time_str (waited, 2)));
+	}
+	nsync_eventfd_free (e);
+	nsync_note_free (n);
+}
+
+/* --------------------------------------- */
+
+/* Signal *cv with *mu held. */
+static void signal_after (nsync_cv *cv, nsync_mu *mu, nsync_time delay) {
+	nsync_time_sleep (delay);
+	nsync_mu_lock (mu);
+	nsync_cv_signal (cv);
+	nsync_mu_unlock (mu);
+}
+
+CLOSURE_DECL_BODY3 (signal_after, nsync_cv *, nsync_mu *, nsync_time)
+
+/* Test that an nsync_eventfd on a condition variable becomes readable once
+   per signal. */
+static void test_eventfd_cv (testing t) {
+	nsync_mu mu;
+	nsync_cv cv;
+	struct nsync_waitable_s w;
+	nsync_eventfd e;
+	int round;
+	nsync_mu_init (&mu);
+	nsync_cv_init (&cv);
+	w.v = &cv;
+	w.funcs = &nsync_cv_waitable_funcs;
+	nsync_mu_lock (&mu);
+	e = nsync_eventfd_new (&w);
+	nsync_mu_unlock (&mu);
+	if (e == NULL) {
+		TEST_FATAL (t, ("nsync_eventfd_new() failed"));
+	}
+	for (round = 0; round != 3; round++) {
+		closure_fork (closure_signal_after (&signal_after, &cv, &mu, nsync_time_ms (10)));
+		if (!fd_readable (nsync_eventfd_fd (e), 10000)) {
+			TEST_ERROR (t, ("eventfd not readable after signal in round %d", round));
+		}
+		nsync_mu_lock (&mu);
+		if (!nsync_eventfd_ready (e)) {
+			TEST_ERROR (t, ("nsync_eventfd_ready() returned 0 after signal in round %d",
+					round));
+		}
+		if (nsync_eventfd_ready (e)) {
+			TEST_ERROR (t, ("nsync_eventfd_ready() reported a signal twice in round %d",
+					round));
+		}
+		nsync_mu_unlock (&mu);
+		if (fd_readable (nsync_eventfd_fd (e), 0)) {
+			TEST_ERROR (t, ("eventfd readable after signal consumed in round %d", round));
+		}
+	}
+	nsync_eventfd_free (e);
+}
+
+#endif
+
+int main (int argc, char *argv[]) {
+	testing_base tb = testing_new (argc, argv, 0);
+#if defined(POLLIN)
+	TEST_RUN (tb, test_eventfd_note_counter);
+	TEST_RUN (tb, test_eventfd_note_expiry);
+	TEST_RUN (tb, test_eventfd_note_orphan_expiry);
+	TEST_RUN (tb, test_eventfd_cv);
+#endif
+	return (testing_base_exit (tb));
+}
@@ -0,0 +1,161 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+/* This tests nsync_fd. */
+
+#include "platform.h"
+#include "nsync.h"
+#include "time_extra.h"
+#include "smprintf.h"
+#include "closure.h"
+#include "testing.h"
+
+NSYNC_CPP_USING_
+
+#if defined(POLLIN)
+
+/* Write one byte to fd after delay. */
+static void write_after (int fd, nsync_time delay) {
+	char c = 'x';
+	nsync_time_sleep (delay);
+	if (write (fd, &c, 1) != 1) {
+		abort ();
+	}
+}
+
+CLOSURE_DECL_BODY2 (write_after, int, nsync_time)
+
+static void notify_after (nsync_note n, nsync_time delay) {
+	nsync_time_sleep (delay);
+	nsync_note_notify (n);
+}
+
+CLOSURE_DECL_BODY2 (notify_after, nsync_note, nsync_time)
+
+/* Test that nsync_wait_n() on an nsync_fd and a note returns when a pipe
+   becomes readable, when the note is notified, or at its deadline. */
+static void test_fd_wait_n (testing t) {
+	int pfd[2];
+	nsync_fd f;
+	nsync_note n;
+	struct nsync_waitable_s w[2];
+	struct nsync_waitable_s *pw[2];
+	int round;
+	int i;
+	char c;
+	if (pipe (pfd) != 0) {
+		TEST_FATAL (t, ("pipe() failed"));
+	}
+	f = nsync_fd_new (pfd[0], NSYNC_FD_READABLE);
+	if (f == NULL) {
+		TEST_FATAL (t, ("nsync_fd_new() failed"));
+	}
+	n = nsync_note_new (NULL, nsync_time_no_deadline);
+	w[0].v = f;
+	w[0].funcs = &nsync_fd_waitable_funcs;
+	w[1].v = n;
+	w[1].funcs = &nsync_note_waitable_funcs;
+	pw[0] = &w[0];
+	pw[1] = &w[1];
+
+	i = nsync_wait_n (NULL, NULL, NULL,
+			  nsync_time_add (nsync_time_now (), nsync_time_ms (10)), 2, pw);
+	if (i != 2) {
+		TEST_ERROR (t, ("nsync_wait_n() on an empty pipe returned %d, want 2", i));
+	}
+	/* Each round waits again on the same nsync_fd, whose registration
+	   must be re-armed. */
+	for (round = 0; round != 5; round++) {
+		closure_fork (closure_write_after (&write_after, pfd[1], nsync_time_ms (5)));
+		i = nsync_wait_n (NULL, NULL, NULL, nsync_time_no_deadline, 2, pw);
+		if (i != 0) {
+			TEST_ERROR (t, ("nsync_wait_n() returned %d in round %d, want 0",
+					i, round));
+		}
+		i = nsync_wait_n (NULL, NULL, NULL, nsync_time_zero, 2, pw);
+		if (i != 0) {
+			TEST_ERROR (t, ("nsync_wait_n() on a readable pipe returned %d, want 0", i));
+		}
+		if (read (pfd[0], &c, 1) != 1) {
+			TEST_ERROR (t, ("read() from the pipe failed"));
+		}
+	}
+	closure_fork (closure_notify_after (&notify_after, n, nsync_time_ms (5)));
+	i = nsync_wait_n (NULL, NULL, NULL, nsync_time_no_deadline, 2, pw);
+	if (i != 1) {
+		TEST_ERROR (t, ("nsync_wait_n() returned %d after notification, want 1", i));
+	}
+	nsync_fd_free (f);
+	nsync_note_free (n);
+	close (pfd[0]);
+	close (pfd[1]);
+}
+
+/* The number of pipes used by test_fd_many(). */
+#define FD_MANY 16
+
+/* Wait for f to become ready, then decrement done. */
+static void fd_many_waiter (testing t, nsync_fd f, nsync_counter done) {
+	struct nsync_waitable_s w;
+	struct nsync_waitable_s *pw = &w;
+	w.v = f;
+	w.funcs = &nsync_fd_waitable_funcs;
+	if (nsync_wait_n (NULL, NULL, NULL, nsync_time_no_deadline, 1, &pw) != 0) {
+		TEST_ERROR (t, ("nsync_wait_n() on an nsync_fd did not return 0"));
+	}
+	nsync_counter_add (done, -1);
+}
+
+CLOSURE_DECL_BODY3 (fd_many_waiter, testing, nsync_fd, nsync_counter)
+
+/* Test that several threads waiting on different nsync_fds are each woken
+   by the poller when their pipe becomes readable. */
+static void test_fd_many (testing t) {
+	int pfd[FD_MANY][2];
+	nsync_fd f[FD_MANY];
+	nsync_counter done = nsync_counter_new (FD_MANY);
+	int i;
+	for (i = 0; i != FD_MANY; i++) {
+		if (pipe (pfd[i]) != 0) {
+			TEST_FATAL (t, ("pipe() failed"));
+		}
+		f[i] = nsync_fd_new (pfd[i][0], NSYNC_FD_READABLE);
+		closure_fork (closure_fd_many_waiter (&fd_many_waiter, t, f[i], done));
+	}
+	for (i = 0; i != FD_MANY; i++) {
+		closure_fork (closure_write_after (&write_after, pfd[i][1],
+						   nsync_time_ms (i % 4)));
+	}
+	if (nsync_counter_wait (done, nsync_time_add (nsync_time_now (),
+						     nsync_time_ms (10000))) != 0) {
+		TEST_FATAL (t, ("waiters on nsync_fds were not all woken"));
+	}
+	for (i = 0; i != FD_MANY; i++) {
+		nsync_fd_free (f[i]);
+		close (pfd[i][0]);
+		close (pfd[i][1]);
+	}
+	nsync_counter_free (done);
+}
+
+#endif
+
+int main (int argc, char *argv[]) {
+	testing_base tb = testing_new (argc, argv, 0);
+#if defined(POLLIN)
+	TEST_RUN (tb, test_fd_wait_n);
+	TEST_RUN (tb, test_fd_many);
+#endif
+	return (testing_base_exit (tb));
+}
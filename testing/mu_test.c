@@ -14,6 +14,8 @@
 
 #include "platform.h"
 #include "nsync.h"
+#include "atomic.h"
+#include "sem.h"
 #include "time_extra.h"
 #include "smprintf.h"
 #include "testing.h"
@@ -33,6 +35,7 @@ typedef struct test_data_s {
 	void (*unlock) (void *);
 	
 	nsync_mu mu;
+	nsync_brmu brmu;
 	pthread_mutex_t mutex;
 	pthread_rwlock_t rwmutex;
 	
@@ -264,6 +267,434 @@ static void test_try_mu_nthread (testing t) {
 
 /* --------------------------------------- */
 
+/* Versions of nsync_brmu_lock() and nsync_brmu_unlock() that take "void *"
+   arguments. */
+static void void_brmu_lock (void *mu) {
+	nsync_brmu_lock ((nsync_brmu *) mu);
+}
+static void void_brmu_unlock (void *mu) {
+	nsync_brmu_unlock ((nsync_brmu *) mu);
+}
+
+/* Create a few threads, each of which increments an
+   integer a fixed number of times, using an nsync_brmu in write mode for
+   mutual exclusion.  It checks that the integer is incremented the correct
+   number of times. */
+static void test_brmu_nthread (testing t) {
+	int loop_count = 100000;
+	nsync_time deadline;
+	deadline = nsync_time_add (nsync_time_now (), nsync_time_ms (1500));
+	do {
+		int i;
+		test_data td;
+		memset (&td, 0, sizeof (td));
+		td.t = t;
+		td.n_threads = 5;
+		td.loop_count = loop_count;
+		td.mu_in_use = &td.brmu;
+		td.lock = &void_brmu_lock;
+		td.unlock = &void_brmu_unlock;
+		for (i = 0; i != td.n_threads; i++) {
+			closure_fork (closure_counting (&counting_loop, &td, i));
+		}
+		test_data_wait_for_all_threads (&td);
+		if (td.i != td.n_threads*td.loop_count) {
+			TEST_FATAL (t, ("test_brmu_nthread final count inconsistent: want %d, got %d",
+				   td.n_threads*td.loop_count, td.i));
+		}
+		loop_count *= 2;
+	} while (nsync_time_cmp (nsync_time_now (), deadline) < 0);
+}
+
+/* The state shared between the threads of test_brmu_readers(). */
+typedef struct brmu_test_s {
+	testing t;
+	nsync_brmu mu;  /* protects a and b */
+	nsync_cv cv;    /* broadcast when a changes */
+	int a;          /* a + b == 0 whenever mu is not held in write mode */
+	int b;
+	int limit;      /* final value of a; constant after init */
+	nsync_counter done; /* decremented as each thread finishes */
+} brmu_test;
+
+/* Return whether bt->a has reached bt->limit. */
+static int brmu_test_finished (const void *v) {
+	const brmu_test *bt = (const brmu_test *) v;
+	return (bt->a == bt->limit);
+}
+
+/* Increment bt->a n times, in write mode, maintaining the invariant. */
+static void brmu_test_incrementer (brmu_test *bt, int n) {
+	int i;
+	for (i = 0; i != n; i++) {
+		nsync_brmu_lock (&bt->mu);
+		bt->a++;
+		if (bt->a + bt->b != 1) {
+			TEST_ERROR (bt->t, ("brmu writer saw a + b == %d, want 1", bt->a + bt->b));
+		}
+		bt->b--;
+		nsync_cv_broadcast (&bt->cv);
+		nsync_brmu_unlock (&bt->mu);
+	}
+	nsync_counter_add (bt->done, -1);
+}
+
+/* Repeatedly acquire bt->mu in read mode, checking the invariant,
+   until bt->a reaches bt->limit. */
+static void brmu_test_reader (brmu_test *bt, int unused) {
+	int a;
+	(void) unused;
+	do {
+		nsync_brmu_rlock (&bt->mu);
+		if (bt->a + bt->b != 0) {
+			TEST_ERROR (bt->t, ("brmu reader saw a + b == %d, want 0", bt->a + bt->b));
+		}
+		a = bt->a;
+		nsync_brmu_runlock (&bt->mu);
+	} while (a != bt->limit);
+	nsync_counter_add (bt->done, -1);
+}
+
+/* Acquire bt->mu in write mode if writer!=0, and read mode otherwise, and
+   wait for bt->a to reach bt->limit using nsync_brmu_wait(). */
+static void brmu_test_cond_waiter (brmu_test *bt, int writer) {
+	if (writer) {
+		nsync_brmu_lock (&bt->mu);
+	} else {
+		nsync_brmu_rlock (&bt->mu);
+	}
+	nsync_brmu_wait (&bt->mu, &brmu_test_finished, bt, NULL);
+	if (bt->a != bt->limit || bt->a + bt->b != 0) {
+		TEST_ERROR (bt->t, ("brmu condition waiter woke with a == %d, b == %d",
+				    bt->a, bt->b));
+	}
+	if (nsync_brmu_is_reader (&bt->mu) != !writer) {
+		TEST_ERROR (bt->t, ("brmu condition waiter woke in wrong mode"));
+	}
+	if (writer) {
+		nsync_brmu_unlock (&bt->mu);
+	} else {
+		nsync_brmu_runlock (&bt->mu);
+	}
+	nsync_counter_add (bt->done, -1);
+}
+
+/* As brmu_test_cond_waiter(), but wait using bt->cv. */
+static void brmu_test_cv_waiter (brmu_test *bt, int writer) {
+	if (writer) {
+		nsync_brmu_lock (&bt->mu);
+	} else {
+		nsync_brmu_rlock (&bt->mu);
+	}
+	while (bt->a != bt->limit) {
+		nsync_brmu_cv_wait (&bt->cv, &bt->mu);
+		if (bt->a + bt->b != 0) {
+			TEST_ERROR (bt->t, ("brmu cv waiter saw a + b == %d, want 0",
+					    bt->a + bt->b));
+		}
+	}
+	if (nsync_brmu_is_reader (&bt->mu) != !writer) {
+		TEST_ERROR (bt->t, ("brmu cv waiter woke in wrong mode"));
+	}
+	if (writer) {
+		nsync_brmu_unlock (&bt->mu);
+	} else {
+		nsync_brmu_runlock (&bt->mu);
+	}
+	nsync_counter_add (bt->done, -1);
+}
+
+CLOSURE_DECL_BODY2 (brmu_test, brmu_test *, int)
+
+/* Test that an nsync_brmu excludes readers from writers, and that
+   conditional critical sections and condition variable waits work in
+   both modes. */
+static void test_brmu_readers (testing t) {
+	int i;
+	brmu_test *bt = (brmu_test *) malloc (sizeof (*bt));
+	memset ((void *) bt, 0, sizeof (*bt));
+	bt->t = t;
+	bt->limit = 2 * 20000;
+	bt->done = nsync_counter_new (0);
+	for (i = 0; i != 2; i++) {
+		nsync_counter_add (bt->done, 4);
+		closure_fork (closure_brmu_test (&brmu_test_cond_waiter, bt, i));
+		closure_fork (closure_brmu_test (&brmu_test_cv_waiter, bt, i));
+		closure_fork (closure_brmu_test (&brmu_test_reader, bt, 0));
+		closure_fork (closure_brmu_test (&brmu_test_incrementer, bt, bt->limit / 2));
+	}
+	nsync_counter_wait (bt->done, nsync_time_no_deadline);
+	if (bt->a != bt->limit) {
+		TEST_ERROR (t, ("test_brmu_readers final count %d, want %d", bt->a, bt->limit));
+	}
+	nsync_counter_free (bt->done);
+	free (bt);
+}
+
+/* Release *mu, held in read mode, from a frame depth frames of about 1KB
+   below the caller's, so that the release is made on a different page of
+   the stack from the acquisition.  Returns a value that depends on the
+   frames, so that they are not optimized away. */
+static int brmu_runlock_at_depth (nsync_brmu *mu, int depth) {
+	char frame[1024];
+	int r;
+	memset ((void *) frame, depth, sizeof (frame));
+	if (depth == 0) {
+		nsync_brmu_runlock (mu);
+		r = 0;
+	} else {
+		r = brmu_runlock_at_depth (mu, depth - 1);
+	}
+	return (r + frame[depth]);
+}
+
+/* As brmu_test_reader(), but release bt->mu at varying stack depths. */
+static void brmu_test_deep_reader (brmu_test *bt, int unused) {
+	int a;
+	int depth = 0;
+	int sum = 0;
+	(void) unused;
+	do {
+		nsync_brmu_rlock (&bt->mu);
+		if (bt->a + bt->b != 0) {
+			TEST_ERROR (bt->t, ("brmu reader saw a + b == %d, want 0", bt->a + bt->b));
+		}
+		a = bt->a;
+		sum += brmu_runlock_at_depth (&bt->mu, depth);
+		depth = (depth + 5) % 17;
+	} while (a != bt->limit);
+	if (sum < 0) {
+		TEST_ERROR (bt->t, ("brmu_runlock_at_depth() returned a negative sum"));
+	}
+	nsync_counter_add (bt->done, -1);
+}
+
+/* Test that readers that acquire an nsync_brmu in one stack frame and
+   release it in another exclude, and are excluded by, draining writers, and
+   that each release is made in the slot of the matching acquisition. */
+static void test_brmu_stack_depth (testing t) {
+	int i;
+	brmu_test *bt = (brmu_test *) malloc (sizeof (*bt));
+	memset ((void *) bt, 0, sizeof (*bt));
+	bt->t = t;
+	bt->limit = 2 * 20000;
+	bt->done = nsync_counter_new (0);
+	for (i = 0; i != 2; i++) {
+		nsync_counter_add (bt->done, 2);
+		closure_fork (closure_brmu_test (&brmu_test_deep_reader, bt, 0));
+		closure_fork (closure_brmu_test (&brmu_test_incrementer, bt, bt->limit / 2));
+	}
+	nsync_counter_wait (bt->done, nsync_time_no_deadline);
+	for (i = 0; i != NSYNC_BRMU_SLOTS_; i++) {
+		if (ATM_LOAD (&bt->mu.slot[i].readers) != 0) {
+			TEST_ERROR (t, ("brmu slot %d holds %d readers at end, want 0", i,
+					(int) ATM_LOAD (&bt->mu.slot[i].readers)));
+		}
+	}
+	nsync_counter_free (bt->done);
+	free (bt);
+}
+
+/* --------------------------------------- */
+
+/* Versions of nsync_cmu_lock() and nsync_cmu_unlock() that take "void *"
+   arguments. */
+static void void_cmu_lock (void *mu) {
+	nsync_cmu_lock ((nsync_cmu *) mu);
+}
+static void void_cmu_unlock (void *mu) {
+	nsync_cmu_unlock ((nsync_cmu *) mu);
+}
+
+/* Create a few threads, each of which increments an integer a fixed number
+   of times, using an nsync_cmu in write mode for mutual exclusion.  It
+   checks that the integer is incremented the correct number of times. */
+static void test_cmu_nthread (testing t) {
+	int loop_count = 100000;
+	nsync_time deadline;
+	if (sizeof (nsync_cmu) != 4 || sizeof (nsync_ccv) != 4) {
+		TEST_ERROR (t, ("sizeof (nsync_cmu) == %d, sizeof (nsync_ccv) == %d, want 4",
+				(int) sizeof (nsync_cmu), (int) sizeof (nsync_ccv)));
+	}
+	deadline = nsync_time_add (nsync_time_now (), nsync_time_ms (1500));
+	do {
+		int i;
+		test_data td;
+		nsync_cmu cmu;
+		memset (&td, 0, sizeof (td));
+		nsync_cmu_init (&cmu);
+		td.t = t;
+		td.n_threads = 5;
+		td.loop_count = loop_count;
+		td.mu_in_use = &cmu;
+		td.lock = &void_cmu_lock;
+		td.unlock = &void_cmu_unlock;
+		for (i = 0; i != td.n_threads; i++) {
+			closure_fork (closure_counting (&counting_loop, &td, i));
+		}
+		test_data_wait_for_all_threads (&td);
+		if (td.i != td.n_threads*td.loop_count) {
+			TEST_FATAL (t, ("test_cmu_nthread final count inconsistent: want %d, got %d",
+				   td.n_threads*td.loop_count, td.i));
+		}
+		loop_count *= 2;
+	} while (nsync_time_cmp (nsync_time_now (), deadline) < 0);
+}
+
+/* The state shared between the threads of test_cmu_readers(). */
+typedef struct cmu_test_s {
+	testing t;
+	nsync_cmu mu;   /* protects a and b */
+	nsync_ccv cv;   /* signalled or broadcast when a changes */
+	int a;          /* a + b == 0 whenever mu is not held in write mode */
+	int b;
+	int limit;      /* final value of a; constant after init */
+	nsync_counter done; /* decremented as each thread finishes */
+} cmu_test;
+
+/* Increment ct->a n times, in write mode, maintaining the invariant.
+   Wake waiters on ct->cv with nsync_ccv_broadcast() if broadcast!=0, and
+   otherwise with nsync_ccv_signal(). */
+static void cmu_test_incrementer (cmu_test *ct, int n, int broadcast) {
+	int i;
+	for (i = 0; i != n; i++) {
+		nsync_cmu_lock (&ct->mu);
+		ct->a++;
+		if (ct->a + ct->b != 1) {
+			TEST_ERROR (ct->t, ("cmu writer saw a + b == %d, want 1", ct->a + ct->b));
+		}
+		ct->b--;
+		if (broadcast) {
+			nsync_ccv_broadcast (&ct->cv);
+		} else {
+			nsync_ccv_signal (&ct->cv);
+		}
+		nsync_cmu_unlock (&ct->mu);
+	}
+	nsync_counter_add (ct->done, -1);
+}
+
+/* Repeatedly acquire ct->mu in read mode, checking the invariant,
+   until ct->a reaches ct->limit. */
+static void cmu_test_reader (cmu_test *ct, int n, int unused) {
+	int a;
+	(void) n;
+	(void) unused;
+	do {
+		nsync_cmu_rlock (&ct->mu);
+		if (ct->a + ct->b != 0) {
+			TEST_ERROR (ct->t, ("cmu reader saw a + b == %d, want 0", ct->a + ct->b));
+		}
+		a = ct->a;
+		nsync_cmu_runlock (&ct->mu);
+	} while (a != ct->limit);
+	nsync_counter_add (ct->done, -1);
+}
+
+/* Acquire ct->mu in write mode if writer!=0, and read mode otherwise, and
+   wait on ct->cv for ct->a to reach ct->limit.  Each waiter then
+   broadcasts, since signals may have woken only some of the waiters. */
+static void cmu_test_cv_waiter (cmu_test *ct, int n, int writer) {
+	(void) n;
+	if (writer) {
+		nsync_cmu_lock (&ct->mu);
+	} else {
+		nsync_cmu_rlock (&ct->mu);
+	}
+	while (ct->a != ct->limit) {
+		nsync_ccv_wait (&ct->cv, &ct->mu);
+		if (ct->a + ct->b != 0) {
+			TEST_ERROR (ct->t, ("cmu cv waiter saw a + b == %d, want 0",
+					    ct->a + ct->b));
+		}
+	}
+	if (nsync_cmu_is_reader (&ct->mu) != !writer) {
+		TEST_ERROR (ct->t, ("cmu cv waiter woke in wrong mode"));
+	}
+	nsync_ccv_broadcast (&ct->cv);
+	if (writer) {
+		nsync_cmu_unlock (&ct->mu);
+	} else {
+		nsync_cmu_runlock (&ct->mu);
+	}
+	nsync_counter_add (ct->done, -1);
+}
+
+CLOSURE_DECL_BODY3 (cmu_test, cmu_test *, int, int)
+
+/* Test that an nsync_cmu excludes readers from writers, and that nsync_ccv
+   waits work in both modes with signals and broadcasts. */
+static void test_cmu_readers (testing t) {
+	int i;
+	cmu_test *ct = (cmu_test *) malloc (sizeof (*ct));
+	memset ((void *) ct, 0, sizeof (*ct));
+	ct->t = t;
+	ct->limit = 2 * 20000;
+	ct->done = nsync_counter_new (0);
+	for (i = 0; i != 2; i++) {
+		nsync_counter_add (ct->done, 5);
+		closure_fork (closure_cmu_test (&cmu_test_cv_waiter, ct, 0, i));
+		closure_fork (closure_cmu_test (&cmu_test_cv_waiter, ct, 0, i));
+		closure_fork (closure_cmu_test (&cmu_test_reader, ct, 0, 0));
+		closure_fork (closure_cmu_test (&cmu_test_reader, ct, 0, 0));
+		closure_fork (closure_cmu_test (&cmu_test_incrementer, ct, ct->limit / 2, i));
+	}
+	nsync_counter_wait (ct->done, nsync_time_no_deadline);
+	if (ct->a != ct->limit) {
+		TEST_ERROR (t, ("test_cmu_readers final count %d, want %d", ct->a, ct->limit));
+	}
+	nsync_counter_free (ct->done);
+	free (ct);
+}
+
+/* Test that nsync_ccv_wait_with_deadline() reports expiry of its deadline
+   and cancellation, and returns with the lock held. */
+static void test_ccv_deadline (testing t) {
+	nsync_cmu mu;
+	nsync_ccv cv;
+	nsync_note cancel;
+	nsync_time start;
+	nsync_time waited;
+	int outcome;
+	nsync_cmu_init (&mu);
+	nsync_ccv_init (&cv);
+	nsync_cmu_lock (&mu);
+	start = nsync_time_now ();
+	do {
+		outcome = nsync_ccv_wait_with_deadline (&cv, &mu,
+			nsync_time_add (start, nsync_time_ms (50)), NULL);
+	} while (outcome == 0);
+	waited = nsync_time_sub (nsync_time_now (), start);
+	if (outcome != ETIMEDOUT) {
+		TEST_ERROR (t, ("nsync_ccv_wait_with_deadline() returned %d, want ETIMEDOUT",
+				outcome));
+	}
+	if (nsync_time_cmp (waited, nsync_time_ms (40)) < 0) {
+		TEST_ERROR (t, ("nsync_ccv_wait_with_deadline() returned after %gs, want >= 0.05s",
+				nsync_time_to_dbl (waited)));
+	}
+	nsync_cmu_assert_held (&mu);
+	nsync_cmu_unlock (&mu);
+
+	cancel = nsync_note_new (NULL, nsync_time_no_deadline);
+	nsync_note_notify (cancel);
+	nsync_cmu_rlock (&mu);
+	do {
+		outcome = nsync_ccv_wait_with_deadline (&cv, &mu, nsync_time_no_deadline, cancel);
+	} while (outcome == 0);
+	if (outcome != ECANCELED) {
+		TEST_ERROR (t, ("nsync_ccv_wait_with_deadline() returned %d, want ECANCELED",
+				outcome));
+	}
+	if (!nsync_cmu_is_reader (&mu)) {
+		TEST_ERROR (t, ("nsync_ccv_wait_with_deadline() returned in wrong mode"));
+	}
+	nsync_cmu_runlock (&mu);
+	nsync_note_free (cancel);
+}
+
+/* --------------------------------------- */
+
 /* An integer protected by a mutex, and with an associated
    condition variable that is signalled when the counter reaches 0. */
 typedef struct counter_s {
@@ -781,6 +1212,441 @@ static void test_rlock (testing t) {
 
 /* --------------------------------------- */
 
+/* The state shared between the threads of test_mu_downgrade() and
+   test_mu_try_upgrade(). */
+typedef struct downgrade_state_s {
+	nsync_mu mu;
+	int value;                 /* protected by mu */
+	nsync_counter readers_in;  /* decremented by each reader once it holds mu */
+	nsync_counter release;     /* readers release mu once this reaches 0 */
+	nsync_counter done;        /* decremented as each thread finishes */
+} downgrade_state;
+
+/* Acquire ds->mu in read mode, and hold it until ds->release reaches 0. */
+static void downgrade_reader (downgrade_state *ds) {
+	nsync_mu_rlock (&ds->mu);
+	nsync_counter_add (ds->readers_in, -1);
+	nsync_counter_wait (ds->release, nsync_time_no_deadline);
+	nsync_mu_runlock (&ds->mu);
+	nsync_counter_add (ds->done, -1);
+}
+
+/* Increment ds->value in write mode. */
+static void downgrade_writer (downgrade_state *ds) {
+	nsync_mu_lock (&ds->mu);
+	ds->value++;
+	nsync_mu_unlock (&ds->mu);
+	nsync_counter_add (ds->done, -1);
+}
+
+CLOSURE_DECL_BODY1 (downgrade, downgrade_state *)
+
+/* Initialize *ds for a test with n_readers readers and n_writers writers. */
+static void downgrade_state_init (downgrade_state *ds, int n_readers, int n_writers) {
+	memset ((void *) ds, 0, sizeof (*ds));
+	ds->readers_in = nsync_counter_new (n_readers);
+	ds->release = nsync_counter_new (1);
+	ds->done = nsync_counter_new (n_readers + n_writers);
+}
+
+/* Wait for the threads using *ds to finish, and free its resources. */
+static void downgrade_state_destroy (downgrade_state *ds) {
+	nsync_counter_wait (ds->done, nsync_time_no_deadline);
+	nsync_counter_free (ds->readers_in);
+	nsync_counter_free (ds->release);
+	nsync_counter_free (ds->done);
+}
+
+/* Test that nsync_mu_downgrade() admits queued readers, but not a writer
+   queued ahead of them. */
+static void test_mu_downgrade (testing t) {
+	enum { n_readers = 3 };
+	int i;
+	downgrade_state ds;
+	downgrade_state_init (&ds, n_readers, 1);
+	nsync_mu_lock (&ds.mu);
+	ds.value = 1;
+	closure_fork (closure_downgrade (&downgrade_writer, &ds));
+	nsync_time_sleep (nsync_time_ms (10)); /* let the writer queue */
+	for (i = 0; i != n_readers; i++) {
+		closure_fork (closure_downgrade (&downgrade_reader, &ds));
+	}
+	nsync_time_sleep (nsync_time_ms (100)); /* let the readers queue */
+	nsync_mu_downgrade (&ds.mu);
+	if (!nsync_mu_is_reader (&ds.mu)) {
+		TEST_ERROR (t, ("nsync_mu_downgrade() did not leave mu held in read mode"));
+	}
+	if (nsync_counter_wait (ds.readers_in,
+				nsync_time_add (nsync_time_now (), nsync_time_ms (10000))) != 0) {
+		TEST_ERROR (t, ("queued readers not admitted by nsync_mu_downgrade()"));
+	}
+	if (ds.value != 1) {
+		TEST_ERROR (t, ("writer acquired mu after nsync_mu_downgrade()"));
+	}
+	nsync_counter_add (ds.release, -1);
+	nsync_mu_runlock (&ds.mu);
+	downgrade_state_destroy (&ds);
+	if (ds.value != 2) {
+		TEST_ERROR (t, ("writer did not run; value %d, want 2", ds.value));
+	}
+}
+
+/* Test that nsync_mu_try_upgrade() succeeds if and only if the caller is the
+   sole reader. */
+static void test_mu_try_upgrade (testing t) {
+	downgrade_state ds;
+	downgrade_state_init (&ds, 1, 0);
+	nsync_mu_rlock (&ds.mu);
+	if (!nsync_mu_try_upgrade (&ds.mu)) {
+		TEST_ERROR (t, ("nsync_mu_try_upgrade() failed for sole reader"));
+	} else {
+		nsync_mu_assert_held (&ds.mu);
+		nsync_mu_downgrade (&ds.mu);
+	}
+	if (!nsync_mu_is_reader (&ds.mu)) {
+		TEST_ERROR (t, ("mu not held in read mode after downgrade"));
+	}
+	nsync_mu_runlock (&ds.mu);
+
+	nsync_mu_rlock (&ds.mu);
+	closure_fork (closure_downgrade (&downgrade_reader, &ds));
+	nsync_counter_wait (ds.readers_in, nsync_time_no_deadline);
+	if (nsync_mu_try_upgrade (&ds.mu)) {
+		TEST_ERROR (t, ("nsync_mu_try_upgrade() succeeded with another reader"));
+		nsync_mu_downgrade (&ds.mu);
+	}
+	if (!nsync_mu_is_reader (&ds.mu)) {
+		TEST_ERROR (t, ("failed nsync_mu_try_upgrade() lost the read lock"));
+	}
+	nsync_counter_add (ds.release, -1);
+	nsync_mu_runlock (&ds.mu);
+	downgrade_state_destroy (&ds);
+}
+
+/* --------------------------------------- */
+
+/* The state shared between the threads of test_mu_lock_with_deadline(). */
+typedef struct deadline_state_s {
+	nsync_mu mu;
+	int value;              /* protected by mu */
+	nsync_time deadline;    /* deadline used by timed lockers */
+	nsync_note cancel;      /* note used by cancelled lockers */
+	nsync_counter done;     /* decremented as each thread finishes */
+	int timed_outcome;      /* outcome of deadline_writer(); set before done */
+	int cancel_outcome;     /* outcome of deadline_cancelled(); set before done */
+	int reader_outcome;     /* outcome of deadline_reader(); set before done */
+} deadline_state;
+
+/* Acquire ds->mu with nsync_mu_lock() and increment ds->value. */
+static void deadline_plain_writer (deadline_state *ds) {
+	nsync_mu_lock (&ds->mu);
+	ds->value++;
+	nsync_mu_unlock (&ds->mu);
+	nsync_counter_add (ds->done, -1);
+}
+
+/* Attempt to acquire ds->mu in write mode before ds->deadline. */
+static void deadline_writer (deadline_state *ds) {
+	ds->timed_outcome = nsync_mu_lock_with_deadline (&ds->mu, ds->deadline, NULL);
+	if (ds->timed_outcome == 0) {
+		ds->value++;
+		nsync_mu_unlock (&ds->mu);
+	}
+	nsync_counter_add (ds->done, -1);
+}
+
+/* Attempt to acquire ds->mu in write mode before ds->cancel is notified. */
+static void deadline_cancelled (deadline_state *ds) {
+	ds->cancel_outcome = nsync_mu_lock_with_deadline (&ds->mu, nsync_time_no_deadline,
+							  ds->cancel);
+	if (ds->cancel_outcome == 0) {
+		ds->value++;
+		nsync_mu_unlock (&ds->mu);
+	}
+	nsync_counter_add (ds->done, -1);
+}
+
+/* Attempt to acquire ds->mu in read mode before ds->deadline. */
+static void deadline_reader (deadline_state *ds) {
+	ds->reader_outcome = nsync_mu_rlock_with_deadline (&ds->mu, ds->deadline, NULL);
+	if (ds->reader_outcome == 0) {
+		nsync_mu_runlock (&ds->mu);
+	}
+	nsync_counter_add (ds->done, -1);
+}
+
+CLOSURE_DECL_BODY1 (deadline, deadline_state *)
+
+/* Test that nsync_mu_lock_with_deadline() and nsync_mu_rlock_with_deadline()
+   give up on expiry and cancellation, without disturbing the waiters queued
+   around them. */
+static void test_mu_lock_with_deadline (testing t) {
+	deadline_state ds;
+	memset ((void *) &ds, 0, sizeof (ds));
+	ds.deadline = nsync_time_add (nsync_time_now (), nsync_time_ms (200));
+	ds.cancel = nsync_note_new (NULL, nsync_time_no_deadline);
+	ds.done = nsync_counter_new (5);
+	nsync_mu_lock (&ds.mu);
+	closure_fork (closure_deadline (&deadline_plain_writer, &ds));
+	nsync_time_sleep (nsync_time_ms (10));
+	closure_fork (closure_deadline (&deadline_writer, &ds));
+	closure_fork (closure_deadline (&deadline_cancelled, &ds));
+	closure_fork (closure_deadline (&deadline_reader, &ds));
+	nsync_time_sleep (nsync_time_ms (10));
+	closure_fork (closure_deadline (&deadline_plain_writer, &ds));
+	nsync_time_sleep (nsync_time_ms (50));
+	nsync_note_notify (ds.cancel);
+	nsync_time_sleep (nsync_time_ms (300)); /* past ds.deadline */
+	nsync_mu_unlock (&ds.mu);
+	nsync_counter_wait (ds.done, nsync_time_no_deadline);
+	if (ds.timed_outcome != ETIMEDOUT) {
+		TEST_ERROR (t, ("nsync_mu_lock_with_deadline() returned %d, want ETIMEDOUT",
+				ds.timed_outcome));
+	}
+	if (ds.cancel_outcome != ECANCELED) {
+		TEST_ERROR (t, ("nsync_mu_lock_with_deadline() returned %d, want ECANCELED",
+				ds.cancel_outcome));
+	}
+	if (ds.reader_outcome != ETIMEDOUT) {
+		TEST_ERROR (t, ("nsync_mu_rlock_with_deadline() returned %d, want ETIMEDOUT",
+				ds.reader_outcome));
+	}
+	if (ds.value != 2) {
+		TEST_ERROR (t, ("queued writers lost; value %d, want 2", ds.value));
+	}
+	if (nsync_mu_lock_with_deadline (&ds.mu, nsync_time_zero, NULL) != 0) {
+		TEST_ERROR (t, ("nsync_mu_lock_with_deadline() failed on a free mu"));
+	} else if (nsync_mu_rtrylock (&ds.mu)) {
+		TEST_ERROR (t, ("nsync_mu_rtrylock() succeeded while mu held"));
+	} else {
+		nsync_mu_unlock (&ds.mu);
+	}
+	if (!nsync_mu_rtrylock (&ds.mu)) {
+		TEST_ERROR (t, ("mu not free after timed-out lockers left"));
+	} else {
+		nsync_mu_runlock (&ds.mu);
+	}
+	nsync_note_free (ds.cancel);
+	nsync_counter_free (ds.done);
+}
+
+/* The body of each thread executed by test_mu_lock_with_deadline_nthread().
+   Increment td->i loop_count times, acquiring td->mu with a short deadline
+   and falling back to nsync_mu_lock() when the deadline expires. */
+static void deadline_loop (test_data *td, int id) {
+	int n = td->loop_count;
+	int i;
+	for (i = 0; i != n; i++) {
+		nsync_time deadline = nsync_time_add (nsync_time_now (),
+						      nsync_time_us ((i % 4) * 20));
+		if (nsync_mu_lock_with_deadline (&td->mu, deadline, NULL) == 0) {
+			td->id = id;
+			td->i++;
+			nsync_time_sleep (nsync_time_us (id + 1));
+			if (td->id != id) {
+				testing_panic ("td->id != id");
+			}
+		} else {
+			nsync_mu_lock (&td->mu);
+			td->i++;
+		}
+		nsync_mu_unlock (&td->mu);
+	}
+	test_data_thread_finished (td);
+}
+
+/* Test that many threads acquiring an nsync_mu with short deadlines neither
+   lose acquisitions nor leave the mu unusable. */
+static void test_mu_lock_with_deadline_nthread (testing t) {
+	int i;
+	test_data td;
+	memset ((void *) &td, 0, sizeof (td));
+	td.t = t;
+	td.n_threads = 8;
+	td.loop_count = 200;
+	td.mu_in_use = &td.mu;
+	td.lock = &void_mu_lock;
+	td.unlock = &void_mu_unlock;
+	for (i = 0; i != td.n_threads; i++) {
+		closure_fork (closure_counting (&deadline_loop, &td, i));
+	}
+	test_data_wait_for_all_threads (&td);
+	if (td.i != td.n_threads * td.loop_count) {
+		TEST_FATAL (t, ("lock_with_deadline final count inconsistent: want %d, got %d",
+				td.n_threads * td.loop_count, td.i));
+	}
+}
+
+/* --------------------------------------- */
+
+/* Test which operations on an nsync_mu invalidate an optimistic read. */
+static void test_mu_read_validate (testing t) {
+	nsync_mu mu;
+	uint32_t v;
+	nsync_mu_init (&mu);
+	v = nsync_mu_read_begin (&mu);
+	if (!nsync_mu_read_validate (&mu, v)) {
+		TEST_ERROR (t, ("optimistic read of a free mu failed to validate"));
+	}
+	nsync_mu_rlock (&mu);
+	nsync_mu_runlock (&mu);
+	if (!nsync_mu_read_validate (&mu, v)) {
+		TEST_ERROR (t, ("read lock invalidated an optimistic read"));
+	}
+	nsync_mu_lock (&mu);
+	if (nsync_mu_read_validate (&mu, v)) {
+		TEST_ERROR (t, ("optimistic read validated while mu held in write mode"));
+	}
+	nsync_mu_unlock (&mu);
+	if (nsync_mu_read_validate (&mu, v)) {
+		TEST_ERROR (t, ("optimistic read validated after a write"));
+	}
+	v = nsync_mu_read_begin (&mu);
+	nsync_mu_lock (&mu);
+	nsync_mu_downgrade (&mu);
+	if (nsync_mu_read_validate (&mu, v)) {
+		TEST_ERROR (t, ("optimistic read validated after a downgraded write"));
+	}
+	v = nsync_mu_read_begin (&mu);
+	if (!nsync_mu_read_validate (&mu, v)) {
+		TEST_ERROR (t, ("optimistic read failed with mu held in read mode"));
+	}
+	nsync_mu_runlock (&mu);
+}
+
+/* The state shared between the threads of test_mu_read_optimistic(). */
+typedef struct optimistic_state_s {
+	nsync_mu mu;
+	volatile int a;        /* a == b whenever mu is free; protected by mu */
+	volatile int b;
+	int writes;            /* number of writes to perform */
+	nsync_counter done;    /* decremented as each thread finishes */
+	int inconsistent;      /* validated reads that saw a != b; under mu */
+	int validated;         /* number of validated reads; under mu */
+} optimistic_state;
+
+/* Update os->a and os->b os->writes times, keeping them equal while os->mu
+   is free. */
+static void optimistic_writer (optimistic_state *os) {
+	int i;
+	for (i = 0; i != os->writes; i++) {
+		nsync_mu_lock (&os->mu);
+		os->a++;
+		if ((i & 15) == 0) {
+			nsync_time_sleep (nsync_time_zero); /* let readers see a != b */
+		}
+		os->b++;
+		nsync_mu_unlock (&os->mu);
+	}
+	nsync_counter_add (os->done, -1);
+}
+
+/* Read os->a and os->b optimistically until the writer finishes, counting
+   reads that validate even though the values were inconsistent. */
+static void optimistic_reader (optimistic_state *os) {
+	int inconsistent = 0;
+	int validated = 0;
+	int a;
+	int b;
+	do {
+		uint32_t v = nsync_mu_read_begin (&os->mu);
+		a = os->a;
+		b = os->b;
+		if (nsync_mu_read_validate (&os->mu, v)) {
+			validated++;
+			inconsistent += (a != b);
+		}
+	} while (a != os->writes || b != os->writes);
+	nsync_mu_lock (&os->mu);
+	os->inconsistent += inconsistent;
+	os->validated += validated;
+	nsync_mu_unlock (&os->mu);
+	nsync_counter_add (os->done, -1);
+}
+
+CLOSURE_DECL_BODY1 (optimistic, optimistic_state *)
+
+/* Test that optimistic reads that validate see consistent data while a
+   writer is active. */
+static void test_mu_read_optimistic (testing t) {
+	enum { n_readers = 4 };
+	int i;
+	optimistic_state os;
+	memset ((void *) &os, 0, sizeof (os));
+	os.writes = 2000;
+	os.done = nsync_counter_new (n_readers + 1);
+	for (i = 0; i != n_readers; i++) {
+		closure_fork (closure_optimistic (&optimistic_reader, &os));
+	}
+	closure_fork (closure_optimistic (&optimistic_writer, &os));
+	nsync_counter_wait (os.done, nsync_time_no_deadline);
+	nsync_counter_free (os.done);
+	if (os.inconsistent != 0) {
+		TEST_ERROR (t, ("%d of %d validated optimistic reads were inconsistent",
+				os.inconsistent, os.validated));
+	}
+	if (os.validated < n_readers) {
+		TEST_ERROR (t, ("only %d optimistic reads validated", os.validated));
+	}
+}
+
+/* --------------------------------------- */
+
+/* Increment the counter in the test_data *v; called via
+   nsync_mu_run_locked (&td->mu, ...). */
+static void run_locked_increment (void *v) {
+	test_data *td = (test_data *) v;
+	nsync_mu_assert_held (&td->mu);
+	td->i++;
+}
+
+/* The body of each thread executed by test_mu_run_locked().  Even threads
+   increment td->i via nsync_mu_run_locked(), odd threads alternate between
+   that and nsync_mu_lock(). */
+static void run_locked_loop (test_data *td, int id) {
+	int n = td->loop_count;
+	int i;
+	for (i = 0; i != n; i++) {
+		if ((id & i & 1) == 0) {
+			nsync_mu_run_locked (&td->mu, &run_locked_increment, td);
+		} else {
+			nsync_mu_lock (&td->mu);
+			td->i++;
+			nsync_mu_unlock (&td->mu);
+		}
+	}
+	test_data_thread_finished (td);
+}
+
+/* Test that calls made via nsync_mu_run_locked() are mutually exclusive with
+   each other and with ordinary holders of the mu, and that none are lost. */
+static void test_mu_run_locked (testing t) {
+	int i;
+	test_data td;
+	memset ((void *) &td, 0, sizeof (td));
+	td.t = t;
+	td.n_threads = 8;
+	td.loop_count = 20000;
+	td.mu_in_use = &td.mu;
+	td.lock = &void_mu_lock;
+	td.unlock = &void_mu_unlock;
+	/* Hold the mu while the threads start, so that their first calls are
+	   published and run in a batch. */
+	nsync_mu_lock (&td.mu);
+	for (i = 0; i != td.n_threads; i++) {
+		closure_fork (closure_counting (&run_locked_loop, &td, i));
+	}
+	nsync_time_sleep (nsync_time_ms (10));
+	nsync_mu_unlock (&td.mu);
+	test_data_wait_for_all_threads (&td);
+	if (td.i != td.n_threads * td.loop_count) {
+		TEST_FATAL (t, ("test_mu_run_locked final count inconsistent: want %d, got %d",
+				td.n_threads * td.loop_count, td.i));
+	}
+}
+
+/* --------------------------------------- */
+
 /* Measure the performance of an uncontended nsync_mu. */
 static void benchmark_mu_uncontended (testing t) {
 	int i;
@@ -793,6 +1659,18 @@ static void benchmark_mu_uncontended (testing t) {
 	}
 }
 
+/* Measure the performance of an uncontended nsync_cmu. */
+static void benchmark_cmu_uncontended (testing t) {
+	int i;
+	int n = testing_n (t);
+	nsync_cmu mu;
+	nsync_cmu_init (&mu);
+	for (i = 0; i != n; i++) {
+		nsync_cmu_lock (&mu);
+		nsync_cmu_unlock (&mu);
+	}
+}
+
 /* Return whether int *value is one. */
 static int int_is_1 (const void *value) { return (*(const int *)value == 1); }
 
@@ -871,6 +1749,122 @@ static void benchmark_rmu_uncontended (testing t) {
 	}
 }
 
+/* The state shared between the threads of reader_scaling_run(). */
+typedef struct reader_scaling_s {
+	int n;            /* iterations per thread */
+	void *mu;         /* lock acquired in read mode by each thread */
+	void (*rlock) (void *);
+	void (*runlock) (void *);
+	nsync_counter done; /* decremented as each thread finishes */
+} reader_scaling;
+
+/* Acquire and release rs->mu in read mode rs->n times. */
+static void reader_scaling_loop (reader_scaling *rs) {
+	int i;
+	for (i = 0; i != rs->n; i++) {
+		(*rs->rlock) (rs->mu);
+		(*rs->runlock) (rs->mu);
+	}
+	nsync_counter_add (rs->done, -1);
+}
+
+CLOSURE_DECL_BODY1 (reader_scaling_loop, reader_scaling *)
+
+/* Run n_threads threads, each of which acquires and releases *mu in read
+   mode testing_n (t) times.  On a multiprocessor, the time per operation
+   shows how read throughput scales with the number of readers. */
+static void reader_scaling_run (testing t, int n_threads, void *mu,
+				void (*rlock) (void *), void (*runlock) (void *)) {
+	int i;
+	reader_scaling rs;
+	rs.n = testing_n (t);
+	rs.mu = mu;
+	rs.rlock = rlock;
+	rs.runlock = runlock;
+	rs.done = nsync_counter_new (n_threads);
+	for (i = 0; i != n_threads; i++) {
+		closure_fork (closure_reader_scaling_loop (&reader_scaling_loop, &rs));
+	}
+	nsync_counter_wait (rs.done, nsync_time_no_deadline);
+	nsync_counter_free (rs.done);
+}
+
+/* Versions of the read-mode lock operations that take "void *" arguments. */
+static void void_mu_rlock (void *mu) {
+	nsync_mu_rlock ((nsync_mu *) mu);
+}
+static void void_mu_runlock (void *mu) {
+	nsync_mu_runlock ((nsync_mu *) mu);
+}
+static void void_brmu_rlock (void *mu) {
+	nsync_brmu_rlock ((nsync_brmu *) mu);
+}
+static void void_brmu_runlock (void *mu) {
+	nsync_brmu_runlock ((nsync_brmu *) mu);
+}
+
+/* An optimistic read of an nsync_mu, retried until it validates, and a no-op
+   to pair with it in reader_scaling_run(). */
+static void void_mu_read_optimistic (void *mu) {
+	uint32_t version;
+	do {
+		version = nsync_mu_read_begin ((nsync_mu *) mu);
+	} while (!nsync_mu_read_validate ((nsync_mu *) mu, version));
+}
+static void void_mu_read_done (void *mu) {
+	(void) mu;
+}
+
+/* Measure read throughput of an nsync_mu with 1, 4, and 16 readers. */
+static void benchmark_rmu_readers (testing t, int n_threads) {
+	nsync_mu mu;
+	nsync_mu_init (&mu);
+	reader_scaling_run (t, n_threads, &mu, &void_mu_rlock, &void_mu_runlock);
+}
+static void benchmark_rmu_readers_1 (testing t) {
+	benchmark_rmu_readers (t, 1);
+}
+static void benchmark_rmu_readers_4 (testing t) {
+	benchmark_rmu_readers (t, 4);
+}
+static void benchmark_rmu_readers_16 (testing t) {
+	benchmark_rmu_readers (t, 16);
+}
+
+/* Measure read throughput of an nsync_brmu with 1, 4, and 16 readers. */
+static void benchmark_brmu_readers (testing t, int n_threads) {
+	nsync_brmu *b = (nsync_brmu *) malloc (sizeof (*b));
+	nsync_brmu_init (b);
+	reader_scaling_run (t, n_threads, b, &void_brmu_rlock, &void_brmu_runlock);
+	free (b);
+}
+static void benchmark_brmu_readers_1 (testing t) {
+	benchmark_brmu_readers (t, 1);
+}
+static void benchmark_brmu_readers_4 (testing t) {
+	benchmark_brmu_readers (t, 4);
+}
+static void benchmark_brmu_readers_16 (testing t) {
+	benchmark_brmu_readers (t, 16);
+}
+
+/* Measure read throughput of optimistic reads of an nsync_mu with 1, 4, and
+   16 readers. */
+static void benchmark_mu_optimistic_readers (testing t, int n_threads) {
+	nsync_mu mu;
+	nsync_mu_init (&mu);
+	reader_scaling_run (t, n_threads, &mu, &void_mu_read_optimistic, &void_mu_read_done);
+}
+static void benchmark_mu_optimistic_readers_1 (testing t) {
+	benchmark_mu_optimistic_readers (t, 1);
+}
+static void benchmark_mu_optimistic_readers_4 (testing t) {
+	benchmark_mu_optimistic_readers (t, 4);
+}
+static void benchmark_mu_optimistic_readers_16 (testing t) {
+	benchmark_mu_optimistic_readers (t, 16);
+}
+
 /* Measure the performance of an uncontended nsync_mu
    in read mode with a blocked waiter. */
 static void benchmark_rmu_uncontended_waiter (testing t) {
@@ -995,12 +1989,12 @@ CLOSURE_DECL_BODY4 (contended_state_contend_loop, contended_state *, void *, fun
 
 /* Start the threads in a contended test, wait for them to finish,
    and print the number of iterations achieved. */
-static void contended_state_run_test (contended_state *cs, testing t,
+static void contended_state_run_test (contended_state *cs, testing t, int n_threads,
 				      void *mu, void (*lock) (void *),
 				      void (*unlock) (void *)) {
 	int i;
 	cs->t = t;
-	cs->not_yet_done = 4; /* number of threads */
+	cs->not_yet_done = n_threads;
 	cs->start = 0;
 	cs->count = 0;
 	for (i = 0; i != cs->not_yet_done; i++) {
@@ -1014,12 +2008,258 @@ static void contended_state_run_test (contended_state *cs, testing t,
 }
 
 /* Measure the performance of highly contended
-   nsync_mu locks, with small critical sections.  */
+   nsync_mu locks, with small critical sections.
+   Also report the number of semaphore calls into the kernel per acquisition,
+   where the platform counts them.  */
 static void benchmark_mu_contended (testing t) {
 	contended_state cs;
+	uint32_t syscalls;
 	memset (&cs, 0, sizeof (cs));
-	contended_state_run_test (&cs, t, &cs.mu, (void (*) (void*))&nsync_mu_lock,
+	ATM_STORE (&nsync_mu_semaphore_sleeps_, 0);
+	ATM_STORE (&nsync_mu_semaphore_wakes_, 0);
+	ATM_STORE (&nsync_mu_semaphore_stats_enabled_, 1);
+	contended_state_run_test (&cs, t, 4, &cs.mu, (void (*) (void*))&nsync_mu_lock,
 				  (void (*) (void*))&nsync_mu_unlock);
+	ATM_STORE (&nsync_mu_semaphore_stats_enabled_, 0);
+	syscalls = ATM_LOAD (&nsync_mu_semaphore_sleeps_) +
+		   ATM_LOAD (&nsync_mu_semaphore_wakes_);
+	BENCHMARK_EXTRA (t, ("%.3g syscalls/acquisition",
+			     ((double) syscalls) / (cs.count == 0? 1 : cs.count)));
+}
+
+/* Measure the performance of an nsync_mu contended by many threads, so
+   that most of them are queued at any time.  */
+static void benchmark_mu_contended_64 (testing t) {
+	contended_state cs;
+	memset (&cs, 0, sizeof (cs));
+	contended_state_run_test (&cs, t, 64, &cs.mu, (void (*) (void*))&nsync_mu_lock,
+				  (void (*) (void*))&nsync_mu_unlock);
+}
+
+/* Measure the performance of highly contended nsync_cmu locks, with small
+   critical sections; compare with benchmark_mu_contended.  */
+static void benchmark_cmu_contended (testing t) {
+	contended_state cs;
+	nsync_cmu cmu;
+	memset (&cs, 0, sizeof (cs));
+	nsync_cmu_init (&cmu);
+	contended_state_run_test (&cs, t, 4, &cmu, &void_cmu_lock, &void_cmu_unlock);
+}
+
+/* Increment the counter in the contended_state *v; called via
+   nsync_mu_run_locked (&cs->mu, ...). */
+static void contended_state_increment (void *v) {
+	((contended_state *) v)->count++;
+}
+
+/* As contended_state_contend_loop(), but delegate each increment of cs.count
+   to nsync_mu_run_locked(). */
+static void contended_state_run_locked_loop (contended_state *cs) {
+	int n = testing_n (cs->t);
+	int j;
+	int i;
+	nsync_mu_rlock (&cs->start_done_mu);
+	nsync_mu_wait (&cs->start_done_mu, &contended_state_may_start, cs, NULL);
+	nsync_mu_runlock (&cs->start_done_mu);
+
+	for (j = 0; j < n; j += 10000) {
+		for (i = 0; i != 10000; i++) {
+			nsync_mu_run_locked (&cs->mu, &contended_state_increment, cs);
+		}
+	}
+
+	nsync_mu_lock (&cs->start_done_mu);
+	cs->not_yet_done--;
+	nsync_mu_unlock (&cs->start_done_mu);
+}
+
+CLOSURE_DECL_BODY1 (contended_state_run_locked_loop, contended_state *)
+
+/* Measure the performance of highly contended nsync_mu locks, with small
+   critical sections run via nsync_mu_run_locked(); compare with
+   benchmark_mu_contended.  */
+static void benchmark_mu_contended_run_locked (testing t) {
+	contended_state cs;
+	int i;
+	memset (&cs, 0, sizeof (cs));
+	cs.t = t;
+	cs.not_yet_done = 4;
+	for (i = 0; i != cs.not_yet_done; i++) {
+		closure_fork (closure_contended_state_run_locked_loop (
+			&contended_state_run_locked_loop, &cs));
+	}
+	nsync_mu_lock (&cs.start_done_mu);
+	cs.start = 1;
+	nsync_mu_wait (&cs.start_done_mu, &contended_state_all_done, &cs, NULL);
+	nsync_mu_unlock (&cs.start_done_mu);
+}
+
+/* The state shared between the short-lived threads of benchmark_mu_thread_churn()
+   and test_mu_thread_churn(). */
+typedef struct churn_state_s {
+	nsync_mu mu;
+	nsync_cv cv;
+	int prewarm;         /* whether threads call nsync_thread_prewarm(); constant */
+	int count;           /* protected by mu */
+	nsync_counter done;  /* decremented as each thread finishes */
+} churn_state;
+
+/* Block briefly on cs->cv, as a thread handling a request might, then exit.
+   The wait obtains a waiter struct for the thread, and the exit recycles it. */
+static void churn_thread (churn_state *cs) {
+	if (cs->prewarm) {
+		nsync_thread_prewarm ();
+	}
+	nsync_mu_lock (&cs->mu);
+	cs->count++;
+	nsync_cv_wait_with_deadline (&cs->cv, &cs->mu, nsync_time_zero, NULL);
+	nsync_mu_unlock (&cs->mu);
+	nsync_counter_add (cs->done, -1);
+}
+
+CLOSURE_DECL_BODY1 (churn, churn_state *)
+
+/* Create and wait for n short-lived threads, up to 8 at a time, each of
+   which uses churn_thread() on *cs. */
+static void churn_run (churn_state *cs, int n) {
+	int i;
+	for (i = 0; i < n; i += 8) {
+		int j;
+		int batch = (n - i < 8? n - i : 8);
+		cs->done = nsync_counter_new (batch);
+		for (j = 0; j != batch; j++) {
+			closure_fork (closure_churn (&churn_thread, cs));
+		}
+		nsync_counter_wait (cs->done, nsync_time_no_deadline);
+		nsync_counter_free (cs->done);
+	}
+}
+
+/* Test that waiter structs survive being recycled through many short-lived
+   threads, with and without nsync_thread_prewarm(). */
+static void test_mu_thread_churn (testing t) {
+	churn_state cs;
+	memset ((void *) &cs, 0, sizeof (cs));
+	churn_run (&cs, 200);
+	cs.prewarm = 1;
+	churn_run (&cs, 200);
+	if (cs.count != 400) {
+		TEST_ERROR (t, ("churn threads ran %d times, want 400", cs.count));
+	}
+}
+
+/* Measure the cost of creating a thread that blocks once in nsync and then
+   exits, recycling its waiter struct. */
+static void benchmark_mu_thread_churn (testing t) {
+	churn_state cs;
+	memset ((void *) &cs, 0, sizeof (cs));
+	churn_run (&cs, testing_n (t));
+}
+
+/* The state shared by the threads of test_mu_reader_fanout() and
+   benchmark_mu_reader_fanout(). */
+typedef struct fanout_state_s {
+	nsync_mu mu;          /* held by the writer while readers queue on it */
+	nsync_mu control_mu;  /* protects the fields below */
+	nsync_cv round_cv;    /* broadcast when round increases */
+	int readers;          /* number of reader threads; constant */
+	int rounds;           /* number of rounds; constant */
+	int round;            /* rounds started by the writer */
+	int queued;           /* number of times a reader has been about to block */
+	int acquired;         /* number of times a reader has acquired mu */
+	nsync_time unlock_time; /* total time spent in the writer's unlocks */
+	nsync_counter running;  /* number of reader threads still running */
+} fanout_state;
+
+/* Return whether every reader has reached the point of blocking in the
+   current round. */
+static int fanout_all_queued (const void *v) {
+	const fanout_state *fs = (const fanout_state *) v;
+	return (fs->queued == fs->readers * fs->round);
+}
+
+/* Return whether every reader has acquired fs->mu in the current round. */
+static int fanout_all_acquired (const void *v) {
+	const fanout_state *fs = (const fanout_state *) v;
+	return (fs->acquired == fs->readers * fs->round);
+}
+
+/* In each round, block in nsync_mu_rlock() while the writer holds fs->mu. */
+static void fanout_reader (fanout_state *fs) {
+	int r;
+	for (r = 0; r != fs->rounds; r++) {
+		nsync_mu_lock (&fs->control_mu);
+		while (fs->round <= r) {
+			nsync_cv_wait (&fs->round_cv, &fs->control_mu);
+		}
+		fs->queued++;
+		nsync_mu_unlock (&fs->control_mu);
+		nsync_mu_rlock (&fs->mu);
+		nsync_mu_runlock (&fs->mu);
+		nsync_mu_lock (&fs->control_mu);
+		fs->acquired++;
+		nsync_mu_unlock (&fs->control_mu);
+	}
+	nsync_counter_add (fs->running, -1);
+}
+
+CLOSURE_DECL_BODY1 (fanout_reader, fanout_state *)
+
+/* Run fs->rounds rounds in which fs->readers readers queue on fs->mu while
+   it is held by the calling thread, and then are released together. */
+static void fanout_run (fanout_state *fs) {
+	int i;
+	fs->running = nsync_counter_new (fs->readers);
+	for (i = 0; i != fs->readers; i++) {
+		closure_fork (closure_fanout_reader (&fanout_reader, fs));
+	}
+	for (i = 0; i != fs->rounds; i++) {
+		nsync_time start;
+		nsync_mu_lock (&fs->mu);
+		nsync_mu_lock (&fs->control_mu);
+		fs->round++;
+		nsync_cv_broadcast (&fs->round_cv);
+		nsync_mu_wait (&fs->control_mu, &fanout_all_queued, fs, NULL);
+		nsync_mu_unlock (&fs->control_mu);
+		/* Give the readers time to block on fs->mu. */
+		nsync_time_sleep (nsync_time_ms (1));
+		start = nsync_time_now ();
+		nsync_mu_unlock (&fs->mu);
+		fs->unlock_time = nsync_time_add (fs->unlock_time,
+						  nsync_time_sub (nsync_time_now (), start));
+		nsync_mu_lock (&fs->control_mu);
+		nsync_mu_wait (&fs->control_mu, &fanout_all_acquired, fs, NULL);
+		nsync_mu_unlock (&fs->control_mu);
+	}
+	nsync_counter_wait (fs->running, nsync_time_no_deadline);
+	nsync_counter_free (fs->running);
+}
+
+/* Test that a writer's unlock releases every reader queued behind it,
+   however the wakeups are passed among the readers. */
+static void test_mu_reader_fanout (testing t) {
+	fanout_state fs;
+	memset ((void *) &fs, 0, sizeof (fs));
+	fs.readers = 33;
+	fs.rounds = 50;
+	fanout_run (&fs);
+	if (fs.acquired != fs.readers * fs.rounds) {
+		TEST_ERROR (t, ("readers acquired %d times, want %d",
+				fs.acquired, fs.readers * fs.rounds));
+	}
+}
+
+/* Measure the cost of a round in which 64 readers queued behind a writer
+   are released by its unlock.  Also report the time the writer spends in
+   nsync_mu_unlock(), which includes waking the readers.  */
+static void benchmark_mu_reader_fanout (testing t) {
+	fanout_state fs;
+	memset ((void *) &fs, 0, sizeof (fs));
+	fs.readers = 64;
+	fs.rounds = testing_n (t);
+	fanout_run (&fs);
+	BENCHMARK_EXTRA (t, ("%.3gus/writer unlock",
+			     nsync_time_to_dbl (fs.unlock_time) * 1e6 / fs.rounds));
 }
 
 /* Measure the performance of highly contended
@@ -1028,7 +2268,7 @@ static void benchmark_mutex_contended (testing t) {
 	contended_state cs;
 	memset (&cs, 0, sizeof (cs));
 	pthread_mutex_init (&cs.mutex, NULL);
-	contended_state_run_test (&cs, t, &cs.mutex, &void_pthread_mutex_lock,
+	contended_state_run_test (&cs, t, 4, &cs.mutex, &void_pthread_mutex_lock,
 				  &void_pthread_mutex_unlock);
 	pthread_mutex_destroy (&cs.mutex);
 }
@@ -1039,7 +2279,7 @@ static void benchmark_wmutex_contended (testing t) {
 	contended_state cs;
 	memset (&cs, 0, sizeof (cs));
 	pthread_rwlock_init (&cs.rwmutex, NULL);
-	contended_state_run_test (&cs, t, &cs.rwmutex, &void_pthread_rwlock_wrlock,
+	contended_state_run_test (&cs, t, 4, &cs.rwmutex, &void_pthread_rwlock_wrlock,
 				  &void_pthread_rwlock_unlock);
 	pthread_rwlock_destroy (&cs.rwmutex);
 }
@@ -1048,17 +2288,38 @@ int main (int argc, char *argv[]) {
 	testing_base tb = testing_new (argc, argv, 0);
 
 	TEST_RUN (tb, test_rlock);
+	TEST_RUN (tb, test_mu_downgrade);
+	TEST_RUN (tb, test_mu_try_upgrade);
+	TEST_RUN (tb, test_mu_lock_with_deadline);
+	TEST_RUN (tb, test_mu_lock_with_deadline_nthread);
+	TEST_RUN (tb, test_mu_run_locked);
+	TEST_RUN (tb, test_mu_read_validate);
+	TEST_RUN (tb, test_mu_read_optimistic);
+	TEST_RUN (tb, test_mu_thread_churn);
+	TEST_RUN (tb, test_mu_reader_fanout);
 	TEST_RUN (tb, test_mu_nthread);
 	TEST_RUN (tb, test_mutex_nthread);
 	TEST_RUN (tb, test_rwmutex_nthread);
 	TEST_RUN (tb, test_try_mu_nthread);
+	TEST_RUN (tb, test_brmu_nthread);
+	TEST_RUN (tb, test_brmu_readers);
+	TEST_RUN (tb, test_brmu_stack_depth);
+	TEST_RUN (tb, test_cmu_nthread);
+	TEST_RUN (tb, test_cmu_readers);
+	TEST_RUN (tb, test_ccv_deadline);
 
 	BENCHMARK_RUN (tb, benchmark_mu_contended);
+	BENCHMARK_RUN (tb, benchmark_mu_contended_64);
+	BENCHMARK_RUN (tb, benchmark_mu_contended_run_locked);
+	BENCHMARK_RUN (tb, benchmark_cmu_contended);
+	BENCHMARK_RUN (tb, benchmark_mu_thread_churn);
+	BENCHMARK_RUN (tb, benchmark_mu_reader_fanout);
 	BENCHMARK_RUN (tb, benchmark_mutex_contended);
 	BENCHMARK_RUN (tb, benchmark_wmutex_contended);
 
 	BENCHMARK_RUN (tb, benchmark_mu_uncontended);
 	BENCHMARK_RUN (tb, benchmark_rmu_uncontended);
+	BENCHMARK_RUN (tb, benchmark_cmu_uncontended);
 	BENCHMARK_RUN (tb, benchmark_mutex_uncontended);
 	BENCHMARK_RUN (tb, benchmark_wmutex_uncontended);
 	BENCHMARK_RUN (tb, benchmark_rmutex_uncontended);
@@ -1066,5 +2327,15 @@ int main (int argc, char *argv[]) {
 	BENCHMARK_RUN (tb, benchmark_mu_uncontended_no_wakeup);
 	BENCHMARK_RUN (tb, benchmark_rmu_uncontended_waiter);
 
+	BENCHMARK_RUN (tb, benchmark_rmu_readers_1);
+	BENCHMARK_RUN (tb, benchmark_rmu_readers_4);
+	BENCHMARK_RUN (tb, benchmark_rmu_readers_16);
+	BENCHMARK_RUN (tb, benchmark_brmu_readers_1);
+	BENCHMARK_RUN (tb, benchmark_brmu_readers_4);
+	BENCHMARK_RUN (tb, benchmark_brmu_readers_16);
+	BENCHMARK_RUN (tb, benchmark_mu_optimistic_readers_1);
+	BENCHMARK_RUN (tb, benchmark_mu_optimistic_readers_4);
+	BENCHMARK_RUN (tb, benchmark_mu_optimistic_readers_16);
+
 	return (testing_base_exit (tb));
 }
@@ -325,6 +325,194 @@ static void test_mu_cancel (testing t) {
 	}
 }
 
+/* --------------------------- */
+
+/* The state shared by the threads of test_mu_wait_interleaved() and
+   benchmark_mu_wait_distinct(). */
+typedef struct level_state_s {
+	int n_waiters;    /* number of waiters; constant after init */
+	int distinct;     /* number of distinct targets; constant after init */
+	nsync_mu mu;      /* protects fields below */
+	int level;        /* waiters return once level reaches their targets */
+	int queued;       /* number of waiters that have called nsync_mu_wait() */
+	int woken;        /* number of waiters that have returned */
+	int evaluations;  /* calls of level_reached() */
+	nsync_counter done; /* decremented by each waiter as it finishes */
+} level_state;
+
+/* The argument of a waiter's wait condition. */
+typedef struct level_arg_s {
+	level_state *ls;
+	int target;
+	uint32_t mask; /* condition mask: the bit for the target */
+} level_arg;
+
+/* Return whether the level has reached the target in *v, a level_arg. */
+static int level_reached (const void *v) {
+	const level_arg *a = (const level_arg *) v;
+	a->ls->evaluations++;
+	return (a->ls->level >= a->target);
+}
+
+/* Return whether the level_args *a and *b have the same target. */
+static int level_arg_eq (const void *a, const void *b) {
+	return (((const level_arg *) a)->target == ((const level_arg *) b)->target);
+}
+
+/* Wait until the level reaches the target in *a, comparing conditions with
+   level_arg_eq() if use_eq is non-zero. */
+static void level_waiter (level_arg *a, int use_eq) {
+	level_state *ls = a->ls;
+	nsync_mu_lock (&ls->mu);
+	ls->queued++;
+	nsync_mu_wait_with_deadline_and_mask (&ls->mu, &level_reached, a,
+					      use_eq? &level_arg_eq : NULL, a->mask,
+					      nsync_time_no_deadline, NULL);
+	ls->woken++;
+	nsync_mu_unlock (&ls->mu);
+	nsync_counter_add (ls->done, -1);
+}
+
+CLOSURE_DECL_BODY2 (level_waiter, level_arg *, int)
+
+/* Return whether every waiter has called nsync_mu_wait(); *v is a level_state. */
+static int level_all_queued (const void *v) {
+	const level_state *ls = (const level_state *) v;
+	return (ls->queued == ls->n_waiters);
+}
+
+/* Return whether exactly the waiters whose targets have been reached have
+   returned; *v is a level_state. */
+static int level_all_woken (const void *v) {
+	const level_state *ls = (const level_state *) v;
+	return (ls->woken == ls->level * (ls->n_waiters / ls->distinct));
+}
+
+/* Initialize *ls and start n waiters on it, waiter i waiting for the level to
+   reach 1 + (i % distinct), so that waiters with equal conditions are not
+   adjacent in the queue.  The condition of waiter i has mask
+   1 << (i % distinct).  If use_eq is zero, waiters with the same target
+   share a condition argument; otherwise each has its own, and equal
+   conditions can be recognized only via level_arg_eq().  Return with all the
+   waiters queued and ls->mu held.  The caller should free the returned array
+   once the waiters finish.  */
+static level_arg *level_start_waiters (level_state *ls, int n, int distinct, int use_eq) {
+	int i;
+	level_arg *args = (level_arg *) malloc (n * sizeof (args[0]));
+	memset ((void *) ls, 0, sizeof (*ls));
+	ls->n_waiters = n;
+	ls->distinct = distinct;
+	ls->done = nsync_counter_new (n);
+	for (i = 0; i != n; i++) {
+		args[i].ls = ls;
+		args[i].target = 1 + (i % distinct);
+		args[i].mask = ((uint32_t) 1) << (i % distinct);
+		closure_fork (closure_level_waiter (&level_waiter,
+						    &args[use_eq? i : i % distinct], use_eq));
+	}
+	nsync_mu_lock (&ls->mu);
+	nsync_mu_wait (&ls->mu, &level_all_queued, ls, NULL);
+	return (args);
+}
+
+/* Test that an unlock evaluates each distinct wait condition at most once,
+   even when waiters with equal conditions are interleaved in the queue, and
+   that waiters are woken when their conditions become true. */
+static void test_mu_wait_interleaved (testing t) {
+	int use_eq;
+	for (use_eq = 0; use_eq != 2; use_eq++) {
+		enum { n = 40, distinct = 4, unlocks = 10 };
+		level_state ls;
+		level_arg *args = level_start_waiters (&ls, n, distinct, use_eq);
+		int i;
+		ls.evaluations = 0;
+		for (i = 0; i != unlocks; i++) {
+			nsync_mu_unlock (&ls.mu);
+			nsync_mu_lock (&ls.mu);
+		}
+		if (ls.evaluations > unlocks * distinct) {
+			TEST_ERROR (t, ("use_eq=%d: %d evaluations in %d unlocks, want at most %d",
+					use_eq, ls.evaluations, unlocks, unlocks * distinct));
+		}
+		for (i = 1; i <= distinct; i++) {
+			ls.level = i;
+			nsync_mu_wait (&ls.mu, &level_all_woken, &ls, NULL);
+		}
+		nsync_mu_unlock (&ls.mu);
+		nsync_counter_wait (ls.done, nsync_time_no_deadline);
+		nsync_counter_free (ls.done);
+		free (args);
+	}
+}
+
+/* Test that nsync_mu_unlock_with_mask() evaluates only the conditions whose
+   masks intersect the changed mask, and still wakes their waiters. */
+static void test_mu_unlock_with_mask (testing t) {
+	enum { n = 8, distinct = 2 };
+	level_state ls;
+	level_arg *args = level_start_waiters (&ls, n, distinct, 0);
+	/* An unlock that evaluates every condition and finds all false. */
+	nsync_mu_unlock (&ls.mu);
+	nsync_mu_lock (&ls.mu);
+	ls.evaluations = 0;
+	nsync_mu_unlock_with_mask (&ls.mu, 0x4);
+	nsync_mu_lock (&ls.mu);
+	if (ls.evaluations != 0) {
+		TEST_ERROR (t, ("unrelated change caused %d evaluations, want 0",
+				ls.evaluations));
+	}
+	nsync_mu_unlock_with_mask (&ls.mu, 0x2);
+	nsync_mu_lock (&ls.mu);
+	if (ls.evaluations != 1) {
+		TEST_ERROR (t, ("change to one condition's state caused %d evaluations, "
+				"want 1", ls.evaluations));
+	}
+	ls.level = 1;
+	nsync_mu_unlock_with_mask (&ls.mu, 0x1);
+	nsync_mu_lock (&ls.mu);
+	nsync_mu_wait (&ls.mu, &level_all_woken, &ls, NULL);
+	ls.level = 2;
+	nsync_mu_unlock_with_mask (&ls.mu, 0x2);
+	nsync_counter_wait (ls.done, nsync_time_no_deadline);
+	if (ls.woken != n) {
+		TEST_ERROR (t, ("%d waiters woken, want %d", ls.woken, n));
+	}
+	nsync_counter_free (ls.done);
+	free (args);
+}
+
+/* Measure the cost of unlocking an nsync_mu with 64 conditional waiters,
+   none of which can proceed, with "distinct" distinct conditions
+   interleaved in the queue.  Also report the number of condition
+   evaluations per unlock. */
+static void benchmark_mu_wait_distinct (testing t, int distinct) {
+	int i;
+	int n = testing_n (t);
+	level_state ls;
+	level_arg *args = level_start_waiters (&ls, 64, distinct, 0);
+	ls.evaluations = 0;
+	for (i = 0; i != n; i++) {
+		nsync_mu_unlock (&ls.mu);
+		nsync_mu_lock (&ls.mu);
+	}
+	BENCHMARK_EXTRA (t, ("%.3g evaluations/unlock",
+			     ((double) ls.evaluations) / (n == 0? 1 : n)));
+	ls.level = distinct;
+	nsync_mu_unlock (&ls.mu);
+	nsync_counter_wait (ls.done, nsync_time_no_deadline);
+	nsync_counter_free (ls.done);
+	free (args);
+}
+static void benchmark_mu_wait_distinct_1 (testing t) {
+	benchmark_mu_wait_distinct (t, 1);
+}
+static void benchmark_mu_wait_distinct_8 (testing t) {
+	benchmark_mu_wait_distinct (t, 8);
+}
+static void benchmark_mu_wait_distinct_64 (testing t) {
+	benchmark_mu_wait_distinct (t, 64);
+}
+
 int main (int argc, char *argv[]) {
 	testing_base tb = testing_new (argc, argv, 0);
 	TEST_RUN (tb, test_mu_producer_consumer0);
@@ -336,5 +524,11 @@ int main (int argc, char *argv[]) {
 	TEST_RUN (tb, test_mu_producer_consumer6);
 	TEST_RUN (tb, test_mu_deadline);
 	TEST_RUN (tb, test_mu_cancel);
+	TEST_RUN (tb, test_mu_wait_interleaved);
+	TEST_RUN (tb, test_mu_unlock_with_mask);
+
+	BENCHMARK_RUN (tb, benchmark_mu_wait_distinct_1);
+	BENCHMARK_RUN (tb, benchmark_mu_wait_distinct_8);
+	BENCHMARK_RUN (tb, benchmark_mu_wait_distinct_64);
 	return (testing_base_exit (tb));
 }
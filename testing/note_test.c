@@ -14,6 +14,8 @@
 
 #include "platform.h"
 #include "nsync.h"
+#include "atomic.h"
+#include "slab.h"
 #include "time_extra.h"
 #include "smprintf.h"
 #include "closure.h"
@@ -321,6 +323,232 @@ static void test_note_in_tree (testing t) {
 	}
 }
 
+/* The number of notes in the chain built by test_note_deep_tree(). */
+#define DEEP_TREE_DEPTH 100000
+
+/* Test that notifying the root of a long chain of notes notifies every note
+   in it, and that the chain can then be freed from either end.  */
+static void test_note_deep_tree (testing t) {
+	nsync_note *node = (nsync_note *) malloc (DEEP_TREE_DEPTH * sizeof (node[0]));
+	int i;
+	node[0] = nsync_note_new (NULL, nsync_time_no_deadline);
+	for (i = 1; i != DEEP_TREE_DEPTH; i++) {
+		node[i] = nsync_note_new (node[i-1], nsync_time_no_deadline);
+	}
+	nsync_note_notify (node[0]);
+	for (i = 0; i != DEEP_TREE_DEPTH; i++) {
+		if (!nsync_note_is_notified (node[i])) {
+			TEST_ERROR (t, ("note %d of a notified chain is not notified", i));
+			break;
+		}
+	}
+	for (i = 0; i != DEEP_TREE_DEPTH; i++) {
+		nsync_note_free (node[i]);
+	}
+
+	/* Free the middle of an unnotified chain first; the lower half is
+	   adopted by the upper half, and is notified with it. */
+	node[0] = nsync_note_new (NULL, nsync_time_no_deadline);
+	for (i = 1; i != DEEP_TREE_DEPTH; i++) {
+		node[i] = nsync_note_new (node[i-1], nsync_time_no_deadline);
+	}
+	nsync_note_free (node[DEEP_TREE_DEPTH / 2]);
+	nsync_note_notify (node[0]);
+	for (i = 0; i != DEEP_TREE_DEPTH; i++) {
+		if (i != DEEP_TREE_DEPTH / 2 && !nsync_note_is_notified (node[i])) {
+			TEST_ERROR (t, ("note %d of a notified chain is not notified", i));
+			break;
+		}
+	}
+	for (i = DEEP_TREE_DEPTH; i-- != 0; ) {
+		if (i != DEEP_TREE_DEPTH / 2) {
+			nsync_note_free (node[i]);
+		}
+	}
+	free (node);
+}
+
+/* The number of notes in each tree built by test_note_concurrent_free(). */
+#define CONCURRENT_TREE_NODES 4096
+
+/* Return whether test_note_concurrent_free() frees the note at index i of
+   its tree while the root is being notified. */
+static int concurrent_free_freed (int i) {
+	return (i % 3 == 1 && i < CONCURRENT_TREE_NODES / 2);
+}
+
+/* Free the notes node[i] for which concurrent_free_freed(i), then
+   decrement done. */
+static void concurrent_free_freer (nsync_note *node, nsync_counter done) {
+	int i;
+	for (i = CONCURRENT_TREE_NODES; i-- != 0; ) {
+		if (concurrent_free_freed (i)) {
+			nsync_note_free (node[i]);
+		}
+	}
+	nsync_counter_add (done, -1);
+}
+
+CLOSURE_DECL_BODY2 (concurrent_free_freer, nsync_note *, nsync_counter)
+
+/* Notify n, then decrement done. */
+static void concurrent_free_notifier (nsync_note n, nsync_counter done) {
+	nsync_note_notify (n);
+	nsync_counter_add (done, -1);
+}
+
+CLOSURE_DECL_BODY2 (concurrent_free_notifier, nsync_note, nsync_counter)
+
+/* Test that when notes in a tree are freed while its root is notified,
+   every note that remains is notified once both have finished, whether it
+   was adopted before the notification or not.  */
+static void test_note_concurrent_free (testing t) {
+	nsync_note *node = (nsync_note *) malloc (CONCURRENT_TREE_NODES * sizeof (node[0]));
+	int round;
+	int i;
+	for (round = 0; round != 20; round++) {
+		nsync_counter done = nsync_counter_new (2);
+		node[0] = nsync_note_new (NULL, nsync_time_no_deadline);
+		for (i = 1; i != CONCURRENT_TREE_NODES; i++) {
+			node[i] = nsync_note_new (node[(i-1)/3], nsync_time_no_deadline);
+		}
+		closure_fork (closure_concurrent_free_freer (&concurrent_free_freer, node, done));
+		closure_fork (closure_concurrent_free_notifier (&concurrent_free_notifier, node[0], done));
+		nsync_counter_wait (done, nsync_time_no_deadline);
+		nsync_counter_free (done);
+		for (i = 0; i != CONCURRENT_TREE_NODES; i++) {
+			if (!concurrent_free_freed (i)) {
+				if (!nsync_note_is_notified (node[i])) {
+					TEST_ERROR (t, ("round %d: note %d is not notified", round, i));
+				}
+				nsync_note_free (node[i]);
+			}
+		}
+	}
+	free (node);
+}
+
+/* An arena for test_note_arena() that counts its allocations. */
+typedef struct counting_arena_s {
+	int allocs;     /* number of calls to counting_arena_alloc() */
+	int releases;   /* number of calls to counting_arena_release() */
+	size_t in_use;  /* bytes allocated and not yet released */
+} counting_arena;
+
+static void *counting_arena_alloc (void *arg, size_t size) {
+	counting_arena *a = (counting_arena *) arg;
+	a->allocs++;
+	a->in_use += size;
+	return (malloc (size));
+}
+
+static void counting_arena_release (void *arg, void *p, size_t size) {
+	counting_arena *a = (counting_arena *) arg;
+	a->releases++;
+	a->in_use -= size;
+	free (p);
+}
+
+/* Test that notes come from an arena supplied with nsync_set_arena(), and
+   that free memory beyond the high-water mark is returned to it. */
+static void test_note_arena (testing t) {
+	enum { count = 1000 };
+	static counting_arena a;
+	nsync_note *n = (nsync_note *) malloc (count * sizeof (n[0]));
+	int i;
+	nsync_set_arena (&counting_arena_alloc, &counting_arena_release, &a);
+	nsync_set_free_high_water (0);
+	for (i = 0; i != count; i++) {
+		n[i] = nsync_note_new (NULL, nsync_time_no_deadline);
+		if (((uintptr_t) n[i]) % 64 != 0) {
+			TEST_ERROR (t, ("note %p not aligned to a cache line", (void *) n[i]));
+		}
+	}
+	for (i = 0; i != count; i++) {
+		nsync_note_free (n[i]);
+	}
+	nsync_set_arena (NULL, NULL, NULL);
+	nsync_set_free_high_water (65536);
+	if (a.allocs == 0) {
+		TEST_ERROR (t, ("no notes allocated from arena"));
+	}
+	if (a.releases == 0 || a.releases > a.allocs) {
+		TEST_ERROR (t, ("arena allocated %d chunks, but %d were released",
+				a.allocs, a.releases));
+	}
+	free (n);
+}
+
+/* Measure the cost of creating and freeing an nsync_note as the child of
+   a long-lived note, as for the cancellation note of a request, and report
+   the number of chunks obtained from the allocator per note.  */
+static void benchmark_note_new_free (testing t) {
+	int i;
+	int n = testing_n (t);
+	uint32_t allocs = ATM_LOAD (&nsync_slab_chunk_allocs_);
+	nsync_note parent = nsync_note_new (NULL, nsync_time_no_deadline);
+	for (i = 0; i != n; i++) {
+		nsync_note_free (nsync_note_new (parent, nsync_time_no_deadline));
+	}
+	nsync_note_free (parent);
+	allocs = ATM_LOAD (&nsync_slab_chunk_allocs_) - allocs;
+	BENCHMARK_EXTRA (t, ("%.3g chunk allocations/note", ((double) allocs) / (n == 0? 1 : n)));
+}
+
+/* Measure the cost of creating a note with an expiry time, while testing_n()
+   such notes are pending in the timer, and of freeing it.  The notes are
+   freed in creation order, which is not their expiry order.  */
+static void benchmark_note_timed_new_free (testing t) {
+	int i;
+	int n = testing_n (t);
+	nsync_note *node = (nsync_note *) malloc ((n == 0? 1 : n) * sizeof (node[0]));
+	nsync_time base = nsync_time_add (nsync_time_now (), nsync_time_ms (3600 * 1000));
+	for (i = 0; i != n; i++) {
+		node[i] = nsync_note_new (NULL, nsync_time_add (base, nsync_time_ms ((i * 7919) % 100000)));
+	}
+	for (i = 0; i != n; i++) {
+		nsync_note_free (node[i]);
+	}
+	free (node);
+}
+
+/* The number of notes in each tree built by benchmark_note_notify_tree(). */
+#define NOTIFY_TREE_NODES 1024
+
+/* Measure the cost per note of notifying trees of NOTIFY_TREE_NODES notes
+   in which each note has up to fanout children, by notifying the root.
+   Building and freeing the trees is not timed.  */
+static void benchmark_note_notify_tree (testing t, int fanout) {
+	nsync_note node[NOTIFY_TREE_NODES];
+	int n = testing_n (t);
+	int i;
+	int j;
+	for (i = 0; i < n; i += NOTIFY_TREE_NODES) {
+		testing_stop_timer (t);
+		node[0] = nsync_note_new (NULL, nsync_time_no_deadline);
+		for (j = 1; j != NOTIFY_TREE_NODES; j++) {
+			node[j] = nsync_note_new (node[(j-1)/fanout], nsync_time_no_deadline);
+		}
+		testing_start_timer (t);
+		nsync_note_notify (node[0]);
+		testing_stop_timer (t);
+		for (j = 0; j != NOTIFY_TREE_NODES; j++) {
+			nsync_note_free (node[j]);
+		}
+		testing_start_timer (t);
+	}
+}
+
+/* Measure notification of a root with NOTIFY_TREE_NODES-1 children. */
+static void benchmark_note_notify_wide (testing t) {
+	benchmark_note_notify_tree (t, NOTIFY_TREE_NODES);
+}
+
+/* Measure notification of a chain of NOTIFY_TREE_NODES notes. */
+static void benchmark_note_notify_deep (testing t) {
+	benchmark_note_notify_tree (t, 1);
+}
+
 int main (int argc, char *argv[]) {
 	testing_base tb = testing_new (argc, argv, 0);
 	TEST_RUN (tb, test_note_prenotified);
@@ -328,5 +556,12 @@ int main (int argc, char *argv[]) {
 	TEST_RUN (tb, test_note_expiry);
 	TEST_RUN (tb, test_note_notify);
 	TEST_RUN (tb, test_note_in_tree);
+	TEST_RUN (tb, test_note_deep_tree);
+	TEST_RUN (tb, test_note_concurrent_free);
+	TEST_RUN (tb, test_note_arena);
+	BENCHMARK_RUN (tb, benchmark_note_new_free);
+	BENCHMARK_RUN (tb, benchmark_note_timed_new_free);
+	BENCHMARK_RUN (tb, benchmark_note_notify_wide);
+	BENCHMARK_RUN (tb, benchmark_note_notify_deep);
 	return (testing_base_exit (tb));
 }
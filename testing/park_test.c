@@ -0,0 +1,270 @@
+/* Copyright 2016 Google Inc.
+
+  Licensed under the Apache License, Version 2.0 (the "License");
+  you may not use this file except in compliance with the License.
+  You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License. */
+
+/* This tests nsync_park() and nsync_unpark_*(). */
+
+#include "platform.h"
+#include "nsync.h"
+#include "atomic.h"
+#include "time_extra.h"
+#include "smprintf.h"
+#include "closure.h"
+#include "testing.h"
+
+NSYNC_CPP_USING_
+
+/* Return zero. */
+static int validate_false (const void *addr, void *arg) {
+	(void) addr;
+	(void) arg;
+	return (0);
+}
+
+/* Test that nsync_park() does not block if its validation function returns
+   zero, and that it honours deadlines and cancellation. */
+static void test_park_timeout (testing t) {
+	int key = 0;
+	int outcome;
+	nsync_time start;
+	nsync_time waited;
+	nsync_note cancel;
+
+	outcome = nsync_park (&key, &validate_false, NULL, nsync_time_no_deadline, NULL);
+	if (outcome != EAGAIN) {
+		TEST_ERROR (t, ("nsync_park() with false validation returned %d, want EAGAIN",
+				outcome));
+	}
+	if (nsync_unpark_all (&key) != 0) {
+		TEST_ERROR (t, ("nsync_unpark_all() woke a thread, but none was parked"));
+	}
+
+	start = nsync_time_now ();
+	outcome = nsync_park (&key, NULL, NULL, nsync_time_add (start, nsync_time_ms (50)), NULL);
+	waited = nsync_time_sub (nsync_time_now (), start);
+	if (outcome != ETIMEDOUT) {
+		TEST_ERROR (t, ("nsync_park() with deadline returned %d, want ETIMEDOUT",
+				outcome));
+	}
+	if (nsync_time_cmp (waited, nsync_time_ms (40)) < 0) {
+		TEST_ERROR (t, ("nsync_park() returned after %gs, want >= 0.05s",
+				nsync_time_to_dbl (waited)));
+	}
+
+	cancel = nsync_note_new (NULL, nsync_time_add (nsync_time_now (), nsync_time_ms (50)));
+	outcome = nsync_park (&key, NULL, NULL, nsync_time_no_deadline, cancel);
+	if (outcome != ECANCELED) {
+		TEST_ERROR (t, ("nsync_park() with cancel_note returned %d, want ECANCELED",
+				outcome));
+	}
+	nsync_note_free (cancel);
+	if (nsync_unpark_all (&key) != 0) {
+		TEST_ERROR (t, ("nsync_unpark_all() woke a thread after timeouts"));
+	}
+}
+
+/* --------------------------------------- */
+
+/* The state shared by the threads of test_park_unpark_n(). */
+typedef struct park_n_s {
+	testing t;
+	nsync_atomic_uint32_ parked; /* number of threads that have parked */
+	nsync_counter running;       /* number of threads not yet woken */
+} park_n;
+
+/* The validation function of park_n_thread(): count the caller as parked. */
+static int park_n_validate (const void *addr, void *v) {
+	park_n *pn = (park_n *) v;
+	uint32_t old_value;
+	(void) addr;
+	do {
+		old_value = ATM_LOAD (&pn->parked);
+	} while (!ATM_CAS (&pn->parked, old_value, old_value+1));
+	return (1);
+}
+
+/* Park on pn until woken. */
+static void park_n_thread (park_n *pn) {
+	int outcome = nsync_park (pn, &park_n_validate, pn, nsync_time_no_deadline, NULL);
+	if (outcome != 0) {
+		TEST_ERROR (pn->t, ("nsync_park() returned %d, want 0", outcome));
+	}
+	nsync_counter_add (pn->running, -1);
+}
+
+CLOSURE_DECL_BODY1 (park_n_thread, park_n *)
+
+/* Wait until the number of threads running in *pn is n. */
+static void park_n_wait_running (park_n *pn, int n) {
+	while (nsync_counter_value (pn->running) != (uint32_t) n) {
+		nsync_time_sleep (nsync_time_ms (1));
+	}
+}
+
+/* Test that nsync_unpark_one(), nsync_unpark_n() and nsync_unpark_all() wake
+   the number of threads requested. */
+static void test_park_unpark_n (testing t) {
+	park_n pn;
+	int i;
+	int n;
+	memset ((void *) &pn, 0, sizeof (pn));
+	pn.t = t;
+	pn.running = nsync_counter_new (6);
+	for (i = 0; i != 6; i++) {
+		closure_fork (closure_park_n_thread (&park_n_thread, &pn));
+	}
+	/* A thread is queued once its validation function has run. */
+	while (ATM_LOAD (&pn.parked) != 6) {
+		nsync_time_sleep (nsync_time_ms (1));
+	}
+	if ((n = nsync_unpark_n (&pn, 2)) != 2) {
+		TEST_ERROR (t, ("nsync_unpark_n (2) woke %d threads, want 2", n));
+	}
+	park_n_wait_running (&pn, 4);
+	if ((n = nsync_unpark_one (&pn)) != 1) {
+		TEST_ERROR (t, ("nsync_unpark_one() woke %d threads, want 1", n));
+	}
+	park_n_wait_running (&pn, 3);
+	if ((n = nsync_unpark_n (&pn, 0)) != 0) {
+		TEST_ERROR (t, ("nsync_unpark_n (0) woke %d threads, want 0", n));
+	}
+	if ((n = nsync_unpark_n (&pn, 5)) != 3) {
+		TEST_ERROR (t, ("nsync_unpark_n (5) woke %d threads, want 3", n));
+	}
+	nsync_counter_wait (pn.running, nsync_time_no_deadline);
+	if ((n = nsync_unpark_all (&pn)) != 0) {
+		TEST_ERROR (t, ("nsync_unpark_all() woke %d threads, want 0", n));
+	}
+	nsync_counter_free (pn.running);
+}
+
+/* --------------------------------------- */
+
+/* A counting semaphore built on nsync_park(), as a client might build one. */
+typedef struct park_sem_s {
+	nsync_atomic_uint32_ count;
+} park_sem;
+
+/* The validation function of park_sem_p(): block only if the count is
+   zero. */
+static int park_sem_is_zero (const void *addr, void *v) {
+	(void) addr;
+	return (ATM_LOAD_ACQ (&((park_sem *) v)->count) == 0);
+}
+
+/* Wait until s->count is positive, then decrement it. */
+static void park_sem_p (park_sem *s) {
+	uint32_t c;
+	for (;;) {
+		c = ATM_LOAD (&s->count);
+		if (c != 0) {
+			if (ATM_CAS_ACQ (&s->count, c, c - 1)) {
+				return;
+			}
+		} else {
+			nsync_park (s, &park_sem_is_zero, s, nsync_time_no_deadline, NULL);
+		}
+	}
+}
+
+/* Increment s->count, and wake a thread blocked in park_sem_p(). */
+static void park_sem_v (park_sem *s) {
+	uint32_t c;
+	do {
+		c = ATM_LOAD (&s->count);
+	} while (!ATM_CAS_REL (&s->count, c, c + 1));
+	nsync_unpark_one (s);
+}
+
+/* The state shared by the threads of test_park_sem(). */
+typedef struct park_sem_test_s {
+	park_sem full;   /* count of items in buf */
+	park_sem empty;  /* count of free slots in buf */
+	nsync_mu mu;     /* protects buf, head, and tail */
+	int buf[4];
+	int head;
+	int tail;
+	int sum;         /* sum of items consumed; under mu */
+	nsync_counter done;
+} park_sem_test;
+
+/* Put the integers 1..n into pst->buf. */
+static void park_sem_producer (park_sem_test *pst, int n) {
+	int i;
+	for (i = 1; i <= n; i++) {
+		park_sem_p (&pst->empty);
+		nsync_mu_lock (&pst->mu);
+		pst->buf[pst->tail++ % 4] = i;
+		nsync_mu_unlock (&pst->mu);
+		park_sem_v (&pst->full);
+	}
+	nsync_counter_add (pst->done, -1);
+}
+
+/* Remove n integers from pst->buf, adding them to pst->sum. */
+static void park_sem_consumer (park_sem_test *pst, int n) {
+	int i;
+	for (i = 0; i != n; i++) {
+		park_sem_p (&pst->full);
+		nsync_mu_lock (&pst->mu);
+		pst->sum += pst->buf[pst->head++ % 4];
+		nsync_mu_unlock (&pst->mu);
+		park_sem_v (&pst->empty);
+	}
+	nsync_counter_add (pst->done, -1);
+}
+
+CLOSURE_DECL_BODY2 (park_sem_thread, park_sem_test *, int)
+
+/* Test a bounded buffer whose producers and consumers block in semaphores
+   built on nsync_park(). */
+static void test_park_sem (testing t) {
+	park_sem_test *pst = (park_sem_test *) malloc (sizeof (*pst));
+	int n = 20000;
+	int i;
+	memset ((void *) pst, 0, sizeof (*pst));
+	ATM_STORE (&pst->empty.count, 4);
+	pst->done = nsync_counter_new (6);
+	for (i = 0; i != 3; i++) {
+		closure_fork (closure_park_sem_thread (&park_sem_producer, pst, n));
+		closure_fork (closure_park_sem_thread (&park_sem_consumer, pst, n));
+	}
+	nsync_counter_wait (pst->done, nsync_time_no_deadline);
+	if (pst->sum != 3 * (n * (n + 1) / 2)) {
+		TEST_ERROR (t, ("park semaphore test sum %d, want %d",
+				pst->sum, 3 * (n * (n + 1) / 2)));
+	}
+	nsync_counter_free (pst->done);
+	free (pst);
+}
+
+/* --------------------------------------- */
+
+/* Measure the cost of nsync_unpark_one() when no thread is parked. */
+static void benchmark_unpark_none (testing t) {
+	int key = 0;
+	int i;
+	int n = testing_n (t);
+	for (i = 0; i != n; i++) {
+		nsync_unpark_one (&key);
+	}
+}
+
+int main (int argc, char *argv[]) {
+	testing_base tb = testing_new (argc, argv, 0);
+	TEST_RUN (tb, test_park_timeout);
+	TEST_RUN (tb, test_park_unpark_n);
+	TEST_RUN (tb, test_park_sem);
+	BENCHMARK_RUN (tb, benchmark_unpark_none);
+	return (testing_base_exit (tb));
+}
@@ -14,6 +14,8 @@
 
 #include "platform.h"
 #include "nsync.h"
+#include "atomic.h"
+#include "sem.h"
 #include "smprintf.h"
 #include "testing.h"
 #include "closure.h"
@@ -77,6 +79,23 @@ static void ping_pong_destroy (ping_pong *pp) {
 	pthread_cond_destroy (&pp->done_cond);
 }
 
+/* Reset the semaphore statistics of sem.h and start counting. */
+static void sem_stats_start (void) {
+	ATM_STORE (&nsync_mu_semaphore_sleeps_, 0);
+	ATM_STORE (&nsync_mu_semaphore_wakes_, 0);
+	ATM_STORE (&nsync_mu_semaphore_stats_enabled_, 1);
+}
+
+/* Stop counting semaphore statistics, and annotate the result of benchmark *t
+   with the number of wakeup calls into the kernel per ping-pong step, where
+   the platform counts them.  */
+static void sem_stats_report (testing t) {
+	uint32_t wakes;
+	ATM_STORE (&nsync_mu_semaphore_stats_enabled_, 0);
+	wakes = ATM_LOAD (&nsync_mu_semaphore_wakes_);
+	BENCHMARK_EXTRA (t, ("%.3g wake syscalls/op", ((double) wakes) / testing_n (t)));
+}
+
 /* --------------------------------------- */
 
 CLOSURE_DECL_BODY2 (ping_pong, ping_pong *, int)
@@ -136,13 +155,16 @@ static void mu_cv_ping_pong (ping_pong *pp, int parity) {
 }
 
 /* Measure the wakeup speed of nsync_mu/nsync_cv used to
-   ping-pong back and forth between two threads. */
+   ping-pong back and forth between two threads, and the
+   number of wakeup system calls made. */
 static void benchmark_ping_pong_mu_cv (testing t) {
 	ping_pong pp;
 	ping_pong_init (&pp, testing_n (t));
+	sem_stats_start ();
 	closure_fork (closure_ping_pong (&mu_cv_ping_pong, &pp, 0));
 	mu_cv_ping_pong (&pp, 1);
 	ping_pong_destroy (&pp);
+	sem_stats_report (t);
 }
 
 /* --------------------------------------- */
@@ -281,13 +303,16 @@ static void mu_ping_pong (ping_pong *pp, int parity) {
 }
 
 /* Measure the wakeup speed of nsync_mu's conditional
-   critical sections, used to ping-pong back and forth between two threads. */
+   critical sections, used to ping-pong back and forth between two threads,
+   and the number of wakeup system calls made. */
 static void benchmark_ping_pong_mu (testing t) {
 	ping_pong pp;
 	ping_pong_init (&pp, testing_n (t));
+	sem_stats_start ();
 	closure_fork (closure_ping_pong (&mu_ping_pong, &pp, 0));
 	mu_ping_pong (&pp, 1);
 	ping_pong_destroy (&pp);
+	sem_stats_report (t);
 }
 
 /* --------------------------------------- */
@@ -59,6 +59,7 @@ struct testing_s {
 	FILE *fp;			   /* where to output; merged into common->fp if != to it */
 	nsync_time start_time;	/* timer start time; for benchmarks */
 	nsync_time stop_time;	 /* when the timer was stopped; for benchmarks */
+	char *extra;			   /* annotation of benchmark result, or NULL */
 	void (*f) (testing);		   /* test function to run */
 	const char *name;		   /* name of test */
 	nsync_dll_element_ siblings;       /* part of list of siblings */
@@ -285,11 +286,13 @@ static void run_benchmark (testing t) {
 	} while (t->test_status == 0 && elapsed < target && n != t->n);
 	elapsed_str = nsync_time_str (nsync_time_from_dbl (elapsed), 2);
 	time_per_op_str = nsync_time_str (nsync_time_from_dbl (elapsed / t->n), 2);
-	fprintf (t->fp, "%-50s %9d %8s  %8.2g %8s%s\n", t->name, t->n, elapsed_str,
+	fprintf (t->fp, "%-50s %9d %8s  %8.2g %8s%s%s%s\n", t->name, t->n, elapsed_str,
 		 ((double)t->n) / elapsed, time_per_op_str,
+		 t->extra != NULL ? "  " : "", t->extra != NULL ? t->extra : "",
 		 t->test_status != 0 ? "  *** failed ***" : "");
 	free (elapsed_str);
 	free (time_per_op_str);
+	free (t->extra);
 	finish_run (t);
 }
 
@@ -495,6 +498,11 @@ void testing_error_ (testing t, int test_status, const char *file, int line, cha
 	free (msg);
 }
 
+void testing_extra_ (testing t, char *msg) {
+	free (t->extra);
+	t->extra = msg;
+}
+
 /* Abort after printing the nul-terminated string s[]. */
 void testing_panic (const char *s) {
 	nsync_atm_log_print_ ();
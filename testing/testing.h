@@ -58,6 +58,12 @@ int testing_longshort (testing t);
 /* Return non-zero if the user requested verbose output. */
 int testing_verbose (testing t);
 
+/* Append a printf-formatted annotation to the line reporting a benchmark's
+   result, replacing any earlier annotation.  Since the benchmark is run
+   repeatedly, only the annotation from the final run is reported.
+   Example:    BENCHMARK_EXTRA (t, ("%.3g syscalls/op", syscalls / n));  */
+#define BENCHMARK_EXTRA(t, args) testing_extra_ ((t), smprintf args);
+
 /* Output a printf-formated log message associated with *t.
    Example:    TEST_LOG (t, ("wombat %d", some_int));
    The TEST_ERROR() and TEST_FATAL() forms of the call makr the test as failing.
@@ -73,6 +79,10 @@ int testing_verbose (testing t);
 /* An internal routine used by TEST_RUN() and BENCHMARK_RUN(). */
 void testing_run_ (testing_base tb, void (*f) (testing t), const char *name, int is_benchmark);
 
+/* Record msg, which must have been allocated with malloc(), as the annotation
+   of a benchmark's result. */
+void testing_extra_ (testing t, char *msg);
+
 /* Output an error message msg, and record status. */
 void testing_error_ (testing t, int status, const char *file, int line, char *msg);
 
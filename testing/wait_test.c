@@ -177,9 +177,249 @@ static void test_wait_n_ready_while_queuing (testing t) {
 	}
 }
 
+/* The number of notes used by test_wait_n_many_notes() and
+   benchmark_wait_n_many_notes(). */
+#define MANY_NOTES 64
+
+/* Test that nsync_wait_n() on many notes returns the index of the one that is
+   notified while it waits, or of one whose deadline expires.  */
+static void test_wait_n_many_notes (testing t) {
+	struct nsync_waitable_s w[MANY_NOTES];
+	struct nsync_waitable_s *pw[MANY_NOTES];
+	int i;
+	int round;
+	for (round = 0; round != 10; round++) {
+		int target = (round * 37) % MANY_NOTES;
+		int woken;
+		nsync_counter done = nsync_counter_new (0);
+		nsync_time deadline = nsync_time_add (nsync_time_now (), nsync_time_ms (10));
+		for (i = 0; i != MANY_NOTES; i++) {
+			/* In odd rounds, the target note expires rather than
+			   being notified. */
+			nsync_time expiry = nsync_time_no_deadline;
+			if (i == target && (round & 1) != 0) {
+				expiry = deadline;
+			}
+			w[i].v = nsync_note_new (NULL, expiry);
+			w[i].funcs = &nsync_note_waitable_funcs;
+			pw[i] = &w[i];
+		}
+		if ((round & 1) == 0) {
+			nsync_counter_add (done, 1);
+			closure_fork (closure_notify (&notify_at, (nsync_note) w[target].v,
+						      deadline, done));
+		}
+		woken = nsync_wait_n (NULL, NULL, NULL, nsync_time_no_deadline, MANY_NOTES, pw);
+		if (woken != target) {
+			TEST_ERROR (t, ("nsync_wait_n() returned %d, want %d", woken, target));
+		}
+		nsync_counter_wait (done, nsync_time_no_deadline);
+		for (i = 0; i != MANY_NOTES; i++) {
+			nsync_note_free ((nsync_note) w[i].v);
+		}
+		nsync_counter_free (done);
+	}
+}
+
+/* Measure the cost of nsync_wait_n() on many notes, of which only the last
+   has been notified. */
+static void benchmark_wait_n_many_notes (testing t) {
+	struct nsync_waitable_s w[MANY_NOTES];
+	struct nsync_waitable_s *pw[MANY_NOTES];
+	int n = testing_n (t);
+	int i;
+	for (i = 0; i != MANY_NOTES; i++) {
+		w[i].v = nsync_note_new (NULL, nsync_time_no_deadline);
+		w[i].funcs = &nsync_note_waitable_funcs;
+		pw[i] = &w[i];
+	}
+	nsync_note_notify ((nsync_note) w[MANY_NOTES - 1].v);
+	for (i = 0; i != n; i++) {
+		nsync_wait_n (NULL, NULL, NULL, nsync_time_no_deadline, MANY_NOTES, pw);
+	}
+	for (i = 0; i != MANY_NOTES; i++) {
+		nsync_note_free ((nsync_note) w[i].v);
+	}
+}
+
+/* --------------------------------------- */
+
+/* Versions of nsync_mu_lock() and nsync_mu_unlock() that take "void *"
+   arguments. */
+static void void_mu_lock (void *mu) {
+	nsync_mu_lock ((nsync_mu *) mu);
+}
+static void void_mu_unlock (void *mu) {
+	nsync_mu_unlock ((nsync_mu *) mu);
+}
+
+/* Signal *cv while holding *mu, then decrement done. */
+static void signal_at (nsync_cv *cv, nsync_mu *mu, nsync_time abs_deadline, nsync_counter done) {
+	nsync_time_sleep_until (abs_deadline);
+	nsync_mu_lock (mu);
+	nsync_cv_signal (cv);
+	nsync_mu_unlock (mu);
+	nsync_counter_add (done, -1);
+}
+
+CLOSURE_DECL_BODY4 (signal, nsync_cv *, nsync_mu *, nsync_time, nsync_counter)
+
+/* Test that nsync_waitset_wait() reports ready notes for as long as they are
+   in the set, a condition variable once per signal, and a counter that
+   reaches zero, and that it returns zero at its deadline. */
+static void test_waitset (testing t) {
+	struct nsync_waitable_s w[MANY_NOTES + 2];
+	struct nsync_waitable_s *ready[MANY_NOTES + 2];
+	nsync_waitset ws = nsync_waitset_new ();
+	nsync_mu mu;
+	nsync_cv cv;
+	nsync_counter c = nsync_counter_new (1);
+	int i;
+	int n;
+	int round;
+	nsync_mu_init (&mu);
+	nsync_cv_init (&cv);
+	for (i = 0; i != MANY_NOTES; i++) {
+		w[i].v = nsync_note_new (NULL, nsync_time_no_deadline);
+		w[i].funcs = &nsync_note_waitable_funcs;
+		nsync_waitset_add (ws, &w[i]);
+	}
+	w[MANY_NOTES].v = &cv;
+	w[MANY_NOTES].funcs = &nsync_cv_waitable_funcs;
+	nsync_waitset_add (ws, &w[MANY_NOTES]);
+	w[MANY_NOTES + 1].v = c;
+	w[MANY_NOTES + 1].funcs = &nsync_counter_waitable_funcs;
+	nsync_waitset_add (ws, &w[MANY_NOTES + 1]);
+
+	n = nsync_waitset_wait (ws, NULL, NULL, NULL,
+				nsync_time_add (nsync_time_now (), nsync_time_ms (10)),
+				MANY_NOTES + 2, ready);
+	if (n != 0) {
+		TEST_ERROR (t, ("nsync_waitset_wait() on an unready set returned %d, want 0", n));
+	}
+
+	/* Each notified note is reported by the wait that follows, and by
+	   every later wait until it is removed. */
+	for (round = 0; round != 4; round++) {
+		int target = (round * 37) % MANY_NOTES;
+		nsync_counter done = nsync_counter_new (1);
+		closure_fork (closure_notify (&notify_at, (nsync_note) w[target].v,
+					      nsync_time_add (nsync_time_now (), nsync_time_ms (5)),
+					      done));
+		n = nsync_waitset_wait (ws, NULL, NULL, NULL, nsync_time_no_deadline,
+					MANY_NOTES + 2, ready);
+		if (n != 1 || ready[0] != &w[target]) {
+			TEST_ERROR (t, ("nsync_waitset_wait() returned %d waitables, want note %d",
+					n, target));
+		}
+		n = nsync_waitset_wait (ws, NULL, NULL, NULL, nsync_time_zero,
+					MANY_NOTES + 2, ready);
+		if (n != 1 || ready[0] != &w[target]) {
+			TEST_ERROR (t, ("nsync_waitset_wait() did not report note %d again", target));
+		}
+		if (!nsync_waitset_remove (ws, &w[target])) {
+			TEST_ERROR (t, ("nsync_waitset_remove() did not find note %d", target));
+		}
+		if (nsync_waitset_remove (ws, &w[target])) {
+			TEST_ERROR (t, ("nsync_waitset_remove() found note %d twice", target));
+		}
+		nsync_counter_wait (done, nsync_time_no_deadline);
+		nsync_counter_free (done);
+	}
+
+	/* A signal is reported once, to a waiter that holds mu. */
+	for (round = 0; round != 3; round++) {
+		nsync_counter done = nsync_counter_new (1);
+		nsync_mu_lock (&mu);
+		closure_fork (closure_signal (&signal_at, &cv, &mu,
+					      nsync_time_add (nsync_time_now (), nsync_time_ms (5)),
+					      done));
+		n = nsync_waitset_wait (ws, &mu, &void_mu_lock, &void_mu_unlock,
+					nsync_time_no_deadline, MANY_NOTES + 2, ready);
+		if (n != 1 || ready[0] != &w[MANY_NOTES]) {
+			TEST_ERROR (t, ("nsync_waitset_wait() returned %d waitables, want the cv", n));
+		}
+		n = nsync_waitset_wait (ws, &mu, &void_mu_lock, &void_mu_unlock,
+					nsync_time_zero, MANY_NOTES + 2, ready);
+		if (n != 0) {
+			TEST_ERROR (t, ("nsync_waitset_wait() reported %d waitables after a signal "
+					"was consumed, want 0", n));
+		}
+		nsync_mu_unlock (&mu);
+		nsync_counter_wait (done, nsync_time_no_deadline);
+		nsync_counter_free (done);
+	}
+
+	/* The counter is reported once it reaches zero, alongside the
+	   remaining notes once they are notified, subject to max.  A wait
+	   resumes after the last waitable reported by the previous one.  */
+	nsync_counter_add (c, -1);
+	for (i = 0; i != MANY_NOTES; i++) {
+		nsync_note_notify ((nsync_note) w[i].v);
+	}
+	n = nsync_waitset_wait (ws, NULL, NULL, NULL, nsync_time_no_deadline, 3, ready);
+	if (n != 3) {
+		TEST_ERROR (t, ("nsync_waitset_wait() with max 3 returned %d, want 3", n));
+	}
+	n = nsync_waitset_wait (ws, NULL, NULL, NULL, nsync_time_no_deadline, 3, ready + 3);
+	if (n != 3) {
+		TEST_ERROR (t, ("nsync_waitset_wait() with max 3 returned %d, want 3", n));
+	}
+	for (i = 0; i != 3; i++) {
+		if (ready[i] == ready[3] || ready[i] == ready[4] || ready[i] == ready[5]) {
+			TEST_ERROR (t, ("nsync_waitset_wait() with max 3 reported a waitable "
+					"twice in succession"));
+		}
+	}
+	n = nsync_waitset_wait (ws, NULL, NULL, NULL, nsync_time_no_deadline,
+				MANY_NOTES + 2, ready);
+	if (n != MANY_NOTES - 4 + 1) {
+		TEST_ERROR (t, ("nsync_waitset_wait() returned %d, want %d",
+				n, MANY_NOTES - 4 + 1));
+	}
+	for (i = 0; i != n && ready[i] != &w[MANY_NOTES + 1]; i++) {
+	}
+	if (i == n) {
+		TEST_ERROR (t, ("nsync_waitset_wait() did not report the counter"));
+	}
+
+	nsync_waitset_free (ws);
+	nsync_counter_free (c);
+	for (i = 0; i != MANY_NOTES; i++) {
+		nsync_note_free ((nsync_note) w[i].v);
+	}
+}
+
+/* Measure the cost of nsync_waitset_wait() on a set of many notes, of which
+   only the last has been notified; compare benchmark_wait_n_many_notes(). */
+static void benchmark_waitset_many_notes (testing t) {
+	struct nsync_waitable_s w[MANY_NOTES];
+	struct nsync_waitable_s *ready[1];
+	nsync_waitset ws = nsync_waitset_new ();
+	int n = testing_n (t);
+	int i;
+	for (i = 0; i != MANY_NOTES; i++) {
+		w[i].v = nsync_note_new (NULL, nsync_time_no_deadline);
+		w[i].funcs = &nsync_note_waitable_funcs;
+		nsync_waitset_add (ws, &w[i]);
+	}
+	nsync_note_notify ((nsync_note) w[MANY_NOTES - 1].v);
+	for (i = 0; i != n; i++) {
+		nsync_waitset_wait (ws, NULL, NULL, NULL, nsync_time_no_deadline, 1, ready);
+	}
+	nsync_waitset_free (ws);
+	for (i = 0; i != MANY_NOTES; i++) {
+		nsync_note_free ((nsync_note) w[i].v);
+	}
+}
+
 int main (int argc, char *argv[]) {
 	testing_base tb = testing_new (argc, argv, 0);
 	TEST_RUN (tb, test_wait_n);
 	TEST_RUN (tb, test_wait_n_ready_while_queuing);
+	TEST_RUN (tb, test_wait_n_many_notes);
+	TEST_RUN (tb, test_waitset);
+	BENCHMARK_RUN (tb, benchmark_wait_n_many_notes);
+	BENCHMARK_RUN (tb, benchmark_waitset_many_notes);
 	return (testing_base_exit (tb));
 }